@@ -0,0 +1,389 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+// clang-format on
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cxxopts.hpp"
+
+#include "config.h"
+#include "fake_sane.h"
+#include "histogram.h"
+#include "logging.h"
+#include "run_configuration.h"
+#include "sane.h"
+
+// Polls fake devices (see fake_sane.h) with the unchanged SaneHandler and PollHandler and reports, per number of
+// devices, the CPU time per device, wakeups (context switches) per second, option reads per second, the latency
+// from a button press to the start of its script and the RSS. No scanner is needed.
+using namespace scanbdpp;
+using namespace scanbdpp::fake;
+namespace fs = std::experimental::filesystem;
+
+namespace {
+    struct Press {
+        std::chrono::milliseconds offset;
+        size_t device;
+        size_t option;
+    };
+
+    struct Usage {
+        std::chrono::steady_clock::time_point time;
+        std::chrono::microseconds cpu;
+        long switches;
+        uint64_t reads;
+    };
+
+    struct Settings {
+        std::vector<size_t> device_counts{1, 8, 64, 512};
+        FakeSane::Settings fake;
+        std::chrono::milliseconds timeout{500};
+        std::chrono::milliseconds press_interval{5000};
+        std::chrono::seconds warmup{2};
+        std::chrono::seconds duration{20};
+        fs::path sequence;
+    };
+
+    Usage usage() {
+        rusage current{};
+        getrusage(RUSAGE_SELF, &current);
+
+        auto to_microseconds = [](const timeval &time) {
+            return std::chrono::seconds(time.tv_sec) + std::chrono::microseconds(time.tv_usec);
+        };
+
+        return Usage{std::chrono::steady_clock::now(),
+                     to_microseconds(current.ru_utime) + to_microseconds(current.ru_stime),
+                     current.ru_nvcsw + current.ru_nivcsw, FakeSane::reads()};
+    }
+
+    long rss_kib() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) {
+                return std::strtol(line.c_str() + 6, nullptr, 10);
+            }
+        }
+
+        return 0;
+    }
+
+    // Every device presses a random button once per interval, at a random offset
+    std::vector<Press> generate_presses(const Settings &settings, size_t devices) {
+        std::minstd_rand random(devices);
+        std::uniform_int_distribution<long> offset(0, settings.press_interval.count() - 1);
+        std::uniform_int_distribution<size_t> option(0, std::max<size_t>(settings.fake.options, 1) - 1);
+        std::vector<Press> presses;
+
+        for (auto start = std::chrono::milliseconds(0); start + settings.press_interval <= settings.duration;
+             start += settings.press_interval) {
+            for (size_t device = 0; device < devices; ++device) {
+                presses.push_back(Press{start + std::chrono::milliseconds(offset(random)), device, option(random)});
+            }
+        }
+
+        std::sort(presses.begin(), presses.end(),
+                  [](const Press &first, const Press &second) { return first.offset < second.offset; });
+        return presses;
+    }
+
+    // One press per line: <offset [ms]> <device> <option>, devices beyond the current count are skipped
+    std::vector<Press> read_sequence(const fs::path &path, size_t devices) {
+        std::ifstream sequence(path);
+        std::string line;
+        std::vector<Press> presses;
+
+        while (std::getline(sequence, line)) {
+            std::istringstream fields(line);
+            long offset;
+            size_t device;
+            size_t option;
+
+            if (line.empty() || line[0] == '#' || !(fields >> offset >> device >> option) || device >= devices) {
+                continue;
+            }
+
+            presses.push_back(Press{std::chrono::milliseconds(offset), device, option});
+        }
+
+        std::sort(presses.begin(), presses.end(),
+                  [](const Press &first, const Press &second) { return first.offset < second.offset; });
+        return presses;
+    }
+
+    // The scripts write the name of their device into the fifo
+    void write_environment(const fs::path &directory, const Settings &settings) {
+        auto fifo = directory / "scripts.fifo";
+        auto script = directory / "press.script";
+
+        if (mkfifo(fifo.c_str(), S_IRUSR | S_IWUSR) < 0) {
+            std::cerr << "Couldn't create " << fifo << " " << strerror(errno) << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+
+        {
+            std::ofstream script_file(script);
+            script_file << "#!/bin/sh\necho \"$SCANBD_DEVICE\" > " << fifo.native() << "\n";
+        }
+        chmod(script.c_str(), S_IRWXU);
+
+        std::ofstream config_file(directory / "scanbd.conf");
+        config_file << "global {\n"
+                    << "    timeout = " << settings.timeout.count() << "\n"
+                    << "    capture_output = false\n"
+                    << "    multiple_actions = true\n"
+                    << "    environment {\n"
+                    << "        device = \"SCANBD_DEVICE\"\n"
+                    << "        action = \"SCANBD_ACTION\"\n"
+                    << "    }\n"
+                    << "    action press {\n"
+                    << "        filter = \"^button-.*\"\n"
+                    << "        numerical-trigger {\n"
+                    << "            from-value = 0\n"
+                    << "            to-value = 1\n"
+                    << "        }\n"
+                    << "        script = \"" << script.native() << "\"\n"
+                    << "    }\n"
+                    << "}\n";
+    }
+
+    class ScriptListener {
+       public:
+        ScriptListener(const fs::path &fifo, size_t devices) : m_pressed(devices) {
+            for (size_t device = 0; device < devices; ++device) {
+                m_devices[FakeSane::device_name(device)] = device;
+            }
+
+            // Opened for writing as well, so it doesn't report EOF between two scripts
+            m_fd = open(fifo.c_str(), O_RDWR | O_CLOEXEC | O_NONBLOCK);
+            m_thread = std::thread(&ScriptListener::listen, this);
+        }
+
+        ~ScriptListener() {
+            m_stop = true;
+            m_thread.join();
+            close(m_fd);
+        }
+
+        void pressed(size_t device, std::chrono::steady_clock::time_point time) {
+            m_pressed[device].store(time.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        const LatencyHistogram &latency() const { return m_latency; }
+
+       private:
+        void listen() {
+            std::string pending;
+            char buf[4096];
+
+            while (!m_stop) {
+                pollfd fds{m_fd, POLLIN, 0};
+
+                if (poll(&fds, 1, 100) <= 0) {
+                    continue;
+                }
+
+                auto now = std::chrono::steady_clock::now();
+
+                for (ssize_t bytes; (bytes = read(m_fd, buf, sizeof(buf))) > 0;) {
+                    pending.append(buf, bytes);
+                }
+
+                for (size_t end; (end = pending.find('\n')) != std::string::npos; pending.erase(0, end + 1)) {
+                    auto device = m_devices.find(pending.substr(0, end));
+
+                    if (device == m_devices.end()) {
+                        continue;
+                    }
+
+                    auto pressed = m_pressed[device->second].exchange(0, std::memory_order_relaxed);
+                    if (pressed) {
+                        m_latency.record(now.time_since_epoch() - std::chrono::steady_clock::duration(pressed));
+                    }
+                }
+            }
+        }
+
+        int m_fd = -1;
+        std::atomic_bool m_stop = false;
+        std::unordered_map<std::string, size_t> m_devices;
+        std::vector<std::atomic<std::chrono::steady_clock::rep>> m_pressed;
+        LatencyHistogram m_latency;
+        std::thread m_thread;
+    };
+
+    void run(const Settings &settings, const fs::path &directory, size_t devices) {
+        auto fake = settings.fake;
+        fake.devices = devices;
+        FakeSane::configure(fake);
+
+        auto presses =
+            settings.sequence.empty() ? generate_presses(settings, devices) : read_sequence(settings.sequence, devices);
+        // Long enough to be seen by one poll cycle, short enough not to be seen again after the reopen
+        auto hold = settings.timeout * 2;
+
+        ScriptListener listener(directory / "scripts.fifo", devices);
+        SaneHandler sane;
+
+        auto start_begin = std::chrono::steady_clock::now();
+        sane.start();
+        auto start_time = std::chrono::steady_clock::now() - start_begin;
+
+        std::this_thread::sleep_for(settings.warmup);
+
+        auto begin = usage();
+        for (const auto &current_press : presses) {
+            std::this_thread::sleep_until(begin.time + current_press.offset);
+            listener.pressed(current_press.device,
+                             FakeSane::press(current_press.device, current_press.option, hold));
+        }
+        std::this_thread::sleep_until(begin.time + settings.duration);
+        auto end = usage();
+
+        // Scripts of the last presses start up to two poll intervals later
+        std::this_thread::sleep_for(settings.timeout * 4);
+        sane.stop();
+
+        double seconds = std::chrono::duration<double>(end.time - begin.time).count();
+        double cpu = std::chrono::duration<double>(end.cpu - begin.cpu).count();
+
+        std::printf("%7zu %9.1f %11.3f %10.0f %10.0f %8zu %8llu %9.2f %9.2f %9.2f %9.2f %8.1f\n", devices,
+                    std::chrono::duration<double, std::milli>(start_time).count(), cpu / seconds / devices * 100,
+                    (end.switches - begin.switches) / seconds, (end.reads - begin.reads) / seconds, presses.size(),
+                    static_cast<unsigned long long>(listener.latency().count()),
+                    listener.latency().percentile(0.5).count() / 1e6,
+                    listener.latency().percentile(0.9).count() / 1e6,
+                    listener.latency().percentile(0.99).count() / 1e6, listener.latency().max().count() / 1e6,
+                    rss_kib() / 1024.0);
+        std::fflush(stdout);
+    }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Settings settings;
+
+    cxxopts::Options options("scanbdpp_bench", "polls fake devices and reports the cost of polling");
+
+    // clang-format off
+    options.add_options()
+        ("d,devices", "comma separated numbers of devices (1,8,64,512)", cxxopts::value<std::string>())
+        ("o,options", "buttons per device (1)", cxxopts::value<int>())
+        ("l,latency", "latency of an option read in us (200)", cxxopts::value<int>())
+        ("b,bus", "devices per USB bus (4)", cxxopts::value<int>())
+        ("t,timeout", "poll interval in ms (500)", cxxopts::value<int>())
+        ("i,interval", "every device is pressed once per interval in ms (5000)", cxxopts::value<int>())
+        ("s,sequence", "presses from a file, <offset ms> <device> <option> per line", cxxopts::value<std::string>())
+        ("w,warmup", "seconds before measuring (2)", cxxopts::value<int>())
+        ("r,duration", "seconds to measure per number of devices (20)", cxxopts::value<int>())
+        ("h,help", "print this help menu");
+    // clang-format on
+
+    try {
+        options.parse(argc, argv);
+
+        if (options.count("help")) {
+            std::cout << options.help() << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        if (options.count("devices")) {
+            settings.device_counts.clear();
+            std::istringstream counts(options["devices"].as<std::string>());
+
+            for (std::string count; std::getline(counts, count, ',');) {
+                settings.device_counts.push_back(std::max(std::stoul(count), 1ul));
+            }
+        }
+
+        if (options.count("options")) {
+            settings.fake.options = std::max(options["options"].as<int>(), 1);
+        }
+        if (options.count("latency")) {
+            settings.fake.read_latency = std::chrono::microseconds(std::max(options["latency"].as<int>(), 0));
+        }
+        if (options.count("bus")) {
+            settings.fake.devices_per_bus = std::max(options["bus"].as<int>(), 1);
+        }
+        if (options.count("timeout")) {
+            settings.timeout = std::chrono::milliseconds(std::max(options["timeout"].as<int>(), 1));
+        }
+        if (options.count("interval")) {
+            settings.press_interval = std::chrono::milliseconds(std::max(options["interval"].as<int>(), 1));
+        }
+        if (options.count("sequence")) {
+            settings.sequence = options["sequence"].as<std::string>();
+        }
+        if (options.count("warmup")) {
+            settings.warmup = std::chrono::seconds(std::max(options["warmup"].as<int>(), 0));
+        }
+        if (options.count("duration")) {
+            settings.duration = std::chrono::seconds(std::max(options["duration"].as<int>(), 1));
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Invalid arguments" << '\n' << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    char directory_template[] = "/tmp/scanbdpp_bench.XXXXXX";
+    if (!mkdtemp(directory_template)) {
+        std::cerr << "Couldn't create a temporary directory " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    fs::path directory = directory_template;
+    write_environment(directory, settings);
+
+    RunConfiguration run_config;
+    run_config.foreground(true);
+    run_config.config_path(directory / "scanbd.conf");
+
+    // Only errors, the scripts of hundreds of devices would flood the output
+    Logging logging;
+    logging.start(true);
+    logging.level(true, 1);
+    logging.start_async();
+
+    if (Config config; !config) {
+        std::cerr << "Couldn't load the generated config" << std::endl;
+        fs::remove_all(directory);
+        return EXIT_FAILURE;
+    }
+
+    std::printf("%zu options per device, %lld us per read, %lld ms poll interval, press every %lld ms\n",
+                settings.fake.options, static_cast<long long>(settings.fake.read_latency.count()),
+                static_cast<long long>(settings.timeout.count()),
+                static_cast<long long>(settings.press_interval.count()));
+    std::printf("%7s %9s %11s %10s %10s %8s %8s %9s %9s %9s %9s %8s\n", "devices", "start ms", "cpu/dev %",
+                "wakeups/s", "reads/s", "presses", "scripts", "p50 ms", "p90 ms", "p99 ms", "max ms", "rss MiB");
+
+    for (auto devices : settings.device_counts) {
+        run(settings, directory, devices);
+    }
+
+    logging.stop();
+    fs::remove_all(directory);
+    return EXIT_SUCCESS;
+}
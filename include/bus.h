@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace scanbdpp {
+    struct UsbLocation {
+        unsigned int bus;
+        unsigned int device;
+        // Port path as in /sys/bus/usb/devices (e.g. 1-1.2), empty if the device isn't found in sysfs
+        std::string port_path;
+    };
+
+    // SANE names of USB devices contain libusb:BBB:DDD, network devices don't have a location
+    std::optional<UsbLocation> usb_location(const std::string &device_name);
+
+    // Devices on the same USB bus read their options one after another, devices on different buses (and network
+    // devices) in parallel. The time spent waiting for the bus and reading is collected per bus.
+    // A device, which waits longer than its read deadline, gets no bus (try_lock), so one wedged device can't stall
+    // the others for longer than that.
+    class BusScheduler {
+       private:
+        struct Bus {
+            std::timed_mutex mutex;
+            size_t devices = 0;
+            uint64_t reads = 0;
+            std::chrono::nanoseconds wait_time{0};
+            std::chrono::nanoseconds read_time{0};
+            std::chrono::nanoseconds max_read_time{0};
+        };
+
+       public:
+        // Holds the bus until it is destroyed
+        class Guard {
+           public:
+            Guard() = default;
+            Guard(const Guard &) = delete;
+            Guard(Guard &&other);
+            ~Guard();
+
+            Guard &operator=(const Guard &) = delete;
+
+           private:
+            // The bus is already locked, waiting for it started at wait_start
+            Guard(Bus *bus, std::chrono::steady_clock::time_point wait_start);
+
+            Bus *m_bus = nullptr;
+            std::chrono::steady_clock::time_point m_start;
+
+            friend class BusScheduler;
+        };
+
+        // Returns the slot of the device on its bus
+        size_t add(const std::string &bus) const;
+        size_t devices(const std::string &bus) const;
+        void clear() const;
+
+        Guard lock(const std::string &bus) const;
+        // Empty, if the bus wasn't free within timeout
+        std::optional<Guard> try_lock(const std::string &bus, std::chrono::milliseconds timeout) const;
+        std::string status() const;
+
+       private:
+        static inline std::map<std::string, std::unique_ptr<Bus>> _buses;
+        static inline std::mutex _buses_mutex;
+
+        Bus *find(const std::string &bus) const;
+    };
+}  // namespace scanbdpp
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -19,6 +20,8 @@ namespace scanbdpp {
         std::optional<T> get(const confusepp::path& element_path) const;
         void reload_config();
 
+        unsigned int generation() const;
+
         explicit operator bool() const;
 
         class Constants final {
@@ -45,6 +48,66 @@ namespace scanbdpp {
             static inline const confusepp::path script = C_SCRIPT;
             static constexpr char script_def[] = C_SCRIPT_DEF;
 
+            static inline const confusepp::path plugin = C_PLUGIN;
+            static constexpr char plugin_def[] = C_PLUGIN_DEF;
+
+            static inline const confusepp::path symbol = C_SYMBOL;
+            static constexpr char symbol_def[] = C_SYMBOL_DEF;
+
+            static inline const confusepp::path deadline = C_DEADLINE;
+            static constexpr int deadline_def = C_DEADLINE_DEF;
+
+            static inline const confusepp::path limits = C_LIMITS;
+
+            static inline const confusepp::path kill_delay = C_KILL_DELAY;
+            static constexpr int kill_delay_def = C_KILL_DELAY_DEF;
+
+            static inline const confusepp::path address_space = C_ADDRESS_SPACE;
+            static constexpr int address_space_def = C_ADDRESS_SPACE_DEF;
+
+            static inline const confusepp::path cpu_time = C_CPU_TIME;
+            static constexpr int cpu_time_def = C_CPU_TIME_DEF;
+
+            static inline const confusepp::path nice = C_NICE;
+            static constexpr int nice_def = C_NICE_DEF;
+
+            static inline const confusepp::path ionice_class = C_IONICE_CLASS;
+            static constexpr int ionice_class_def = C_IONICE_CLASS_DEF;
+
+            static inline const confusepp::path ionice_level = C_IONICE_LEVEL;
+            static constexpr int ionice_level_def = C_IONICE_LEVEL_DEF;
+
+            static inline const confusepp::path cgroup = C_CGROUP;
+            static constexpr char cgroup_def[] = C_CGROUP_DEF;
+
+            static inline const confusepp::path scan_directory = C_SCAN_DIRECTORY;
+
+            static inline const confusepp::path scan_source = C_SCAN_SOURCE;
+            static constexpr char scan_source_def[] = C_SCAN_SOURCE_DEF;
+
+            static inline const confusepp::path scan_pages = C_SCAN_PAGES;
+            static constexpr int scan_pages_def = C_SCAN_PAGES_DEF;
+
+            static inline const confusepp::path order = C_ORDER;
+            static constexpr int order_def = C_ORDER_DEF;
+
+            static inline const confusepp::path trigger = C_TRIGGER;
+            static constexpr char trigger_def[] = C_TRIGGER_DEF;
+
+            static inline const confusepp::path debounce = C_DEBOUNCE;
+            static constexpr int debounce_def = C_DEBOUNCE_DEF;
+
+            static inline const confusepp::path min_interval = C_MIN_INTERVAL;
+            static constexpr int min_interval_def = C_MIN_INTERVAL_DEF;
+
+            static inline const confusepp::path skip_while_running = C_SKIP_WHILE_RUNNING;
+            static constexpr bool skip_while_running_def = C_SKIP_WHILE_RUNNING_DEF;
+
+            static inline const confusepp::path worker = C_WORKER;
+            static constexpr char worker_def[] = C_WORKER_DEF;
+            static constexpr char worker_action[] = C_WORKER_ACTION;
+            static constexpr char worker_device[] = C_WORKER_DEVICE;
+
             static inline const confusepp::path env = C_ENV;
             static constexpr char env_function_def[] = C_ENV_FUNCTION_DEF;
 
@@ -89,9 +152,42 @@ namespace scanbdpp {
             static inline const confusepp::path timeout = C_TIMEOUT;
             static constexpr int timeout_def = C_TIMEOUT_DEF;
 
+            static inline const confusepp::path read_deadline = C_READ_DEADLINE;
+            static constexpr int read_deadline_def = C_READ_DEADLINE_DEF;
+
+            static inline const confusepp::path open_retries = C_OPEN_RETRIES;
+            static constexpr int open_retries_def = C_OPEN_RETRIES_DEF;
+
             static inline const confusepp::path pidfile = C_PIDFILE;
             static constexpr char pidfile_def[] = C_PIDFILE_DEF;
 
+            static inline const confusepp::path launcher = C_LAUNCHER;
+            static constexpr bool launcher_def = C_LAUNCHER_DEF;
+
+            static inline const confusepp::path option_snapshot = C_OPTION_SNAPSHOT;
+            static constexpr bool option_snapshot_def = C_OPTION_SNAPSHOT_DEF;
+
+            static inline const confusepp::path event_socket = C_EVENT_SOCKET;
+            static constexpr char event_socket_def[] = C_EVENT_SOCKET_DEF;
+
+            static inline const confusepp::path capture_output = C_CAPTURE_OUTPUT;
+            static constexpr bool capture_output_def = C_CAPTURE_OUTPUT_DEF;
+
+            static inline const confusepp::path isolation = C_ISOLATION;
+            static constexpr char isolation_def[] = C_ISOLATION_DEF;
+
+            static inline const confusepp::path metrics_file = C_METRICS_FILE;
+            static constexpr char metrics_file_def[] = C_METRICS_FILE_DEF;
+
+            static inline const confusepp::path metrics_socket = C_METRICS_SOCKET;
+            static constexpr char metrics_socket_def[] = C_METRICS_SOCKET_DEF;
+
+            static inline const confusepp::path metrics_interval = C_METRICS_INTERVAL;
+            static constexpr int metrics_interval_def = C_METRICS_INTERVAL_DEF;
+
+            static inline const confusepp::path trace = C_TRACE;
+            static constexpr bool trace_def = C_TRACE_DEF;
+
             static inline const confusepp::path environment = C_ENVIRONMENT;
 
             static inline const confusepp::path function = C_FUNCTION;
@@ -109,6 +205,7 @@ namespace scanbdpp {
        private:
         inline static std::unique_ptr<confusepp::Config> _config;
         inline static std::mutex _config_mutex;
+        inline static std::atomic_uint _generation = 0;
     };
 
     template<typename T>
@@ -126,6 +223,4 @@ namespace scanbdpp {
 
     std::experimental::filesystem::path make_script_path_absolute(
         const std::experimental::filesystem::path& script_path);
-
-    std::vector<std::string> environment();
 }  // namespace scanbdpp
@@ -1,8 +1,12 @@
 #pragma once
 
+#include "scanbdpp_plugin.h"
+
 // TODO correct paths for pipe and pid file
 
 #define PIPE_PATH "scanbd.pipe"
+#define STATUS_PATH "scanbd.status"
+#define TRACE_PATH "scanbd.trace.json"
 
 #define SANE_REINIT_TIMEOUT 3
 
@@ -26,6 +30,66 @@
 #define C_SCRIPT "script"
 #define C_SCRIPT_DEF ""
 
+#define C_PLUGIN "plugin"
+#define C_PLUGIN_DEF ""
+
+#define C_SYMBOL "symbol"
+#define C_SYMBOL_DEF SCANBDPP_PLUGIN_DEFAULT_SYMBOL
+
+#define C_DEADLINE "deadline"
+#define C_DEADLINE_DEF 0
+
+#define C_LIMITS "limits"
+
+#define C_KILL_DELAY "kill_delay"
+#define C_KILL_DELAY_DEF 5000
+
+#define C_ADDRESS_SPACE "address_space"
+#define C_ADDRESS_SPACE_DEF 0
+
+#define C_CPU_TIME "cpu_time"
+#define C_CPU_TIME_DEF 0
+
+#define C_NICE "nice"
+#define C_NICE_DEF 0
+
+#define C_IONICE_CLASS "ionice_class"
+#define C_IONICE_CLASS_DEF 0
+
+#define C_IONICE_LEVEL "ionice_level"
+#define C_IONICE_LEVEL_DEF 4
+
+#define C_CGROUP "cgroup"
+#define C_CGROUP_DEF ""
+
+#define C_SCAN_DIRECTORY "scan_directory"
+
+#define C_SCAN_SOURCE "scan_source"
+#define C_SCAN_SOURCE_DEF ""
+
+#define C_SCAN_PAGES "scan_pages"
+#define C_SCAN_PAGES_DEF 1
+
+#define C_ORDER "order"
+#define C_ORDER_DEF 0
+
+#define C_TRIGGER "trigger"
+#define C_TRIGGER_DEF ""
+
+#define C_DEBOUNCE "debounce"
+#define C_DEBOUNCE_DEF 0
+
+#define C_MIN_INTERVAL "min_interval"
+#define C_MIN_INTERVAL_DEF 0
+
+#define C_SKIP_WHILE_RUNNING "skip_while_running"
+#define C_SKIP_WHILE_RUNNING_DEF false
+
+#define C_WORKER "worker"
+#define C_WORKER_DEF ""
+#define C_WORKER_ACTION "action"
+#define C_WORKER_DEVICE "device"
+
 #define C_ENV "env"
 #define C_ENV_FUNCTION "SCANBD_FUNCTION"
 #define C_ENV_FUNCTION_DEF "SCANBD_FUNCTION"
@@ -75,9 +139,42 @@
 #define C_TIMEOUT "timeout"
 #define C_TIMEOUT_DEF 500
 
+#define C_READ_DEADLINE "read_deadline"
+#define C_READ_DEADLINE_DEF 2000
+
+#define C_OPEN_RETRIES "open_retries"
+#define C_OPEN_RETRIES_DEF 10
+
 #define C_PIDFILE "pidfile"
 #define C_PIDFILE_DEF "scanbd.pid"
 
+#define C_LAUNCHER "launcher"
+#define C_LAUNCHER_DEF false
+
+#define C_OPTION_SNAPSHOT "option_snapshot"
+#define C_OPTION_SNAPSHOT_DEF false
+
+#define C_EVENT_SOCKET "event_socket"
+#define C_EVENT_SOCKET_DEF ""
+
+#define C_CAPTURE_OUTPUT "capture_output"
+#define C_CAPTURE_OUTPUT_DEF true
+
+#define C_ISOLATION "isolation"
+#define C_ISOLATION_DEF ""
+
+#define C_METRICS_FILE "metrics_file"
+#define C_METRICS_FILE_DEF ""
+
+#define C_METRICS_SOCKET "metrics_socket"
+#define C_METRICS_SOCKET_DEF ""
+
+#define C_METRICS_INTERVAL "metrics_interval"
+#define C_METRICS_INTERVAL_DEF 15
+
+#define C_TRACE "trace"
+#define C_TRACE_DEF false
+
 #define C_ENVIRONMENT "environment"
 
 #define C_FUNCTION "function"
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <optional>
 #include <string>
 
 #include "defines.h"
+#include "environment.h"
 
 namespace scanbdpp {
     class DeviceEvents {
@@ -15,5 +17,9 @@ namespace scanbdpp {
                             const std::string &device_name);
         void hook_device_insert(const std::string &device_name);
         void hook_device_remove(const std::string &device_name);
+        Environment &environment();
+
+        std::optional<Environment> m_environment;
+        unsigned int m_config_generation = 0;
     };
 }  // namespace scanbdpp
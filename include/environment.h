@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace scanbdpp {
+    // Environment of the scripts. The static part (PATH, PWD, USER, HOME and the names of the configured
+    // variables) is computed once, when the environment is created. The variables of a trigger are appended
+    // to the same buffer and removed again with reset(), so once the buffers are large enough building the
+    // envp array doesn't allocate anymore.
+    class Environment {
+       public:
+        Environment();
+
+        Environment &reset();
+        Environment &device(std::string_view device_name);
+        Environment &action(std::string_view action_name);
+        Environment &add(std::string_view name, std::string_view value);
+        template<typename T>
+        std::enable_if_t<std::is_arithmetic_v<T>, Environment &> add(std::string_view name, const T &value);
+
+        char *const *envp();
+        std::string_view dynamic_entries() const;
+        size_t size() const;
+
+       private:
+        std::vector<char> m_arena;
+        std::vector<size_t> m_offsets;
+        std::vector<char *> m_envp;
+        size_t m_static_arena_size = 0;
+        size_t m_static_offsets_size = 0;
+        std::string m_device_env;
+        std::string m_action_env;
+    };
+
+    template<typename T>
+    std::enable_if_t<std::is_arithmetic_v<T>, Environment &> Environment::add(std::string_view name, const T &value) {
+        char buf[64];
+        size_t length = 0;
+
+        if constexpr (std::is_floating_point_v<T>) {
+            // Same format as std::to_string
+            int written = std::snprintf(buf, sizeof(buf), "%f", static_cast<double>(value));
+            length = written < 0 ? 0 : std::min(static_cast<size_t>(written), sizeof(buf) - 1);
+        } else if constexpr (std::is_same_v<T, bool>) {
+            buf[0] = value ? '1' : '0';
+            length = 1;
+        } else {
+            length = std::to_chars(buf, buf + sizeof(buf), value).ptr - buf;
+        }
+
+        return add(name, std::string_view(buf, length));
+    }
+}  // namespace scanbdpp
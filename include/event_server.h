@@ -0,0 +1,85 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <deque>
+#include <experimental/filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace scanbdpp {
+    struct Event {
+        enum struct Type { BUTTON, INSERT, REMOVE, SCRIPT, SCAN };
+
+        Type type;
+        std::string device;
+        std::string action;
+        // Exit status of a script or number of scanned pages
+        int value = 0;
+    };
+
+    // Events of polling worker processes are sent to the supervisor as "event\n<type>\n<value>\n<device>\n<action>"
+    std::string serialize_event(const Event &event);
+    std::optional<Event> parse_event(const std::string &message);
+
+    // Streams events to clients of a local SOCK_SEQPACKET socket, one JSON object per packet:
+    // {"type":"button|insert|remove|script|scan","device":"...","action":"...","value":0,"time":<ms>}
+    // A client can send "device=<regex>" and "action=<regex>" lines at any time to filter the events.
+    // Every subscriber has a bounded queue, if a client doesn't keep up the oldest events are dropped,
+    // so publishing never blocks the poll threads.
+    class EventServer {
+       public:
+        EventServer();
+        ~EventServer();
+
+        void start() const;
+        void stop() const;
+
+        void publish(const Event &event) const;
+        // Worker processes don't serve the socket, they send every event over fd to the supervisor
+        void forward(int fd) const;
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr size_t max_subscribers = 16;
+            static inline constexpr size_t max_queue_size = 256;
+            static inline constexpr size_t max_filter_size = 1024;
+        };
+
+       private:
+        struct Subscriber {
+            int fd;
+            std::regex device_filter;
+            std::regex action_filter;
+            bool filter_device = false;
+            bool filter_action = false;
+            std::deque<std::shared_ptr<const std::string>> queue;
+            size_t dropped = 0;
+        };
+
+        static void server_thread(int listen_fd);
+        static void accept_subscriber(int listen_fd);
+        static bool read_filter(Subscriber &subscriber);
+        static bool send_queued(Subscriber &subscriber);
+        static void wake_up();
+
+        static inline bool _thread_started = false;
+        static inline std::atomic_bool _thread_stop = false;
+        static inline std::thread _thread_inst;
+        static inline std::experimental::filesystem::path _socket_path;
+        static inline int _wake_fd = -1;
+        static inline std::atomic_int _forward_fd = -1;
+        static inline std::vector<std::unique_ptr<Subscriber>> _subscribers;
+        static inline std::mutex _subscriber_mutex;
+        static inline std::recursive_mutex _instance_mutex;
+        static inline std::atomic_int _instance_count = 0;
+    };
+}  // namespace scanbdpp
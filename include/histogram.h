@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace scanbdpp {
+    // e.g. "1.73 ms", used by the reports of the histograms and buses
+    std::string format_time(std::chrono::nanoseconds time);
+
+    // Latencies in fixed buckets, recording is a few relaxed atomic increments, so it can be done for every
+    // option read. Percentiles are reported as the upper bound of their bucket.
+    class LatencyHistogram {
+       public:
+        static inline constexpr std::array<std::chrono::microseconds, 16> bounds{
+            std::chrono::microseconds(100),  std::chrono::microseconds(250),    std::chrono::microseconds(500),
+            std::chrono::milliseconds(1),    std::chrono::microseconds(2500),   std::chrono::milliseconds(5),
+            std::chrono::milliseconds(10),   std::chrono::milliseconds(25),     std::chrono::milliseconds(50),
+            std::chrono::milliseconds(100),  std::chrono::milliseconds(250),    std::chrono::milliseconds(500),
+            std::chrono::seconds(1),         std::chrono::microseconds(2500000), std::chrono::seconds(5),
+            std::chrono::seconds(10)};
+
+        LatencyHistogram() = default;
+        LatencyHistogram(const LatencyHistogram &other);
+
+        LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+        void record(std::chrono::nanoseconds latency);
+
+        uint64_t count() const;
+        // Count of bucket index, the last bucket (bounds.size()) holds everything above the last bound
+        uint64_t bucket(size_t index) const;
+        std::chrono::nanoseconds sum() const;
+        std::chrono::nanoseconds max() const;
+        std::chrono::nanoseconds percentile(double fraction) const;
+
+        // e.g. "12 reads, p50 1.00 ms, p99 2.50 ms, max 1.73 ms"
+        std::string summary(const std::string &unit) const;
+
+       private:
+        std::array<std::atomic<uint64_t>, bounds.size() + 1> m_buckets{};
+        std::atomic<uint64_t> m_count = 0;
+        std::atomic<int64_t> m_sum = 0;
+        std::atomic<int64_t> m_max = 0;
+    };
+}  // namespace scanbdpp
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common.h"
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace scanbdpp {
+    enum struct IsolationMode { NONE, DEVICE, BACKEND };
+
+    // Reads the isolation option of the global section, unknown values disable the isolation
+    IsolationMode isolation_mode();
+
+    // With isolation = "device" or "backend" the devices aren't polled by threads of the daemon, but by worker
+    // processes (scanbd --worker <fd>), one per device or per SANE backend. A crashing backend only takes down its
+    // own worker, backends with global state are polled in parallel.
+    // Every worker is connected by a SOCK_SEQPACKET socketpair: the supervisor sends the devices and the control
+    // messages (trigger, status, stop), the worker sends its events and status reports back. Crashed workers are
+    // restarted with an exponential backoff, which is reset once a worker ran for stable_time.
+    class IsolationSupervisor {
+       public:
+        bool start(IsolationMode mode) const;
+        void stop() const;
+        bool running() const;
+
+        // Returns false, if no worker polls the device
+        bool trigger_action(const std::string &device_name, const std::string &action_name) const;
+        std::string status() const;
+
+        // Runs in the worker process until the supervisor sends stop or goes away, returns the exit code
+        static int worker_main(int control_socket);
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr size_t max_message_size = 64 * 1024;
+            static inline constexpr std::chrono::milliseconds min_backoff = std::chrono::seconds(1);
+            static inline constexpr std::chrono::milliseconds max_backoff = std::chrono::seconds(60);
+            static inline constexpr std::chrono::seconds stable_time = std::chrono::seconds(60);
+            static inline constexpr std::chrono::seconds stop_timeout = std::chrono::seconds(5);
+            static inline constexpr std::chrono::seconds status_timeout = std::chrono::seconds(1);
+        };
+
+       private:
+        struct WorkerProcess {
+            std::string name;
+            std::vector<std::string> devices;
+            pid_t pid = -1;
+            int socket = -1;
+            std::chrono::steady_clock::time_point started;
+            std::chrono::steady_clock::time_point next_start;
+            std::chrono::milliseconds backoff{0};
+            unsigned int restarts = 0;
+            // The worker found nothing to poll and exited, it isn't restarted
+            bool idle = false;
+            std::string last_exit;
+            std::string report;
+            bool report_pending = false;
+        };
+
+        static bool spawn(WorkerProcess &worker);
+        static void reap(WorkerProcess &worker);
+        static void schedule_restart(WorkerProcess &worker);
+        static void handle_message(WorkerProcess &worker, const std::string &message);
+        static void supervisor_thread();
+        static void wake_up();
+
+        static inline bool _thread_started = false;
+        static inline std::atomic_bool _thread_stop = false;
+        // Set by stop, the supervisor thread reaps the exiting workers without restarting them
+        static inline std::atomic_bool _workers_stopping = false;
+        static inline std::thread _thread_inst;
+        static inline int _wake_fd = -1;
+        static inline std::vector<std::unique_ptr<WorkerProcess>> _workers;
+        static inline std::mutex _worker_mutex;
+        static inline std::condition_variable _report_condition;
+        static inline std::recursive_mutex _instance_mutex;
+    };
+}  // namespace scanbdpp
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "common.h"
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "script.h"
+
+namespace scanbdpp {
+
+    // Small helper process, which is forked before any threads are started or sane is initialized.
+    // The daemon sends it the scripts it should start, the launcher forks them from its own small address
+    // space with the real uid and gid of the action or of the configured user and reports the pid and the exit
+    // status back.
+    class Launcher {
+       public:
+        bool start(uid_t uid, gid_t gid) const;
+        void stop() const;
+        bool running() const;
+
+        ScriptResult run(const Script &script, char *const envp[], const ScriptLimits &limits,
+                         const std::vector<Redirection> &redirections,
+                         const std::function<void(pid_t)> &started) const;
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr size_t max_request_size = 64 * 1024;
+            static inline constexpr size_t max_redirections = 8;
+        };
+
+       private:
+        struct RequestHeader {
+            uint32_t uid;
+            uint32_t gid;
+            uint32_t argc;
+            uint32_t envc;
+            uint32_t redirection_count;
+            int32_t redirection_targets[Constants::max_redirections];
+            uint64_t address_space;
+            uint64_t cpu_time;
+            int32_t nice;
+            int32_t ionice_class;
+            int32_t ionice_level;
+        };
+
+        enum struct ReplyType : int32_t { PID, STATUS, ERROR };
+
+        struct Reply {
+            ReplyType type;
+            int32_t value;
+        };
+
+        [[noreturn]] static void launcher_main(int control_socket);
+        static bool handle_request(int control_socket, std::vector<std::pair<pid_t, int>> &children);
+
+        static inline int _control_socket = -1;
+        static inline pid_t _launcher_pid = -1;
+        static inline uid_t _uid = 0;
+        static inline gid_t _gid = 0;
+        static inline std::mutex _instance_mutex;
+    };
+}  // namespace scanbdpp
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+namespace scanbdpp {
+    // Creates the logger of scanbd. It logs synchronously until the daemon has forked (daemonize, launcher), then
+    // start_async replaces it with an asynchronous logger, so syslog writes don't block the poll threads. When the
+    // bounded queue is full, messages are dropped instead of blocking. start_async also starts the thread, which
+    // reports suppressed messages (see Logger), once their window ended.
+    class Logging {
+       public:
+        void start(bool foreground) const;
+        void start_async() const;
+        // debug-level: 1 = error, 2 = warn, 3 = info, 4-7 = debug, without debug info is logged
+        void level(bool debug, int debug_level) const;
+        // Reports all suppressed messages and flushes the queue, afterwards messages are dropped
+        void stop() const;
+
+        static spdlog::logger *current() { return _current.load(std::memory_order_acquire); }
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr char logger_name[] = "logger";
+            // Has to be a power of two
+            static inline constexpr size_t queue_size = 8192;
+            static inline constexpr std::chrono::seconds flush_interval = std::chrono::seconds(1);
+        };
+
+       private:
+        static void replace(std::shared_ptr<spdlog::logger> logger);
+        static void flush_thread();
+
+        // Loggers are never destroyed before exit, a thread might still use the previous one
+        static inline std::vector<std::shared_ptr<spdlog::logger>> _loggers;
+        static inline std::thread _flush_thread_inst;
+        static inline bool _flush_stop = false;
+        static inline std::atomic<spdlog::logger *> _current = nullptr;
+        static inline bool _foreground = false;
+        static inline spdlog::level::level_enum _level = spdlog::level::info;
+    };
+
+    namespace detail {
+        // Returns the number of messages with this format, which were suppressed in the previous window and not
+        // reported yet, or nothing if this message is suppressed as well
+        std::optional<uint64_t> admit_message(spdlog::level::level_enum level, const char *format);
+    }  // namespace detail
+
+    // Handle of the current logger, which is cached by Logging instead of being looked up in the spdlog registry
+    // (under a mutex) for every message. Only messages, which are logged as repeating (e.g. udev events of a
+    // flapping device), are rate limited: per format string they are logged Constants::burst times per
+    // Constants::window, the count of the suppressed ones is reported, once the window ended.
+    class Logger {
+       public:
+        template<typename... Args>
+        void debug(const char *format, const Args &... args) const {
+            log(spdlog::level::debug, format, args...);
+        }
+
+        template<typename... Args>
+        void info(const char *format, const Args &... args) const {
+            log(spdlog::level::info, format, args...);
+        }
+
+        template<typename... Args>
+        void warn(const char *format, const Args &... args) const {
+            log(spdlog::level::warn, format, args...);
+        }
+
+        template<typename... Args>
+        void error(const char *format, const Args &... args) const {
+            log(spdlog::level::err, format, args...);
+        }
+
+        template<typename... Args>
+        void critical(const char *format, const Args &... args) const {
+            log(spdlog::level::critical, format, args...);
+        }
+
+        // format has to be a string literal, it identifies the message
+        template<typename... Args>
+        void repeating_debug(const char *format, const Args &... args) const {
+            log_repeating(spdlog::level::debug, format, args...);
+        }
+
+        template<typename... Args>
+        void repeating_info(const char *format, const Args &... args) const {
+            log_repeating(spdlog::level::info, format, args...);
+        }
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr std::chrono::seconds window = std::chrono::seconds(60);
+            static inline constexpr unsigned int burst = 5;
+        };
+
+       private:
+        template<typename... Args>
+        void log(spdlog::level::level_enum level, const char *format, const Args &... args) const {
+            if (auto current = Logging::current(); current) {
+                current->log(level, format, args...);
+            }
+        }
+
+        template<typename... Args>
+        void log_repeating(spdlog::level::level_enum level, const char *format, const Args &... args) const {
+            auto current = Logging::current();
+
+            if (!current || !current->should_log(level)) {
+                return;
+            }
+
+            auto suppressed = detail::admit_message(level, format);
+
+            if (!suppressed) {
+                return;
+            }
+
+            if (*suppressed) {
+                current->log(level, "Suppressed {0} messages like the next one", *suppressed);
+            }
+
+            current->log(level, format, args...);
+        }
+    };
+
+    inline const Logger logger{};
+}  // namespace scanbdpp
+
+// Debug messages and their arguments are compiled out of release builds
+#ifdef SCANBDPP_DEBUG_LOG
+#define SCANBDPP_LOG_DEBUG(...) ::scanbdpp::logger.debug(__VA_ARGS__)
+#else
+#define SCANBDPP_LOG_DEBUG(...) (void)0
+#endif
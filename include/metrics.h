@@ -0,0 +1,82 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <experimental/filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "histogram.h"
+
+namespace scanbdpp {
+    // Counters, gauges and latency histograms in the Prometheus text format. A metric is looked up once by name and
+    // labels, the caller keeps the returned reference, which is valid as long as the daemon runs. Recording is a
+    // relaxed atomic operation, so it can be done in the poll loop.
+    // The export thread rewrites metrics_file every metrics_interval seconds (write and rename, so readers never
+    // see a partial file) and answers every connection to the SOCK_STREAM socket metrics_socket with the metrics.
+    class Metrics {
+       public:
+        using Counter = std::atomic<uint64_t>;
+        using Gauge = std::atomic<int64_t>;
+        using Labels = std::vector<std::pair<std::string, std::string>>;
+
+        Metrics();
+        ~Metrics();
+
+        void start() const;
+        void stop() const;
+
+        Counter &counter(const std::string &name, const std::string &help, const Labels &labels = {}) const;
+        Gauge &gauge(const std::string &name, const std::string &help, const Labels &labels = {}) const;
+        LatencyHistogram &histogram(const std::string &name, const std::string &help,
+                                    const Labels &labels = {}) const;
+
+        std::string render() const;
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr std::chrono::seconds send_timeout = std::chrono::seconds(1);
+        };
+
+       private:
+        enum struct Type { COUNTER, GAUGE, HISTOGRAM };
+
+        struct Family {
+            Type type;
+            std::string help;
+            // Keyed by the formatted labels
+            std::map<std::string, std::unique_ptr<Counter>> counters;
+            std::map<std::string, std::unique_ptr<Gauge>> gauges;
+            std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+        };
+
+        static Family &family(const std::string &name, const std::string &help, Type type);
+        static std::string format_labels(const Labels &labels);
+        // The export thread doesn't create instances, so it never stops itself
+        static std::string format_metrics();
+        static void export_thread(int listen_fd, std::experimental::filesystem::path file,
+                                  std::chrono::seconds interval);
+        static void write_file(const std::experimental::filesystem::path &file);
+        static void wake_up();
+
+        static inline std::map<std::string, Family> _families;
+        static inline std::mutex _families_mutex;
+        static inline bool _thread_started = false;
+        static inline std::atomic_bool _thread_stop = false;
+        static inline std::thread _thread_inst;
+        static inline std::experimental::filesystem::path _socket_path;
+        static inline int _wake_fd = -1;
+        static inline std::recursive_mutex _instance_mutex;
+        static inline std::atomic_int _instance_count = 0;
+    };
+}  // namespace scanbdpp
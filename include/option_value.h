@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <sane/sane.h>
+
+#include "sanepp.h"
+
+namespace scanbdpp {
+    // An int, fixed or bool option with more than one word (e.g. the levels of a sensor). sanepp only reads the
+    // first word of an option, so word arrays are read through the SANE handle of the device.
+    struct WordArray {
+        SANE_Value_Type type = SANE_TYPE_INT;
+        std::vector<SANE_Word> words;
+
+        double element(size_t index) const;
+        uint64_t fingerprint() const;
+        std::string join() const;
+    };
+
+    bool operator==(const WordArray &lhs, const WordArray &rhs);
+    bool operator!=(const WordArray &lhs, const WordArray &rhs);
+
+    namespace detail {
+        template<typename Variant, typename T>
+        struct append_alternative;
+
+        template<typename... Types, typename T>
+        struct append_alternative<std::variant<Types...>, T> {
+            using type = std::variant<Types..., T>;
+        };
+
+        bool is_word_array(const SANE_Option_Descriptor &descriptor);
+        const SANE_Option_Descriptor *find_descriptor(SANE_Handle handle, const std::string &name, SANE_Int &index);
+    }  // namespace detail
+
+    // The value of an option as it is seen by triggers, functions and snapshots
+    using OptionValue = detail::append_alternative<sanepp::Option::value_type, WordArray>::type;
+
+    OptionValue to_option_value(const sanepp::Option::value_type &value);
+    std::optional<OptionValue> read_option_value(const sanepp::Device &device, const sanepp::Option &option);
+}  // namespace scanbdpp
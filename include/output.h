@@ -0,0 +1,93 @@
+#pragma once
+
+#include "common.h"
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "script.h"
+
+namespace scanbdpp {
+    // Forwards stdout and stderr of the scripts line by line to the logger. All pipes are drained by one
+    // epoll thread, lines are cut at max_line_length and every stream may only log max_lines_per_second,
+    // the rest is read and counted, so a chatty script never blocks on a full pipe.
+    class OutputCollector {
+       public:
+        OutputCollector();
+        ~OutputCollector();
+
+        void start() const;
+        void stop() const;
+        bool running() const;
+
+        void attach(int fd, bool is_error, std::string_view label, pid_t pid) const;
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr size_t max_line_length = 1024;
+            static inline constexpr size_t max_lines_per_second = 20;
+            static inline constexpr size_t max_reads_per_event = 16;
+            static inline constexpr size_t read_size = 4096;
+        };
+
+       private:
+        struct Stream {
+            int fd;
+            bool is_error;
+            std::string label;
+            pid_t pid;
+            std::string line;
+            bool truncating = false;
+            std::chrono::steady_clock::time_point window_start;
+            size_t window_lines = 0;
+            size_t suppressed = 0;
+        };
+
+        static void collector_thread();
+        static bool drain(Stream &stream);
+        static void process(Stream &stream, std::string_view data);
+        static void emit(Stream &stream);
+        static void report_suppressed(Stream &stream);
+
+        static inline bool _thread_started = false;
+        static inline std::atomic_bool _thread_stop = false;
+        static inline std::thread _thread_inst;
+        static inline int _epoll_fd = -1;
+        static inline int _wake_fd = -1;
+        static inline std::map<int, std::unique_ptr<Stream>> _streams;
+        static inline std::mutex _stream_mutex;
+        static inline std::recursive_mutex _instance_mutex;
+        static inline std::atomic_int _instance_count = 0;
+    };
+
+    // The pipes of one script start. The write ends are handed to the script as stdout and stderr,
+    // the read ends are given to the collector once the pid of the script is known.
+    class OutputCapture {
+       public:
+        OutputCapture();
+        OutputCapture(const OutputCapture &) = delete;
+        ~OutputCapture();
+
+        OutputCapture &operator=(const OutputCapture &) = delete;
+
+        void add_redirections(std::vector<Redirection> &redirections) const;
+        void started(std::string_view label, pid_t pid);
+
+       private:
+        void close_all();
+
+        int m_read[2] = {-1, -1};
+        int m_write[2] = {-1, -1};
+    };
+}  // namespace scanbdpp
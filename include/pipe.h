@@ -3,8 +3,11 @@
 #include "common.h"
 
 #include <atomic>
+#include <chrono>
 #include <experimental/filesystem>
 #include <mutex>
+#include <optional>
+#include <string>
 
 #include "defines.h"
 
@@ -17,6 +20,8 @@ namespace scanbdpp {
         void stop() const;
 
         void write_message(const std::string &message) const;
+        std::optional<std::string> request_status() const;
+        bool request_trace() const;
 
         class Constants {
            public:
@@ -24,10 +29,17 @@ namespace scanbdpp {
 
             static inline constexpr size_t _max_message_size = PIPE_BUF;
             static inline const std::experimental::filesystem::path pipe_path = PIPE_PATH;
+            static inline const std::experimental::filesystem::path status_path = STATUS_PATH;
+            static inline constexpr char status_message[] = "status";
+            static inline const std::experimental::filesystem::path trace_path = TRACE_PATH;
+            static inline constexpr char trace_message[] = "trace";
+            static inline constexpr std::chrono::milliseconds status_timeout{2000};
         };
 
        private:
         static void pipe_thread();
+        static void write_status();
+        bool request_file(const char *message, const std::experimental::filesystem::path &path) const;
 
         static inline bool _thread_started = false;
         static inline std::atomic_bool _thread_stop = false;
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "scanbdpp_plugin.h"
+
+namespace scanbdpp {
+    // An action function of a shared library, which was loaded with dlopen
+    class Plugin {
+       public:
+        Plugin(std::shared_ptr<void> library, scanbdpp_action_function function, const std::string &name);
+
+        int call(const scanbdpp_event &event) const;
+        void disable();
+
+        bool enabled() const;
+        const std::string &name() const;
+
+       private:
+        std::shared_ptr<void> m_library;
+        scanbdpp_action_function m_function;
+        std::string m_name;
+        std::atomic_bool m_enabled = true;
+    };
+
+    class PluginRegistry {
+       public:
+        std::shared_ptr<Plugin> resolve(const std::string &library, const std::string &symbol);
+
+       private:
+        static inline std::mutex _instance_mutex;
+        static inline std::map<std::string, std::weak_ptr<void>> _libraries;
+        static inline std::map<std::pair<std::string, std::string>, std::shared_ptr<Plugin>> _plugins;
+        static inline unsigned int _config_generation = 0;
+    };
+
+    // Snapshot of a trigger, which is handed to a plugin
+    struct PluginEvent {
+        std::shared_ptr<Plugin> plugin;
+        std::chrono::milliseconds deadline;
+        std::string device;
+        std::string action;
+        std::vector<std::pair<std::string, std::string>> functions;
+        // Cleared after the plugin returned or when the watchdog gave up on it
+        std::shared_ptr<std::atomic_bool> running;
+    };
+
+    // Calls the plugins in a worker thread, so the poll threads are never blocked by a plugin.
+    // A watchdog thread disables a plugin, as soon as it exceeds the deadline of its action, and replaces the
+    // worker, so the queued events don't wait for the hung plugin.
+    class PluginExecutor {
+       public:
+        PluginExecutor();
+        ~PluginExecutor();
+
+        void start() const;
+        void stop() const;
+
+        bool execute(PluginEvent event) const;
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr size_t max_queue_size = 64;
+        };
+
+       private:
+        static void executor_thread(unsigned int worker_id);
+        static void watchdog_thread();
+        static bool current_call_is_hung();
+        static void replace_hung_worker();
+
+        static inline bool _thread_started = false;
+        static inline bool _thread_stop = false;
+        static inline std::thread _thread_inst;
+        static inline std::thread _watchdog_inst;
+        static inline unsigned int _worker_id = 0;
+        static inline std::deque<PluginEvent> _queue;
+        static inline std::shared_ptr<Plugin> _current_plugin;
+        static inline std::string _current_action;
+        static inline std::shared_ptr<std::atomic_bool> _current_running;
+        static inline std::chrono::milliseconds _current_deadline;
+        static inline std::chrono::steady_clock::time_point _current_start;
+        static inline std::condition_variable _queue_condition;
+        // Notified, when a call starts and on stop
+        static inline std::condition_variable _watchdog_condition;
+        static inline std::mutex _queue_mutex;
+        static inline std::recursive_mutex _instance_mutex;
+        static inline std::atomic_int _instance_count = 0;
+    };
+}  // namespace scanbdpp
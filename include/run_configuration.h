@@ -13,6 +13,8 @@ namespace scanbdpp {
         bool signal() const;
         bool debug() const;
         int debug_level() const;
+        // Polling worker process of the isolation supervisor
+        bool worker() const;
         const std::experimental::filesystem::path &config_path() const;
 
         RunConfiguration &manager_mode(bool value);
@@ -20,6 +22,7 @@ namespace scanbdpp {
         RunConfiguration &signal(bool value);
         RunConfiguration &debug(bool value);
         RunConfiguration &debug_level(int value);
+        RunConfiguration &worker(bool value);
         RunConfiguration &config_path(const std::experimental::filesystem::path &config_path);
 
        private:
@@ -28,6 +31,7 @@ namespace scanbdpp {
         static inline bool _manager_mode;
         static inline bool _foreground;
         static inline bool _signal;
+        static inline bool _worker;
         static inline std::experimental::filesystem::path _config_path = SCANBD_CONF;
         static inline std::mutex _instance_mutex;
     };
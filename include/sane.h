@@ -1,88 +1,51 @@
 #pragma once
 
+#include "common.h"
+
+#include <poll.h>
+
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <experimental/filesystem>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
 #include <regex>
+#include <string>
 #include <thread>
 #include <variant>
 #include <vector>
 
 #include "confusepp.h"
 
+#include <sane/sane.h>
 #include "sanepp.h"
 
+#include "defines.h"
+#include "environment.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "option_value.h"
+#include "plugin.h"
+#include "scan.h"
+#include "snapshot.h"
+#include "script.h"
+#include "trigger.h"
+#include "worker.h"
+
 namespace scanbdpp {
     namespace detail {
-        template<typename T>
-        struct ActionValue {
-           public:
-            using value_type = T;
-
-            ActionValue(const int &value = T{}) : m_value(value) {}
-
-            const T &value() const { return m_value; }
-
-            ActionValue &value(const T &value) {
-                m_value = value;
-                return *this;
-            }
-
-            template<typename T2>
-            bool match(const T2 &other) const {
-                return m_value == other;
-            }
-
-           private:
-            T m_value;
-        };
-
-        template<>
-        struct ActionValue<std::string> {
-           public:
-            using value_type = std::string;
-
-            inline ActionValue(const std::string &value = std::string{})
-                : m_regexp(value, std::regex_constants::extended) {}
-
-            inline ActionValue &regexp(const std::string &value) {
-                m_regexp.assign(value, std::regex_constants::extended);
-                return *this;
-            }
-
-            inline const std::regex &value() const { return m_regexp; }
-
-            inline bool match(const std::string &other) const { return std::regex_match(other, m_regexp); }
-
-           private:
-            std::regex m_regexp;
-        };
-
-        template<typename T, typename T2>
-        bool operator==(const ActionValue<T> &lhs, const T2 &rhs) {
-            return lhs.match(rhs);
-        }
+        enum struct WorkerMode { NONE, ACTION, DEVICE };
 
-        template<typename T, typename T2>
-        bool operator==(const T2 &lhs, const ActionValue<T> &rhs) {
-            return rhs == lhs;
-        }
-
-        template<typename T, typename T2>
-        bool operator!=(const ActionValue<T> &lhs, const T2 &rhs) {
-            return !(lhs.match(rhs));
-        }
-
-        template<typename T, typename T2>
-        bool operator!=(const T2 &lhs, const ActionValue<T> &rhs) {
-            return rhs != lhs;
-        }
+        // opening -> polling -> released (scripts run) -> opening ..., a failed open goes to backoff and is
+        // retried, after open_retries failed retries the device is failed until polling is restarted
+        enum struct DeviceState { OPENING, POLLING, RELEASED, SCANNING, BACKOFF, FAILED };
 
         class Action {
            public:
-            using value_type =
-                std::variant<ActionValue<int>, ActionValue<sanepp::Fixed>, ActionValue<bool>, ActionValue<std::string>>;
-
             Action(const sanepp::OptionInfo &option_info);
             Action(const Action &action) = delete;
             Action(Action &&other);
@@ -90,31 +53,108 @@ namespace scanbdpp {
             void set_trigger();
             void unset_trigger();
             void script(const std::experimental::filesystem::path &new_script);
+            void resolved_script(std::shared_ptr<Script> new_resolved_script);
+            void plugin(std::shared_ptr<Plugin> new_plugin);
+            void limits(const ScriptLimits &new_limits);
+            void scan(const std::optional<ScanSettings> &new_scan);
+            void order(int new_order);
+            void worker_mode(WorkerMode new_worker_mode);
+            void worker(ScriptWorker *new_worker);
             void action_name(const std::string &new_action_name);
             void option_info(const sanepp::OptionInfo &new_option_info);
-            void current_value(const std::optional<sanepp::Option::value_type> new_current_value);
-            void last_value(const std::optional<sanepp::Option::value_type> new_last_value);
-            void from_value(const value_type &new_from_value);
-            void to_value(const value_type &new_to_value);
+            void polled_option(size_t new_polled_option);
+            void last_value(const std::optional<OptionValue> &new_last_value);
+            void reset_last_value();
+            void record_result(const ScriptResult &result);
+            void condition(const TriggerCondition &new_condition);
+            void debounce(std::chrono::milliseconds new_debounce);
+            void min_interval(std::chrono::milliseconds new_min_interval);
+            void skip_while_running(bool new_skip_while_running);
+            void running(bool new_running);
 
             bool is_triggered() const;
             const std::string &action_name() const;
             const std::experimental::filesystem::path &script() const;
-            const std::optional<sanepp::Option::value_type> &current_value() const;
-            const std::optional<sanepp::Option::value_type> &last_value() const;
+            const std::shared_ptr<Script> &resolved_script() const;
+            const std::shared_ptr<Plugin> &plugin() const;
+            std::chrono::milliseconds deadline() const;
+            const ScriptLimits &limits() const;
+            unsigned int timeouts() const;
+            unsigned int kills() const;
+            const std::optional<ScanSettings> &scan() const;
+            int order() const;
+            WorkerMode worker_mode() const;
+            ScriptWorker *worker() const;
+            size_t polled_option() const;
+            const std::optional<OptionValue> &last_value() const;
             const sanepp::OptionInfo &option_info() const;
-            const value_type &from_value() const;
-            const value_type &to_value() const;
+            const TriggerCondition &condition() const;
+            const std::shared_ptr<std::atomic_bool> &running() const;
+            unsigned int suppressed() const;
+            bool evaluate_trigger(const OptionValue &current_value,
+                                  std::chrono::steady_clock::time_point now);
+            bool accept_trigger(std::chrono::steady_clock::time_point now);
 
            private:
-            value_type m_from_value;
-            value_type m_to_value;
+            TriggerCondition m_condition = TriggerCondition::transition(C_FROM_VALUE_DEF_INT, C_TO_VALUE_DEF_INT);
             sanepp::OptionInfo m_option_info;
-            std::optional<sanepp::Option::value_type> m_last_value;
-            std::optional<sanepp::Option::value_type> m_current_value;
+            size_t m_polled_option = 0;
+            std::optional<OptionValue> m_last_value;
             std::experimental::filesystem::path m_script;
+            std::shared_ptr<Script> m_resolved_script;
+            std::shared_ptr<Plugin> m_plugin;
+            ScriptLimits m_limits;
+            // Read by the status report from other threads
+            std::atomic_uint m_timeouts = 0;
+            std::atomic_uint m_kills = 0;
+            std::optional<ScanSettings> m_scan;
+            int m_order = C_ORDER_DEF;
+            WorkerMode m_worker_mode = WorkerMode::NONE;
+            ScriptWorker *m_worker = nullptr;
             std::string m_action_name;
             std::atomic_bool m_trigger = false;
+            std::chrono::milliseconds m_debounce{C_DEBOUNCE_DEF};
+            std::chrono::milliseconds m_min_interval{C_MIN_INTERVAL_DEF};
+            bool m_skip_while_running = C_SKIP_WHILE_RUNNING_DEF;
+            // Shared with the plugin executor, which clears it after the plugin returned
+            std::shared_ptr<std::atomic_bool> m_running = std::make_shared<std::atomic_bool>(false);
+            // After a firing the option has to be stable for the debounce time, before it can fire again
+            bool m_bouncing = false;
+            std::chrono::steady_clock::time_point m_last_change;
+            std::optional<std::chrono::steady_clock::time_point> m_last_fired;
+            std::atomic_uint m_suppressed = 0;
+        };
+
+        // An option which is read once per poll cycle, even if multiple actions are using it.
+        // The value is updated in place, so reading an option doesn't allocate. Strings are read through the SANE
+        // handle of the device into a buffer of the option size, since sanepp returns a new string for every read,
+        // word arrays as well, since sanepp only reads their first word.
+        class PolledOption {
+           public:
+            PolledOption(const sanepp::OptionInfo &option_info, LatencyHistogram &latency);
+
+            bool read();
+            bool pack(uint64_t &word) const;
+            void attach(const sanepp::Device &device);
+            void detach();
+
+            const sanepp::OptionInfo &option_info() const;
+            const std::optional<OptionValue> &value() const;
+            LatencyHistogram &latency();
+            const LatencyHistogram &latency() const;
+
+           private:
+            sanepp::OptionInfo m_option_info;
+            std::optional<sanepp::Option> m_option;
+            std::optional<OptionValue> m_value;
+            // Set by attach for string options and word arrays
+            SANE_Handle m_handle = nullptr;
+            SANE_Value_Type m_type = SANE_TYPE_INT;
+            SANE_Int m_index = 0;
+            std::vector<char> m_buffer;
+            std::vector<SANE_Word> m_words;
+            // Owned by the metrics registry
+            LatencyHistogram *m_latency;
         };
 
         class Function {
@@ -142,24 +182,121 @@ namespace scanbdpp {
             PollHandler &operator=(const PollHandler &) = delete;
             PollHandler &operator=(PollHandler &&) = delete;
 
+            bool prepare();
+            void start();
             void stop();
 
             void poll_device();
             const sanepp::DeviceInfo &device_info() const;
+            const std::string &idle_reason() const;
+            DeviceState state() const;
+            const std::string &bus() const;
+            void bus_slot(size_t new_bus_slot);
+            std::string status(const std::string &state) const;
             const std::atomic_bool &should_stop() const;
             const std::thread &poll_thread() const;
             void trigger_action(const std::string &name);
             std::thread &poll_thread();
+            // Waits until poll_device returned, false if it didn't until deadline
+            bool wait_stopped(std::chrono::steady_clock::time_point deadline) const;
+            bool finished() const;
+
+            class Constants {
+               public:
+                Constants() = delete;
+
+                static inline constexpr std::chrono::seconds max_degraded_interval = std::chrono::seconds(30);
+                static inline constexpr std::chrono::milliseconds min_open_backoff = std::chrono::seconds(1);
+                static inline constexpr std::chrono::milliseconds max_open_backoff = std::chrono::seconds(60);
+            };
 
            private:
+            bool match_config(const sanepp::Device &device);
+            bool open_device(std::optional<sanepp::Device> &device);
             void find_matching_functions(const sanepp::Device &device, const confusepp::Section &section);
             void find_matching_options(const sanepp::Device &device, const confusepp::Section &section);
+            const std::optional<OptionValue> &function_value(
+                const Function &function, const sanepp::Device &device,
+                std::optional<OptionValue> &read_value) const;
+            void dispatch_plugin(const Action &action, const sanepp::Device &device);
+            void prepare_environment(const Action &action, const sanepp::Device &device, Environment &environment);
+            OptionSnapshot take_snapshot(const sanepp::Device &device) const;
+            void run_script(Action &action, Environment &environment, int snapshot_fd);
+            bool run_triggered(std::vector<Action *> &triggered, std::optional<sanepp::Device> &device, int timeout,
+                               bool option_snapshot);
+            void start_scans(const sanepp::Device &device);
+            bool scan_running();
+            void stop_scans(const sanepp::Device &device);
+            void find_polled_options();
+            void start_workers();
+            void attach_polled_options(const sanepp::Device &device);
+            void detach_polled_options();
+            bool read_polled_options();
+            void update_degraded(bool slow_read);
+            void wait_next_cycle(std::chrono::milliseconds timeout);
+            // Sleeps until end, returns early with true once the handler is stopped
+            bool wait_terminate(std::chrono::steady_clock::time_point end);
 
             sanepp::Sane m_instance;
             sanepp::DeviceInfo m_device_info;
+            // Opened by prepare and handed over to the poll thread
+            std::optional<sanepp::Device> m_device;
+            std::string m_idle_reason;
+            // Empty for devices, which aren't connected by USB
+            std::string m_bus;
+            std::string m_port_path;
+            size_t m_bus_slot = 0;
             std::atomic_bool m_terminate;
+            // Wakes the waits of the poll thread on stop
+            std::mutex m_terminate_mutex;
+            std::condition_variable m_terminate_condition;
             std::vector<Function> m_functions;
             std::vector<Action> m_actions;
+            std::vector<PolledOption> m_polled_options;
+            // One word per polled option for bool, int and fixed values, a poll cycle without changes is
+            // detected with one xor pass over both vectors
+            std::vector<uint64_t> m_packed_values;
+            std::vector<uint64_t> m_last_packed_values;
+            std::vector<bool> m_packed;
+            bool m_evaluate_all = true;
+            bool m_always_evaluate = false;
+            std::atomic_bool m_trigger_pending = false;
+            // Option reads, which take longer, mark the device degraded and back off the poll interval
+            std::chrono::milliseconds m_read_deadline{C_READ_DEADLINE_DEF};
+            // Owned by the metrics registry, they keep counting across restarts of the handler
+            LatencyHistogram &m_read_latency;
+            LatencyHistogram &m_trigger_latency;
+            Metrics::Counter &m_poll_cycles;
+            // Read by the status report: the option, which is read since m_read_start (steady clock, 0 while
+            // not reading), and the last read over the deadline
+            std::atomic<int64_t> m_read_start = 0;
+            std::atomic<size_t> m_reading_option = 0;
+            std::atomic_bool m_degraded = false;
+            // Degraded, because the bus wasn't free within the read deadline
+            std::atomic_bool m_bus_busy = false;
+            std::atomic<size_t> m_slow_option = 0;
+            std::atomic<int64_t> m_slow_read_time = 0;
+            unsigned int m_slow_cycles = 0;
+            std::atomic_bool m_finished = false;
+            std::atomic<DeviceState> m_state = DeviceState::OPENING;
+            // Set once the config was matched, the actions and options don't change afterwards
+            std::atomic_bool m_matched = false;
+            std::atomic_uint m_retries = 0;
+            std::atomic_uint m_open_failures = 0;
+            std::atomic<int64_t> m_next_retry = 0;
+            std::atomic<const char *> m_failure = "";
+            unsigned int m_max_retries = C_OPEN_RETRIES_DEF;
+            std::minstd_rand m_random{std::random_device{}()};
+            Environment m_environment;
+            // One per script of a poll cycle, kept for the next cycle
+            std::vector<std::unique_ptr<Environment>> m_launch_environments;
+            std::vector<std::unique_ptr<ScriptWorker>> m_workers;
+            // The pidfds of the running workers, waited for between two poll cycles
+            std::vector<pollfd> m_worker_fds;
+            // Scans use the open device on their own thread, the options aren't read meanwhile
+            std::vector<Action *> m_scan_actions;
+            std::atomic_bool m_scanning = false;
+            std::thread m_scan_thread;
             std::thread m_poll_thread;
         };
     }  // namespace detail
@@ -172,10 +309,34 @@ namespace scanbdpp {
         void start();
         void stop();
         void trigger_action(const std::string &device_name, const std::string &action_name);
+        void restrict_devices(const std::vector<std::string> &device_names);
+        bool polling() const;
+        std::string status() const;
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            // Polling threads, which are stuck in a read, are left behind after this time
+            static inline constexpr std::chrono::seconds stop_timeout = std::chrono::seconds(10);
+        };
 
        private:
+        void join_stuck_handlers();
+
+        // Devices without any matching action, they are only matched again on start
+        struct IdleDevice {
+            std::string name;
+            std::string reason;
+        };
+
         static inline std::recursive_mutex _instance_mutex;
         static inline std::vector<std::unique_ptr<detail::PollHandler>> _device_threads;
+        static inline std::vector<IdleDevice> _idle_devices;
+        // Handlers, whose thread didn't stop in time. They are joined by the next start or stop after they finished,
+        // until then their device isn't polled again.
+        static inline std::vector<std::unique_ptr<detail::PollHandler>> _stuck_handlers;
+        static inline std::vector<std::string> _restricted_devices;
         static inline std::atomic_int _instance_count;
     };
 
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <experimental/filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sane/sane.h>
+
+namespace scanbdpp {
+    struct ScanSettings {
+        std::experimental::filesystem::path directory;
+        std::string source;
+        int pages;
+    };
+
+    // Scans pages with the handle of an open device and writes them as PNM files.
+    // The calling thread reads from the device, while a writer thread writes the previous buffer to disk.
+    // Once stop is set, no further page is started, a running page is ended with sane_cancel.
+    class ScanJob {
+       public:
+        ScanJob(SANE_Handle handle, const std::string &device_name, const ScanSettings &settings,
+                const std::atomic_bool &stop);
+        ScanJob(const ScanJob &) = delete;
+
+        ScanJob &operator=(const ScanJob &) = delete;
+
+        int run();
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr size_t buffer_size = 256 * 1024;
+            static inline constexpr size_t buffer_count = 2;
+        };
+
+       private:
+        struct Chunk {
+            enum struct Kind { BEGIN_PAGE, DATA, END_PAGE, ABORT_PAGE, FINISH };
+
+            Kind kind;
+            SANE_Parameters parameters;
+            std::experimental::filesystem::path path;
+            std::vector<SANE_Byte> data;
+            size_t length;
+        };
+
+        bool select_source() const;
+        bool read_page(const SANE_Parameters &parameters, int page);
+        std::experimental::filesystem::path page_path(int page) const;
+
+        void push(Chunk chunk);
+        Chunk pop();
+        std::vector<SANE_Byte> take_buffer();
+        void return_buffer(std::vector<SANE_Byte> buffer);
+        void writer_thread();
+
+        SANE_Handle m_handle;
+        std::string m_device_name;
+        ScanSettings m_settings;
+        const std::atomic_bool &m_stop;
+        std::string m_job_name;
+        std::deque<Chunk> m_chunks;
+        std::vector<std::vector<SANE_Byte>> m_free_buffers;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+    };
+}  // namespace scanbdpp
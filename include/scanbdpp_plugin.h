@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Interface of in-process action plugins.
+ *
+ * A plugin is a shared library, which exports a function of the type scanbdpp_action_function.
+ * It is loaded with dlopen, when the config is loaded and is called from a worker thread of the daemon
+ * whenever the action is triggered. All pointers are only valid for the duration of the call.
+ * The function should return 0 on success.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCANBDPP_PLUGIN_ABI_VERSION 1
+#define SCANBDPP_PLUGIN_DEFAULT_SYMBOL "scanbdpp_action"
+
+struct scanbdpp_function_value {
+    const char *name;
+    const char *value;
+};
+
+struct scanbdpp_event {
+    unsigned int abi_version;
+    const char *device;
+    const char *action;
+    size_t function_count;
+    const struct scanbdpp_function_value *functions;
+};
+
+typedef int (*scanbdpp_action_function)(const struct scanbdpp_event *event);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.h"
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <experimental/filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "confusepp.h"
+
+namespace scanbdpp {
+    // Makes the descriptor from of the daemon available as descriptor to in the script
+    struct Redirection {
+        int from;
+        int to;
+    };
+
+    // A deadline of 0 lets the script run as long as it wants, the other limits are only applied if set
+    struct ScriptLimits {
+        std::chrono::milliseconds deadline{0};
+        std::chrono::milliseconds kill_delay{0};
+        rlim_t address_space = RLIM_INFINITY;
+        rlim_t cpu_time = RLIM_INFINITY;
+        int nice = 0;
+        int ionice_class = 0;
+        int ionice_level = 0;
+        // Path of the cgroup.procs file of a cgroup v2 leaf, the script moves itself there
+        std::string cgroup_procs;
+        // Credentials of the script, only the launcher can apply them
+        std::optional<uid_t> uid;
+        std::optional<gid_t> gid;
+    };
+
+    struct ScriptResult {
+        std::optional<int> status;
+        bool timed_out = false;
+        bool killed = false;
+    };
+
+    ScriptLimits read_script_limits(const confusepp::Section &section);
+
+    namespace detail {
+        // Waits at most timeout for the child (forever for a negative timeout) and returns false,
+        // if the timeout expired
+        using ChildWaiter = std::function<bool(std::chrono::milliseconds timeout, std::optional<int> &status)>;
+
+        [[noreturn]] void exec_script(int fd, char *const argv[], char *const envp[],
+                                      const Redirection *redirections = nullptr, size_t redirection_count = 0,
+                                      const ScriptLimits *limits = nullptr);
+        ScriptResult supervise_script(pid_t pid, const ScriptLimits &limits, const ChildWaiter &wait);
+    }  // namespace detail
+
+    // A script which has been resolved and validated, when the config was loaded.
+    // The file is held as an O_PATH descriptor and is executed through it, so running the script doesn't need
+    // any path lookups or stat calls.
+    class Script {
+       public:
+        Script(const std::experimental::filesystem::path &script_path, int fd);
+        Script(const Script &) = delete;
+        ~Script();
+
+        Script &operator=(const Script &) = delete;
+
+        void invalidate();
+
+        ScriptResult run(char *const envp[], const ScriptLimits &limits = {},
+                         const std::vector<Redirection> &redirections = {}, std::string_view label = {}) const;
+
+        bool valid() const;
+        int fd() const;
+        const std::experimental::filesystem::path &path() const;
+
+       private:
+        std::experimental::filesystem::path m_path;
+        int m_fd;
+        std::atomic_bool m_valid = true;
+    };
+
+    class ScriptRegistry {
+       public:
+        std::shared_ptr<Script> resolve(const std::experimental::filesystem::path &script_path);
+        void update();
+
+       private:
+        static int open_script(const std::experimental::filesystem::path &absolute_path);
+        static void watch(const std::experimental::filesystem::path &directory);
+        static void process_changes();
+
+        static inline std::recursive_mutex _instance_mutex;
+        static inline std::map<std::experimental::filesystem::path, std::shared_ptr<Script>> _scripts;
+        static inline std::map<int, std::experimental::filesystem::path> _watches;
+        static inline int _inotify_fd = -1;
+        static inline unsigned int _config_generation = 0;
+    };
+}  // namespace scanbdpp
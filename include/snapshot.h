@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "option_value.h"
+
+namespace scanbdpp {
+    namespace detail {
+        void append_json_string(std::string &data, std::string_view value);
+    }
+
+    // All option values of a device at the time of a trigger, one JSON object per line:
+    // {"name":"<option>","type":"int|fixed|bool|string","value":<value>}
+    // Word arrays have the type "int[]", "fixed[]" or "bool[]" and a JSON array as value.
+    // The snapshot is handed to the script as a sealed memfd, so it can't be changed after it was taken.
+    class OptionSnapshot {
+       public:
+        void add(std::string_view name, const OptionValue &value);
+
+        int seal() const;
+        size_t size() const;
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr char env_name[] = "SCANBD_OPTIONS_FD";
+            static inline constexpr int script_fd = 3;
+        };
+
+       private:
+        std::string m_data;
+    };
+}  // namespace scanbdpp
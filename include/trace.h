@@ -0,0 +1,98 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <experimental/filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace scanbdpp {
+    // Spans of the key steps (poll cycles, option reads, device release and reopen, scripts, sane init, config
+    // loads) are recorded into a fixed size ring per thread, which keeps the last ring_size spans. The owning
+    // thread is the only writer of its ring, so recording takes no lock, dump() copies the complete entries as
+    // Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+    // Built without SCANBDPP_TRACING the spans aren't compiled in, while trace = false they cost a relaxed load.
+    class Tracer {
+       public:
+        void enable(bool enabled) const;
+        bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+        void record(const char *name, std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point end) const;
+        bool dump(const std::experimental::filesystem::path &path) const;
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr size_t ring_size = 4096;
+        };
+
+       private:
+        // sequence is index + 1 of the span in the entry and 0 while it is written
+        struct Entry {
+            std::atomic<uint64_t> sequence = 0;
+            std::atomic<const char *> name = nullptr;
+            std::atomic<int64_t> start = 0;
+            std::atomic<int64_t> duration = 0;
+        };
+
+        struct Ring {
+            std::array<Entry, Constants::ring_size> entries;
+            std::atomic<uint64_t> head = 0;
+            std::atomic<pid_t> thread_id = 0;
+            // Rings of exited threads are reused, scripts are started in short lived threads
+            std::atomic_bool in_use = true;
+        };
+
+        struct RingOwner {
+            ~RingOwner();
+
+            std::shared_ptr<Ring> ring;
+        };
+
+        static Ring &ring();
+
+        static inline std::atomic_bool _enabled = false;
+        static inline std::vector<std::shared_ptr<Ring>> _rings;
+        static inline std::mutex _rings_mutex;
+    };
+
+    // Records the time from its construction to its destruction, name has to be a string literal
+    class TraceSpan {
+       public:
+        explicit TraceSpan(const char *name) : m_name(Tracer().enabled() ? name : nullptr) {
+            if (m_name) {
+                m_start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~TraceSpan() {
+            if (m_name) {
+                Tracer().record(m_name, m_start, std::chrono::steady_clock::now());
+            }
+        }
+
+        TraceSpan(const TraceSpan &) = delete;
+        TraceSpan &operator=(const TraceSpan &) = delete;
+
+       private:
+        const char *m_name;
+        std::chrono::steady_clock::time_point m_start;
+    };
+}  // namespace scanbdpp
+
+#ifdef SCANBDPP_TRACING
+#define SCANBDPP_TRACE_CONCAT_(a, b) a##b
+#define SCANBDPP_TRACE_CONCAT(a, b) SCANBDPP_TRACE_CONCAT_(a, b)
+#define SCANBDPP_TRACE_SPAN(name) ::scanbdpp::TraceSpan SCANBDPP_TRACE_CONCAT(trace_span_, __LINE__)(name)
+#else
+#define SCANBDPP_TRACE_SPAN(name) \
+    do {                          \
+    } while (false)
+#endif
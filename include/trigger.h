@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+
+#include "confusepp.h"
+#include "option_value.h"
+
+namespace scanbdpp {
+    // The condition of an action, which is compiled once when the config is loaded. Numerical options (int, fixed
+    // and bool as 0/1) are compared as double, string options with regular expressions. Expressions:
+    //   change | rising | falling               any change, increase or decrease of the value
+    //   == X | != X | < X | <= X | > X | >= X   the comparison becomes true
+    //   in A..B                                 the value enters the range [A, B]
+    //   above X [hysteresis H]                  the value rises above X, is armed again below X - H
+    //   below X [hysteresis H]                  the value falls below X, is armed again above X + H
+    //   A -> B                                  the value changes from A to B, * matches every value
+    //   "regex" -> "regex" | == "regex"         the same for string options
+    // For word arrays a condition fires, if it fires for any element, [k] <condition> only watches element k.
+    // Thresholds keep state, so they need an element. numerical-trigger and string-trigger sections are compiled to
+    // transitions.
+    class TriggerCondition {
+       public:
+        enum struct Op : uint8_t {
+            CHANGE,
+            RISING,
+            FALLING,
+            EQUAL,
+            NOT_EQUAL,
+            LESS,
+            LESS_EQUAL,
+            GREATER,
+            GREATER_EQUAL,
+            RANGE,
+            ABOVE,
+            BELOW,
+            TRANSITION,
+            STRING_MATCH,
+            STRING_TRANSITION
+        };
+
+        static std::optional<TriggerCondition> parse(std::string_view expression);
+        static TriggerCondition transition(double from, double to);
+        static TriggerCondition string_transition(const std::string &from, const std::string &to);
+        static bool changed(const OptionValue &previous, const OptionValue &current);
+
+        bool evaluate(const OptionValue &previous, const OptionValue &current);
+        bool accepts(const OptionValue &value) const;
+        bool fires_without_change() const;
+        Op op() const;
+
+       private:
+        explicit TriggerCondition(Op op);
+
+        bool evaluate_numeric(double previous, double current);
+        bool evaluate_string(const std::string &previous, const std::string &current) const;
+        bool evaluate_array(const WordArray &previous, const WordArray &current);
+
+        Op m_op;
+        // Bit 0: the first operand matches every value, bit 1: the second one
+        uint8_t m_wildcards = 0;
+        // -1 until the first value was seen
+        int8_t m_armed = -1;
+        // Element of a word array, -1 for every element
+        int32_t m_element = -1;
+        double m_first = 0;
+        double m_second = 0;
+        std::regex m_from;
+        std::regex m_to;
+    };
+
+    // Compiles the trigger option of an action section or the trigger section matching the type of value
+    TriggerCondition read_trigger_condition(const confusepp::Section &section, const OptionValue &value);
+}  // namespace scanbdpp
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "common.h"
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "environment.h"
+#include "script.h"
+
+namespace scanbdpp {
+    // A long lived script process, which receives the events of its actions over stdin instead of being
+    // started for every event. Every event is written as a record, which starts with the length of the
+    // record as 32 bit little endian integer, followed by NAME=value entries, each terminated by '\0'.
+    // A worker, which exits, is reaped by the next flush (pid_fd becomes readable, when it exits) and restarted
+    // with an exponential backoff, which is reset once a worker ran for stable_time. Events are buffered up to a
+    // limit, when the worker can't keep up and dropped afterwards.
+    class ScriptWorker {
+       public:
+        ScriptWorker(const std::string &name, std::shared_ptr<Script> script, Environment environment);
+        ScriptWorker(const ScriptWorker &) = delete;
+        ~ScriptWorker();
+
+        ScriptWorker &operator=(const ScriptWorker &) = delete;
+
+        bool send(std::string_view entries);
+        void flush();
+
+        const std::string &name() const;
+        unsigned long dropped() const;
+        // -1 while the worker isn't running or without pidfds (before Linux 5.3)
+        int pid_fd() const;
+
+        class Constants {
+           public:
+            Constants() = delete;
+
+            static inline constexpr size_t max_pending_size = 64 * 1024;
+            static inline constexpr std::chrono::milliseconds min_backoff = std::chrono::seconds(1);
+            static inline constexpr std::chrono::milliseconds max_backoff = std::chrono::seconds(60);
+            static inline constexpr std::chrono::seconds stable_time = std::chrono::seconds(60);
+            static inline constexpr std::chrono::seconds stop_grace = std::chrono::seconds(1);
+        };
+
+       private:
+        bool alive();
+        void reap();
+        bool start();
+        void stop();
+
+        std::string m_name;
+        std::shared_ptr<Script> m_script;
+        Environment m_environment;
+        pid_t m_pid = -1;
+        int m_pid_fd = -1;
+        int m_stdin = -1;
+        std::vector<char> m_pending;
+        unsigned long m_dropped = 0;
+        std::chrono::steady_clock::time_point m_last_start;
+        std::chrono::steady_clock::time_point m_next_start;
+        std::chrono::milliseconds m_backoff{0};
+    };
+}  // namespace scanbdpp
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <experimental/filesystem>
+#include <fstream>
+#include <regex>
+
+#include "bus.h"
+#include "histogram.h"
+
+namespace scanbdpp {
+
+    namespace {
+        std::optional<unsigned int> read_number(const std::experimental::filesystem::path &path) {
+            std::ifstream file(path);
+            unsigned int number;
+
+            if (!(file >> number)) {
+                return {};
+            }
+
+            return number;
+        }
+    }  // namespace
+
+    std::optional<UsbLocation> usb_location(const std::string &device_name) {
+        static const std::regex libusb_regex("libusb:([0-9]+):([0-9]+)");
+        std::smatch match;
+
+        if (!std::regex_search(device_name, match, libusb_regex)) {
+            return {};
+        }
+
+        UsbLocation location{static_cast<unsigned int>(std::stoul(match[1])),
+                             static_cast<unsigned int>(std::stoul(match[2])),
+                             {}};
+
+        // Interfaces (1-1.2:1.0) don't have busnum and devnum, so only devices match
+        namespace fs = std::experimental::filesystem;
+        std::error_code error;
+        for (fs::directory_iterator current(fs::path("/sys/bus/usb/devices"), error), end; !error && current != end;
+             current.increment(error)) {
+            if (read_number(current->path() / "busnum") == location.bus &&
+                read_number(current->path() / "devnum") == location.device) {
+                location.port_path = current->path().filename().native();
+                break;
+            }
+        }
+
+        return location;
+    }
+
+    BusScheduler::Guard::Guard(Bus *bus, std::chrono::steady_clock::time_point wait_start) : m_bus(bus) {
+        m_start = std::chrono::steady_clock::now();
+        m_bus->wait_time += m_start - wait_start;
+    }
+
+    BusScheduler::Guard::Guard(Guard &&other) : m_bus(other.m_bus), m_start(other.m_start) { other.m_bus = nullptr; }
+
+    BusScheduler::Guard::~Guard() {
+        if (!m_bus) {
+            return;
+        }
+
+        auto read_time = std::chrono::steady_clock::now() - m_start;
+        ++m_bus->reads;
+        m_bus->read_time += read_time;
+        m_bus->max_read_time = std::max<std::chrono::nanoseconds>(m_bus->max_read_time, read_time);
+        m_bus->mutex.unlock();
+    }
+
+    size_t BusScheduler::add(const std::string &bus) const {
+        std::lock_guard<std::mutex> guard(_buses_mutex);
+
+        auto &current_bus = _buses[bus];
+        if (!current_bus) {
+            current_bus = std::make_unique<Bus>();
+        }
+
+        return current_bus->devices++;
+    }
+
+    size_t BusScheduler::devices(const std::string &bus) const {
+        std::lock_guard<std::mutex> guard(_buses_mutex);
+
+        auto current_bus = _buses.find(bus);
+        return current_bus != _buses.end() ? current_bus->second->devices : 0;
+    }
+
+    // Must only be called, when no device is polled. The buses themselves are kept, since a stuck poll thread
+    // may still hold one.
+    void BusScheduler::clear() const {
+        std::lock_guard<std::mutex> guard(_buses_mutex);
+
+        for (auto &[name, current_bus] : _buses) {
+            current_bus->devices = 0;
+        }
+    }
+
+    // Devices without a bus aren't serialized
+    auto BusScheduler::find(const std::string &bus) const -> Bus * {
+        if (bus.empty()) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> guard(_buses_mutex);
+
+        auto found = _buses.find(bus);
+        return found != _buses.end() ? found->second.get() : nullptr;
+    }
+
+    auto BusScheduler::lock(const std::string &bus) const -> Guard {
+        Bus *current_bus = find(bus);
+
+        if (!current_bus) {
+            return Guard();
+        }
+
+        auto wait_start = std::chrono::steady_clock::now();
+        current_bus->mutex.lock();
+        return Guard(current_bus, wait_start);
+    }
+
+    auto BusScheduler::try_lock(const std::string &bus, std::chrono::milliseconds timeout) const
+        -> std::optional<Guard> {
+        Bus *current_bus = find(bus);
+
+        if (!current_bus) {
+            return Guard();
+        }
+
+        auto wait_start = std::chrono::steady_clock::now();
+
+        if (!current_bus->mutex.try_lock_for(timeout)) {
+            return {};
+        }
+
+        return Guard(current_bus, wait_start);
+    }
+
+    // Locks every bus, so the numbers of a bus are consistent. A bus, which is held by a read, isn't waited for,
+    // the read may be stuck.
+    std::string BusScheduler::status() const {
+        std::lock_guard<std::mutex> guard(_buses_mutex);
+
+        std::string report;
+
+        for (const auto &[name, current_bus] : _buses) {
+            if (name.empty() || !current_bus->devices) {
+                continue;
+            }
+
+            std::unique_lock<std::timed_mutex> bus_guard(current_bus->mutex, std::try_to_lock);
+
+            if (!bus_guard) {
+                report += "bus " + name + ": " + std::to_string(current_bus->devices) + " devices, reading\n";
+                continue;
+            }
+
+            auto reads = std::max<uint64_t>(current_bus->reads, 1);
+
+            report += "bus " + name + ": " + std::to_string(current_bus->devices) + " devices, " +
+                      std::to_string(current_bus->reads) + " reads, read avg " +
+                      format_time(current_bus->read_time / reads) + " max " +
+                      format_time(current_bus->max_read_time) + ", wait avg " +
+                      format_time(current_bus->wait_time / reads) + "\n";
+        }
+
+        return report;
+    }
+}  // namespace scanbdpp
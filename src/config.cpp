@@ -1,15 +1,12 @@
-// clang-format off
 #include "common.h"
-#include <sys/types.h>
-#include <pwd.h>
-// clang-format on
 
 #include <memory>
 
-#include "spdlog/spdlog.h"
-
 #include "config.h"
+#include "logging.h"
+#include "metrics.h"
 #include "run_configuration.h"
+#include "trace.h"
 
 namespace scanbdpp {
 
@@ -21,24 +18,50 @@ namespace scanbdpp {
         return _config.get() != nullptr;
     }
 
+    // Is incremented every time a config was loaded, so derived data can be recomputed
+    unsigned int Config::generation() const { return _generation; }
+
     void Config::reload_config() {
+        SCANBDPP_TRACE_SPAN("config reload");
         std::lock_guard<std::mutex> config_guard{_config_mutex};
 
         RunConfiguration run_config;
 
         using namespace confusepp;
 
+        auto limits_structure =
+            Section(Constants::limits)
+                .values(Option<int>(Constants::kill_delay).default_value(Constants::kill_delay_def),
+                        Option<int>(Constants::address_space).default_value(Constants::address_space_def),
+                        Option<int>(Constants::cpu_time).default_value(Constants::cpu_time_def),
+                        Option<int>(Constants::nice).default_value(Constants::nice_def),
+                        Option<int>(Constants::ionice_class).default_value(Constants::ionice_class_def),
+                        Option<int>(Constants::ionice_level).default_value(Constants::ionice_level_def),
+                        Option<std::string>(Constants::cgroup).default_value(Constants::cgroup_def));
         auto action_structure =
             Multisection(Constants::action)
                 .values(
                     Option<std::string>(Constants::filter),
+                    Option<std::string>(Constants::trigger).default_value(Constants::trigger_def),
                     Section(Constants::numerical_trigger)
                         .values(Option<int>(Constants::from_value).default_value(Constants::from_value_def_int),
                                 Option<int>(Constants::to_value).default_value(Constants::to_value_def_int)),
                     Section(Constants::string_trigger)
                         .values(Option<std::string>(Constants::from_value).default_value(Constants::from_value_def_str),
                                 Option<std::string>(Constants::to_value).default_value(Constants::to_value_def_str)),
-                    Option<std::string>(Constants::desc), Option<std::string>(Constants::script));
+                    Option<std::string>(Constants::desc), Option<std::string>(Constants::script),
+                    Option<std::string>(Constants::plugin),
+                    Option<std::string>(Constants::symbol).default_value(Constants::symbol_def),
+                    Option<int>(Constants::deadline).default_value(Constants::deadline_def), limits_structure,
+                    Option<std::string>(Constants::scan_directory),
+                    Option<std::string>(Constants::scan_source).default_value(Constants::scan_source_def),
+                    Option<int>(Constants::scan_pages).default_value(Constants::scan_pages_def),
+                    Option<int>(Constants::order).default_value(Constants::order_def),
+                    Option<int>(Constants::debounce).default_value(Constants::debounce_def),
+                    Option<int>(Constants::min_interval).default_value(Constants::min_interval_def),
+                    Option<bool>(Constants::skip_while_running).default_value(Constants::skip_while_running_def),
+                    Option<std::string>(Constants::worker).default_value(Constants::worker_def),
+                    Option<std::string>(Constants::user), Option<std::string>(Constants::group));
         auto function_structure =
             Multisection(Constants::function)
                 .values(Option<std::string>(Constants::filter), Option<std::string>(Constants::desc),
@@ -53,8 +76,20 @@ namespace scanbdpp {
                         Option<std::string>(Constants::script_dir).default_value(Constants::script_dir_def),
                         Option<std::string>(Constants::device_insert_script),
                         Option<std::string>(Constants::device_remove_script),
+                        Option<int>(Constants::deadline).default_value(Constants::deadline_def), limits_structure,
                         Option<int>(Constants::timeout).default_value(Constants::timeout_def),
+                        Option<int>(Constants::read_deadline).default_value(Constants::read_deadline_def),
+                        Option<int>(Constants::open_retries).default_value(Constants::open_retries_def),
                         Option<std::string>(Constants::pidfile),
+                        Option<bool>(Constants::launcher).default_value(Constants::launcher_def),
+                        Option<bool>(Constants::option_snapshot).default_value(Constants::option_snapshot_def),
+                        Option<std::string>(Constants::event_socket).default_value(Constants::event_socket_def),
+                        Option<bool>(Constants::capture_output).default_value(Constants::capture_output_def),
+                        Option<std::string>(Constants::isolation).default_value(Constants::isolation_def),
+                        Option<std::string>(Constants::metrics_file).default_value(Constants::metrics_file_def),
+                        Option<std::string>(Constants::metrics_socket).default_value(Constants::metrics_socket_def),
+                        Option<int>(Constants::metrics_interval).default_value(Constants::metrics_interval_def),
+                        Option<bool>(Constants::trace).default_value(Constants::trace_def),
                         Section(Constants::environment)
                             .values(Option<std::string>(Constants::device), Option<std::string>(Constants::action)),
                         Option<bool>(Constants::multiple_actions).default_value(true), function_structure,
@@ -67,13 +102,24 @@ namespace scanbdpp {
 
         auto conf = confusepp::Config::parse(run_config.config_path(), std::move(config_structure));
 
+        Metrics metrics;
+        metrics
+            .counter("scanbd_config_reloads_total", "Loads of the config, including the first one",
+                     {{"result", conf ? "ok" : "error"}})
+            .fetch_add(1, std::memory_order_relaxed);
+
         if (conf) {
             _config = std::make_unique<confusepp::Config>(std::move(*conf));
+            ++_generation;
+
+            if (auto trace = _config->get<Option<bool>>(Constants::global / Constants::trace); trace) {
+                Tracer().enable(trace->value());
+            }
         } else {
             if (!std::experimental::filesystem::exists(run_config.config_path())) {
-                spdlog::get("logger")->critical("The provided config doesn't exist");
+                logger.critical("The provided config doesn't exist");
             } else {
-                spdlog::get("logger")->critical("Config failed to parse");
+                logger.critical("Config failed to parse");
             }
         }
     }
@@ -110,50 +156,4 @@ namespace scanbdpp {
         return absolute_path;
     }
 
-    std::vector<std::string> environment() {
-        std::vector<std::string> env_vars;
-        Config config;
-
-        std::string current_env = "PATH";
-
-        if (getenv(current_env.c_str())) {
-            env_vars.emplace_back(getenv(current_env.c_str()));
-        } else {
-            env_vars.emplace_back("/usr/sbin:/usr/bin:/sbin:/bin");
-        }
-
-        current_env = "PWD";
-
-        if (getenv(current_env.c_str())) {
-            env_vars.emplace_back(getenv(current_env.c_str()));
-        } else {
-            auto working_directory = std::experimental::filesystem::current_path();
-            if (working_directory != std::experimental::filesystem::path{}) {
-                env_vars.emplace_back(working_directory.c_str());
-            } else {
-                spdlog::get("logger")->warn("Couldn't get working directory");
-            }
-        }
-
-        current_env = "USER";
-
-        if (getenv(current_env.c_str())) {
-            env_vars.emplace_back(getenv(current_env.c_str()));
-        } else {
-            passwd *pwd = getpwuid(geteuid());
-            env_vars.emplace_back(pwd->pw_name);
-        }
-
-        current_env = "HOME";
-
-        if (getenv(current_env.c_str())) {
-            env_vars.emplace_back(getenv(current_env.c_str()));
-        } else {
-            passwd *pwd = getpwuid(geteuid());
-            env_vars.emplace_back(pwd->pw_dir);
-        }
-
-        return env_vars;
-    }
-
 }  // namespace scanbdpp
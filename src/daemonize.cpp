@@ -7,26 +7,25 @@
 #include <cstdlib>
 #include <initializer_list>
 
-#include "spdlog/spdlog.h"
-
 #include "daemonize.h"
+#include "logging.h"
 
 namespace scanbdpp {
     bool daemonize() {
         if (pid_t pid = fork(); pid < 0) {
-            spdlog::get("logger")->critical("Couldn't fork {0}", strerror(errno));
+            logger.critical("Couldn't fork {0}", strerror(errno));
             return false;
         } else if (pid > 0) {
             exit(EXIT_SUCCESS);
         }
 
         if (setsid() < 0) {
-            spdlog::get("logger")->critical("setsid error {0}", strerror(errno));
+            logger.critical("setsid error {0}", strerror(errno));
             return false;
         }
 
         if (pid_t pid = fork(); pid < 0) {
-            spdlog::get("logger")->critical("Couldn't fork {0}", strerror(errno));
+            logger.critical("Couldn't fork {0}", strerror(errno));
             return false;
         } else if (pid > 0) {
             exit(EXIT_SUCCESS);
@@ -35,13 +34,13 @@ namespace scanbdpp {
         int ofd = -1;
 
         if (ofd = open("/dev/null", O_RDWR); ofd < 0) {
-            spdlog::get("logger")->warn("Couldn't open /dev/null {0}", strerror(errno));
+            logger.warn("Couldn't open /dev/null {0}", strerror(errno));
             return false;
         }
 
         auto point_filedes_to = [ofd](int fd) {
             if (dup2(ofd, fd) < 0) {
-                spdlog::get("logger")->warn("Couldn't set filedescriptor {0}", strerror(errno));
+                logger.warn("Couldn't set filedescriptor {0}", strerror(errno));
             }
         };
 
@@ -50,7 +49,7 @@ namespace scanbdpp {
         }
 
         if (chdir("/") < 0) {
-            spdlog::get("logger")->warn("Couldn't change working directory", strerror(errno));
+            logger.warn("Couldn't change working directory", strerror(errno));
         }
 
         return true;
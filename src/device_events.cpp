@@ -5,77 +5,71 @@
 #include <string>
 #include <vector>
 
-#include <pwd.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-
 #include "spdlog/spdlog.h"
 
 #include "config.h"
 #include "device_events.h"
+#include "environment.h"
+#include "event_server.h"
+#include "metrics.h"
 #include "sane.h"
-#include "signal.h"
+#include "script.h"
 
 namespace scanbdpp {
 
+    // The static part of the environment only changes, when the config is reloaded
+    Environment &DeviceEvents::environment() {
+        Config config;
+
+        if (!m_environment || m_config_generation != config.generation()) {
+            m_environment.emplace();
+            m_config_generation = config.generation();
+        }
+
+        return m_environment->reset();
+    }
+
     void DeviceEvents::hook_device_ex(const std::string &parameter, const std::string &action_name,
                                       const std::string &device_name) {
         Config config;
-        if (!config || !config.get<confusepp::Option<std::string>>(parameter)) {
+        auto script_option = config.get<confusepp::Option<std::string>>(Config::Constants::global / parameter);
+        if (!config || !script_option || script_option->value().empty()) {
             return;
         }
 
-        std::vector<std::string> env_vars = environment();
+        Environment &env = environment().device(device_name).action(action_name);
+        char *const *environment_variables = env.envp();
 
-        if (auto device = config.get<confusepp::Option<std::string>>(Config::Constants::global / Config::Constants::device); device) {
-            env_vars.emplace_back(device->value() + "=" + device_name);
+        ScriptLimits limits;
+        if (auto global_section = config.get<confusepp::Section>(Config::Constants::global); global_section) {
+            limits = read_script_limits(*global_section);
         }
 
-        if (auto action = config.get<confusepp::Option<std::string>>(Config::Constants::global / Config::Constants::action); action) {
-            env_vars.emplace_back(action->value() + "=" + action_name);
-        }
-
-        std::unique_ptr<const char *[]> environment_variables = std::make_unique<const char *[]>(env_vars.size() + 1);
-
-        size_t index = 0;
-        for (auto &current_env : env_vars) {
-            environment_variables[index++] = current_env.c_str();
-        }
-        environment_variables[env_vars.size()] = nullptr;
-
-        std::string script = config.get<confusepp::Option<std::string>>(parameter)->value();
-        if (auto script_path = make_script_path_absolute(script); !script_path.empty()) {
-            if (pid_t cpid = fork(); cpid > 0) {
-                int status = 0;
-
-                if (waitpid(cpid, &status, 0) < 0) {
-                }
-
-                if (WIFEXITED(status)) {
-                }
-
-                if (WIFSIGNALED(status)) {
-                }
-            } else if (cpid == 0) {
-                if (execle(script_path.native().c_str(), script_path.native().c_str(), nullptr,
-                           environment_variables.get()) < 0) {
-                    // TODO log error
-                }
-
-                exit(EXIT_FAILURE);
-            } else {
-                // TODO log error couldn't fork
-            }
+        ScriptRegistry scripts;
+        if (auto script = scripts.resolve(script_option->value()); script) {
+            script->run(environment_variables, limits, {}, device_name + "/" + action_name);
         }
     }
 
     void DeviceEvents::hook_device_insert(const std::string &device_name) {
         // hook_device_insert
+        Metrics metrics;
+        metrics.counter("scanbd_hotplug_events_total", "Inserted and removed devices", {{"event", "insert"}})
+            .fetch_add(1, std::memory_order_relaxed);
+
+        EventServer events;
+        events.publish(Event{Event::Type::INSERT, device_name, "insert"});
         hook_device_ex(Config::Constants::device_insert_script, "insert", device_name);
     }
 
     void DeviceEvents::hook_device_remove(const std::string &device_name) {
         // hook_device_remove
+        Metrics metrics;
+        metrics.counter("scanbd_hotplug_events_total", "Inserted and removed devices", {{"event", "remove"}})
+            .fetch_add(1, std::memory_order_relaxed);
+
+        EventServer events;
+        events.publish(Event{Event::Type::REMOVE, device_name, "remove"});
         hook_device_ex(Config::Constants::device_remove_script, "remove", device_name);
     }
 
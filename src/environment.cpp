@@ -0,0 +1,121 @@
+// clang-format off
+#include "common.h"
+#include <sys/types.h>
+#include <pwd.h>
+// clang-format on
+
+#include <cstdlib>
+#include <experimental/filesystem>
+
+#include "config.h"
+#include "environment.h"
+#include "logging.h"
+
+namespace scanbdpp {
+
+    Environment::Environment() {
+        Config config;
+
+        if (auto device_env = config.get<confusepp::Option<std::string>>(
+                Config::Constants::global / Config::Constants::environment / Config::Constants::device);
+            device_env) {
+            m_device_env = device_env->value();
+        }
+
+        if (auto action_env = config.get<confusepp::Option<std::string>>(
+                Config::Constants::global / Config::Constants::environment / Config::Constants::action);
+            action_env) {
+            m_action_env = action_env->value();
+        }
+
+        if (const char *path = getenv("PATH"); path) {
+            add("PATH", path);
+        } else {
+            add("PATH", "/usr/sbin:/usr/bin:/sbin:/bin");
+        }
+
+        if (const char *pwd = getenv("PWD"); pwd) {
+            add("PWD", pwd);
+        } else {
+            auto working_directory = std::experimental::filesystem::current_path();
+            if (working_directory != std::experimental::filesystem::path{}) {
+                add("PWD", working_directory.c_str());
+            } else {
+                logger.warn("Couldn't get working directory");
+            }
+        }
+
+        const char *user = getenv("USER");
+        const char *home = getenv("HOME");
+
+        if (!user || !home) {
+            passwd pwd;
+            passwd *result = nullptr;
+            char buf[1024];
+
+            if (getpwuid_r(geteuid(), &pwd, buf, sizeof(buf), &result) == 0 && result) {
+                add("USER", user ? user : result->pw_name);
+                add("HOME", home ? home : result->pw_dir);
+            } else {
+                logger.warn("Couldn't get user of the daemon");
+            }
+        } else {
+            add("USER", user);
+            add("HOME", home);
+        }
+
+        m_static_arena_size = m_arena.size();
+        m_static_offsets_size = m_offsets.size();
+    }
+
+    Environment &Environment::reset() {
+        m_arena.resize(m_static_arena_size);
+        m_offsets.resize(m_static_offsets_size);
+        return *this;
+    }
+
+    Environment &Environment::device(std::string_view device_name) {
+        if (!m_device_env.empty()) {
+            add(m_device_env, device_name);
+        }
+
+        return *this;
+    }
+
+    Environment &Environment::action(std::string_view action_name) {
+        if (!m_action_env.empty()) {
+            add(m_action_env, action_name);
+        }
+
+        return *this;
+    }
+
+    Environment &Environment::add(std::string_view name, std::string_view value) {
+        m_offsets.push_back(m_arena.size());
+        m_arena.insert(m_arena.end(), name.begin(), name.end());
+        m_arena.push_back('=');
+        m_arena.insert(m_arena.end(), value.begin(), value.end());
+        m_arena.push_back('\0');
+        return *this;
+    }
+
+    // The pointers are only valid until the environment is modified again
+    char *const *Environment::envp() {
+        m_envp.resize(m_offsets.size() + 1);
+
+        for (size_t index = 0; index < m_offsets.size(); ++index) {
+            m_envp[index] = m_arena.data() + m_offsets[index];
+        }
+        m_envp[m_offsets.size()] = nullptr;
+
+        return m_envp.data();
+    }
+
+    // Everything, which was added after the static part, as '\0' terminated NAME=value entries
+    std::string_view Environment::dynamic_entries() const {
+        return std::string_view(m_arena.data() + m_static_arena_size, m_arena.size() - m_static_arena_size);
+    }
+
+    size_t Environment::size() const { return m_offsets.size(); }
+
+}  // namespace scanbdpp
@@ -0,0 +1,437 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+// clang-format on
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "config.h"
+#include "event_server.h"
+#include "logging.h"
+#include "metrics.h"
+#include "signal_handler.h"
+#include "snapshot.h"
+
+namespace scanbdpp {
+    namespace {
+        const char *event_type_name(Event::Type type) {
+            switch (type) {
+                case Event::Type::BUTTON:
+                    return "button";
+                case Event::Type::INSERT:
+                    return "insert";
+                case Event::Type::REMOVE:
+                    return "remove";
+                case Event::Type::SCRIPT:
+                    return "script";
+                case Event::Type::SCAN:
+                    return "scan";
+            }
+
+            return "unknown";
+        }
+
+        Metrics::Gauge &queue_depth() {
+            static auto &depth =
+                Metrics().gauge("scanbd_event_queue_depth", "Events queued for all subscribers of the event socket");
+            return depth;
+        }
+
+        Metrics::Counter &dropped_events() {
+            static auto &dropped =
+                Metrics().counter("scanbd_events_dropped_total", "Events dropped for slow subscribers");
+            return dropped;
+        }
+
+        // Has to be called with the subscriber mutex locked
+        template<typename Subscribers>
+        void update_queue_depth(const Subscribers &subscribers) {
+            int64_t depth = 0;
+            for (const auto &current_subscriber : subscribers) {
+                depth += current_subscriber->queue.size();
+            }
+            queue_depth().store(depth, std::memory_order_relaxed);
+        }
+    }  // namespace
+
+    std::string serialize_event(const Event &event) {
+        return "event\n" + std::to_string(static_cast<int>(event.type)) + "\n" + std::to_string(event.value) + "\n" +
+               event.device + "\n" + event.action;
+    }
+
+    std::optional<Event> parse_event(const std::string &message) {
+        std::istringstream message_stream(message);
+        std::string tag;
+        std::string type;
+        std::string value;
+        Event event;
+
+        if (!std::getline(message_stream, tag) || tag != "event" || !std::getline(message_stream, type) ||
+            !std::getline(message_stream, value) || !std::getline(message_stream, event.device)) {
+            return {};
+        }
+
+        // The action is the rest of the message and may be empty
+        std::getline(message_stream, event.action);
+
+        try {
+            auto type_number = std::stoi(type);
+
+            if (type_number < static_cast<int>(Event::Type::BUTTON) ||
+                type_number > static_cast<int>(Event::Type::SCAN)) {
+                return {};
+            }
+
+            event.type = static_cast<Event::Type>(type_number);
+            event.value = std::stoi(value);
+        } catch (const std::logic_error &) {
+            return {};
+        }
+
+        return event;
+    }
+
+    EventServer::EventServer() {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        ++_instance_count;
+    }
+
+    EventServer::~EventServer() {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        --_instance_count;
+
+        if (!_instance_count) {
+            stop();
+        }
+    }
+
+    // The server is only started, if a socket path is configured
+    void EventServer::start() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (_thread_started) {
+            return;
+        }
+
+        Config config;
+        auto socket_option =
+            config.get<confusepp::Option<std::string>>(Config::Constants::global / Config::Constants::event_socket);
+
+        if (!socket_option || socket_option->value().empty()) {
+            return;
+        }
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+
+        if (socket_option->value().size() >= sizeof(address.sun_path)) {
+            logger.critical("Event socket path {0} is too long", socket_option->value());
+            return;
+        }
+
+        std::strncpy(address.sun_path, socket_option->value().c_str(), sizeof(address.sun_path) - 1);
+
+        int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+        if (listen_fd < 0) {
+            logger.critical("Couldn't create event socket {0}", strerror(errno));
+            return;
+        }
+
+        // A socket of a previous run would prevent the bind
+        unlink(address.sun_path);
+
+        if (bind(listen_fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0 ||
+            listen(listen_fd, Constants::max_subscribers) < 0) {
+            logger.critical("Couldn't listen on event socket {0} {1}", address.sun_path, strerror(errno));
+            close(listen_fd);
+            return;
+        }
+
+        chmod(address.sun_path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+        if (_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); _wake_fd < 0) {
+            logger.critical("Couldn't create eventfd {0}", strerror(errno));
+            close(listen_fd);
+            unlink(address.sun_path);
+            return;
+        }
+
+        _socket_path = address.sun_path;
+        _thread_stop = false;
+        _thread_started = true;
+        _thread_inst = std::thread(server_thread, listen_fd);
+        logger.info("Starting event thread on {0}", _socket_path.c_str());
+    }
+
+    void EventServer::stop() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (!_thread_started) {
+            return;
+        }
+
+        _thread_stop = true;
+        wake_up();
+
+        if (_thread_inst.joinable()) {
+            _thread_inst.join();
+            logger.info("Stopped event thread");
+        } else {
+            logger.info("Couldn't join event thread");
+        }
+
+        close(_wake_fd);
+        _wake_fd = -1;
+        unlink(_socket_path.c_str());
+        _thread_started = false;
+    }
+
+    // Is called from the poll threads, the record is formatted once and shared by all queues
+    void EventServer::forward(int fd) const { _forward_fd = fd; }
+
+    void EventServer::publish(const Event &event) const {
+        if (int fd = _forward_fd; fd >= 0) {
+            auto message = serialize_event(event);
+            send(fd, message.data(), message.size(), MSG_NOSIGNAL);
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(_subscriber_mutex);
+
+        if (_subscribers.empty()) {
+            return;
+        }
+
+        auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+
+        auto record = std::make_shared<std::string>("{\"type\":\"");
+        *record += event_type_name(event.type);
+        *record += "\",\"device\":";
+        detail::append_json_string(*record, event.device);
+        *record += ",\"action\":";
+        detail::append_json_string(*record, event.action);
+        *record += ",\"value\":" + std::to_string(event.value) + ",\"time\":" + std::to_string(time) + "}";
+
+        bool queued = false;
+
+        for (auto &current_subscriber : _subscribers) {
+            if ((current_subscriber->filter_device &&
+                 !std::regex_match(event.device, current_subscriber->device_filter)) ||
+                (current_subscriber->filter_action &&
+                 !std::regex_match(event.action, current_subscriber->action_filter))) {
+                continue;
+            }
+
+            if (current_subscriber->queue.size() >= Constants::max_queue_size) {
+                current_subscriber->queue.pop_front();
+                ++current_subscriber->dropped;
+                dropped_events().fetch_add(1, std::memory_order_relaxed);
+            }
+
+            current_subscriber->queue.push_back(record);
+            queued = true;
+        }
+
+        update_queue_depth(_subscribers);
+
+        if (queued) {
+            wake_up();
+        }
+    }
+
+    void EventServer::wake_up() {
+        uint64_t value = 1;
+
+        if (write(_wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            logger.warn("Couldn't wake up event thread {0}", strerror(errno));
+        }
+    }
+
+    void EventServer::server_thread(int listen_fd) {
+        SignalHandler signal_handler;
+        signal_handler.disable_signals_for_thread();
+
+        std::vector<pollfd> fds;
+
+        while (!_thread_stop) {
+            fds.clear();
+            fds.push_back({listen_fd, POLLIN, 0});
+            fds.push_back({_wake_fd, POLLIN, 0});
+
+            {
+                std::lock_guard<std::mutex> guard(_subscriber_mutex);
+
+                for (const auto &current_subscriber : _subscribers) {
+                    short events = POLLIN;
+                    if (!current_subscriber->queue.empty() || current_subscriber->dropped) {
+                        events |= POLLOUT;
+                    }
+                    fds.push_back({current_subscriber->fd, events, 0});
+                }
+            }
+
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                logger.critical("Polling event socket failed {0}", strerror(errno));
+                break;
+            }
+
+            if (fds[1].revents & POLLIN) {
+                uint64_t value;
+                while (read(_wake_fd, &value, sizeof(value)) == sizeof(value)) {
+                }
+            }
+
+            {
+                // Only this thread adds or removes subscribers, so the indices still match the descriptors
+                std::lock_guard<std::mutex> guard(_subscriber_mutex);
+
+                for (size_t index = _subscribers.size(); index-- > 0;) {
+                    auto &current_subscriber = *_subscribers[index];
+                    short revents = fds[2 + index].revents;
+
+                    bool keep = !(revents & (POLLERR | POLLNVAL));
+
+                    if (keep && (revents & POLLIN)) {
+                        keep = read_filter(current_subscriber);
+                    } else if (keep && (revents & POLLHUP)) {
+                        keep = false;
+                    }
+
+                    if (keep) {
+                        keep = send_queued(current_subscriber);
+                    }
+
+                    if (!keep) {
+                        logger.repeating_info("Event subscriber {0} disconnected", current_subscriber.fd);
+                        close(current_subscriber.fd);
+                        _subscribers.erase(_subscribers.begin() + index);
+                    }
+                }
+
+                update_queue_depth(_subscribers);
+            }
+
+            if (fds[0].revents & POLLIN) {
+                accept_subscriber(listen_fd);
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(_subscriber_mutex);
+
+        for (auto &current_subscriber : _subscribers) {
+            close(current_subscriber->fd);
+        }
+        _subscribers.clear();
+
+        close(listen_fd);
+    }
+
+    void EventServer::accept_subscriber(int listen_fd) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                logger.warn("Couldn't accept event subscriber {0}", strerror(errno));
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(_subscriber_mutex);
+
+        if (_subscribers.size() >= Constants::max_subscribers) {
+            logger.warn("Too many event subscribers, rejecting new subscriber");
+            close(fd);
+            return;
+        }
+
+        auto subscriber = std::make_unique<Subscriber>();
+        subscriber->fd = fd;
+        _subscribers.emplace_back(std::move(subscriber));
+        logger.repeating_info("Event subscriber {0} connected", fd);
+    }
+
+    // An empty regex removes the filter again
+    bool EventServer::read_filter(Subscriber &subscriber) {
+        char buf[Constants::max_filter_size];
+        ssize_t length = recv(subscriber.fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+        if (length == 0) {
+            return false;
+        } else if (length < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+
+        std::istringstream message(std::string(buf, length));
+
+        for (std::string line; std::getline(message, line);) {
+            auto separator = line.find('=');
+
+            if (separator == std::string::npos) {
+                continue;
+            }
+
+            std::string key = line.substr(0, separator);
+            std::string value = line.substr(separator + 1);
+
+            if (key != "device" && key != "action") {
+                continue;
+            }
+
+            bool &enabled = key == "device" ? subscriber.filter_device : subscriber.filter_action;
+            std::regex &filter = key == "device" ? subscriber.device_filter : subscriber.action_filter;
+
+            try {
+                filter.assign(value, std::regex_constants::extended);
+                enabled = !value.empty();
+            } catch (std::regex_error) {
+                logger.warn("Event subscriber {0} sent an invalid {1} filter", subscriber.fd, key);
+            }
+        }
+
+        return true;
+    }
+
+    // Sends as many records as the socket accepts, the rest stays queued
+    bool EventServer::send_queued(Subscriber &subscriber) {
+        if (subscriber.dropped) {
+            std::string record = "{\"type\":\"dropped\",\"value\":" + std::to_string(subscriber.dropped) + "}";
+
+            if (send(subscriber.fd, record.data(), record.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+                return errno == EAGAIN || errno == EINTR;
+            }
+
+            subscriber.dropped = 0;
+        }
+
+        while (!subscriber.queue.empty()) {
+            const auto &record = *subscriber.queue.front();
+
+            if (send(subscriber.fd, record.data(), record.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+                return errno == EAGAIN || errno == EINTR;
+            }
+
+            subscriber.queue.pop_front();
+        }
+
+        return true;
+    }
+}  // namespace scanbdpp
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "histogram.h"
+
+namespace scanbdpp {
+
+    std::string format_time(std::chrono::nanoseconds time) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.2f ms", time.count() / 1e6);
+        return buf;
+    }
+
+    LatencyHistogram::LatencyHistogram(const LatencyHistogram &other)
+        : m_count(other.m_count.load()), m_sum(other.m_sum.load()), m_max(other.m_max.load()) {
+        for (size_t index = 0; index < m_buckets.size(); ++index) {
+            m_buckets[index] = other.m_buckets[index].load();
+        }
+    }
+
+    void LatencyHistogram::record(std::chrono::nanoseconds latency) {
+        // The first bound, which is not smaller than the latency
+        auto index = std::upper_bound(bounds.begin(), bounds.end(), latency,
+                                      [](std::chrono::nanoseconds value, std::chrono::microseconds bound) {
+                                          return value <= bound;
+                                      }) -
+                     bounds.begin();
+
+        m_buckets[index].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(latency.count(), std::memory_order_relaxed);
+
+        // Parallel scripts record into the same histogram
+        for (auto current_max = m_max.load(std::memory_order_relaxed);
+             latency.count() > current_max &&
+             !m_max.compare_exchange_weak(current_max, latency.count(), std::memory_order_relaxed);) {
+        }
+    }
+
+    uint64_t LatencyHistogram::count() const { return m_count.load(std::memory_order_relaxed); }
+
+    uint64_t LatencyHistogram::bucket(size_t index) const { return m_buckets[index].load(std::memory_order_relaxed); }
+
+    std::chrono::nanoseconds LatencyHistogram::sum() const {
+        return std::chrono::nanoseconds(m_sum.load(std::memory_order_relaxed));
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::max() const {
+        return std::chrono::nanoseconds(m_max.load(std::memory_order_relaxed));
+    }
+
+    // Values in the overflow bucket are reported as the maximum
+    std::chrono::nanoseconds LatencyHistogram::percentile(double fraction) const {
+        uint64_t total = 0;
+        std::array<uint64_t, bounds.size() + 1> counts;
+
+        for (size_t index = 0; index < counts.size(); ++index) {
+            counts[index] = bucket(index);
+            total += counts[index];
+        }
+
+        if (!total) {
+            return std::chrono::nanoseconds(0);
+        }
+
+        uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(fraction * total + 0.5), 1);
+        uint64_t seen = 0;
+
+        for (size_t index = 0; index < bounds.size(); ++index) {
+            seen += counts[index];
+
+            if (seen >= rank) {
+                return std::min<std::chrono::nanoseconds>(bounds[index], max());
+            }
+        }
+
+        return max();
+    }
+
+    std::string LatencyHistogram::summary(const std::string &unit) const {
+        return std::to_string(count()) + " " + unit + ", p50 " + format_time(percentile(0.5)) + ", p99 " +
+               format_time(percentile(0.99)) + ", max " + format_time(max());
+    }
+}  // namespace scanbdpp
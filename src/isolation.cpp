@@ -0,0 +1,512 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+// clang-format on
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+
+#include "config.h"
+#include "event_server.h"
+#include "isolation.h"
+#include "logging.h"
+#include "run_configuration.h"
+#include "sane.h"
+#include "sanepp.h"
+#include "signal_handler.h"
+
+namespace scanbdpp {
+    namespace {
+        bool send_message(int fd, const std::string &message) {
+            return send(fd, message.data(), message.size(), MSG_NOSIGNAL | MSG_DONTWAIT) ==
+                   static_cast<ssize_t>(message.size());
+        }
+
+        std::string describe_exit(int status) {
+            if (WIFSIGNALED(status)) {
+                return "was killed by signal " + std::to_string(WTERMSIG(status));
+            }
+
+            return "exited with " + std::to_string(WEXITSTATUS(status));
+        }
+
+        // Backends are the first part of the SANE name (e.g. pixma in pixma:04A91912_123456)
+        std::string backend_name(const std::string &device_name) {
+            return device_name.substr(0, device_name.find(':'));
+        }
+    }  // namespace
+
+    IsolationMode isolation_mode() {
+        Config config;
+        auto isolation_option =
+            config.get<confusepp::Option<std::string>>(Config::Constants::global / Config::Constants::isolation);
+
+        if (!isolation_option || isolation_option->value().empty()) {
+            return IsolationMode::NONE;
+        } else if (isolation_option->value() == "device") {
+            return IsolationMode::DEVICE;
+        } else if (isolation_option->value() == "backend") {
+            return IsolationMode::BACKEND;
+        }
+
+        logger.warn("Unknown isolation {0}, polling devices in threads", isolation_option->value());
+        return IsolationMode::NONE;
+    }
+
+    // The devices are only listed here, they are opened by the workers
+    bool IsolationSupervisor::start(IsolationMode mode) const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (_thread_started) {
+            return true;
+        }
+
+        if (_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); _wake_fd < 0) {
+            logger.critical("Couldn't create eventfd {0}", strerror(errno));
+            return false;
+        }
+
+        sanepp::Sane sane_instance;
+
+        {
+            std::lock_guard<std::mutex> worker_guard(_worker_mutex);
+
+            for (auto device_info : sane_instance.devices(true)) {
+                auto name = mode == IsolationMode::DEVICE ? device_info.name() : backend_name(device_info.name());
+                auto worker = std::find_if(_workers.begin(), _workers.end(),
+                                           [&name](const auto &current_worker) { return current_worker->name == name; });
+
+                if (worker == _workers.end()) {
+                    _workers.emplace_back(std::make_unique<WorkerProcess>());
+                    _workers.back()->name = name;
+                    worker = std::prev(_workers.end());
+                }
+
+                (*worker)->devices.push_back(device_info.name());
+            }
+
+            logger.info("Starting {0} polling worker processes", _workers.size());
+        }
+
+        _thread_stop = false;
+        _workers_stopping = false;
+        _thread_started = true;
+        _thread_inst = std::thread(supervisor_thread);
+        return true;
+    }
+
+    // The workers are stopped, while the supervisor thread is still running: it forked them, so they get SIGTERM
+    // (PR_SET_PDEATHSIG) as soon as it exits. Meanwhile it reaps the workers and doesn't restart them.
+    void IsolationSupervisor::stop() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (!_thread_started) {
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(_worker_mutex);
+            _workers_stopping = true;
+
+            for (auto &current_worker : _workers) {
+                if (current_worker->pid > 0) {
+                    send_message(current_worker->socket, "stop");
+                }
+            }
+
+            auto stopped = [] {
+                return std::all_of(_workers.begin(), _workers.end(),
+                                   [](const auto &current_worker) { return current_worker->pid < 0; });
+            };
+
+            if (!_report_condition.wait_for(lock, Constants::stop_timeout, stopped)) {
+                for (auto &current_worker : _workers) {
+                    if (current_worker->pid > 0) {
+                        logger.warn("Worker {0} (pid {1}) didn't stop, killing it", current_worker->name,
+                                    current_worker->pid);
+                        kill(current_worker->pid, SIGKILL);
+                    }
+                }
+
+                _report_condition.wait_for(lock, Constants::stop_timeout, stopped);
+            }
+        }
+
+        _thread_stop = true;
+        wake_up();
+
+        if (_thread_inst.joinable()) {
+            _thread_inst.join();
+        }
+
+        std::lock_guard<std::mutex> worker_guard(_worker_mutex);
+
+        // Workers, which weren't reaped by the supervisor thread in time
+        for (auto &current_worker : _workers) {
+            if (current_worker->pid > 0) {
+                int status = 0;
+
+                close(current_worker->socket);
+                waitpid(current_worker->pid, &status, 0);
+            }
+        }
+
+        logger.info("Stopped {0} polling worker processes", _workers.size());
+
+        _workers.clear();
+        close(_wake_fd);
+        _wake_fd = -1;
+        _thread_started = false;
+    }
+
+    bool IsolationSupervisor::running() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        return _thread_started;
+    }
+
+    bool IsolationSupervisor::trigger_action(const std::string &device_name, const std::string &action_name) const {
+        std::lock_guard<std::mutex> guard(_worker_mutex);
+
+        for (auto &current_worker : _workers) {
+            if (std::find(current_worker->devices.begin(), current_worker->devices.end(), device_name) ==
+                current_worker->devices.end()) {
+                continue;
+            }
+
+            if (current_worker->pid < 0 ||
+                !send_message(current_worker->socket, "trigger\n" + device_name + "\n" + action_name)) {
+                logger.warn("Worker {0} of device {1} isn't running", current_worker->name, device_name);
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    // Workers, which don't answer within status_timeout, are reported without their devices
+    std::string IsolationSupervisor::status() const {
+        std::unique_lock<std::mutex> lock(_worker_mutex);
+
+        for (auto &current_worker : _workers) {
+            if (current_worker->pid > 0) {
+                current_worker->report_pending = send_message(current_worker->socket, "status");
+            }
+        }
+
+        _report_condition.wait_for(lock, Constants::status_timeout, [] {
+            return std::none_of(_workers.begin(), _workers.end(),
+                                [](const auto &current_worker) { return current_worker->report_pending; });
+        });
+
+        auto now = std::chrono::steady_clock::now();
+        std::string report = std::to_string(_workers.size()) + " polling worker processes\n";
+
+        for (auto &current_worker : _workers) {
+            report += "worker " + current_worker->name + ": ";
+
+            if (current_worker->pid > 0) {
+                report += "pid " + std::to_string(current_worker->pid) + ", up " +
+                          std::to_string(std::chrono::duration_cast<std::chrono::seconds>(
+                                             now - current_worker->started)
+                                             .count()) +
+                          " s, " + std::to_string(current_worker->restarts) + " restarts" +
+                          (current_worker->report_pending ? ", didn't answer" : "") + "\n";
+
+                if (!current_worker->report_pending) {
+                    report += current_worker->report;
+                }
+            } else if (current_worker->idle) {
+                report += "nothing to poll\n" + current_worker->report;
+            } else {
+                report += "restarting in " +
+                          std::to_string(std::max<long>(std::chrono::duration_cast<std::chrono::seconds>(
+                                                            current_worker->next_start - now)
+                                                            .count(),
+                                                        0)) +
+                          " s, " + current_worker->last_exit + "\n";
+            }
+
+            current_worker->report_pending = false;
+        }
+
+        return report;
+    }
+
+    // The arguments are prepared before fork, the child only calls async signal safe functions until exec
+    bool IsolationSupervisor::spawn(WorkerProcess &worker) {
+        int sockets[2];
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) < 0) {
+            logger.critical("Couldn't create worker socket {0}", strerror(errno));
+            return false;
+        }
+
+        RunConfiguration run_config;
+        std::vector<std::string> arguments{"scanbd", "--worker", std::to_string(sockets[1]), "-c",
+                                           run_config.config_path().native()};
+
+        if (run_config.foreground()) {
+            arguments.push_back("-f");
+        }
+
+        if (run_config.debug()) {
+            arguments.push_back("-d");
+            arguments.push_back(std::to_string(run_config.debug_level()));
+        }
+
+        std::vector<char *> argv;
+        for (auto &current_argument : arguments) {
+            argv.push_back(current_argument.data());
+        }
+        argv.push_back(nullptr);
+
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            logger.critical("Couldn't fork worker {0} {1}", worker.name, strerror(errno));
+            close(sockets[0]);
+            close(sockets[1]);
+            return false;
+        } else if (pid == 0) {
+            // The supervisor thread blocks all signals, the worker needs its own handlers
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigprocmask(SIG_SETMASK, &mask, nullptr);
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            fcntl(sockets[1], F_SETFD, 0);
+            execv("/proc/self/exe", argv.data());
+            _exit(127);
+        }
+
+        close(sockets[1]);
+        worker.pid = pid;
+        worker.socket = sockets[0];
+        worker.started = std::chrono::steady_clock::now();
+        worker.report.clear();
+
+        std::string devices = "devices";
+        for (const auto &current_device : worker.devices) {
+            devices += "\n" + current_device;
+        }
+        send_message(worker.socket, devices);
+
+        logger.info("Started worker {0} (pid {1}) for {2} devices", worker.name, worker.pid, worker.devices.size());
+        return true;
+    }
+
+    // Is called when the socket of the worker is closed, so the worker has exited (or is about to)
+    void IsolationSupervisor::reap(WorkerProcess &worker) {
+        int status = 0;
+
+        close(worker.socket);
+        waitpid(worker.pid, &status, 0);
+
+        worker.last_exit = describe_exit(status);
+        worker.socket = -1;
+        worker.pid = -1;
+        worker.report_pending = false;
+        _report_condition.notify_all();
+
+        if (worker.idle) {
+            logger.info("Worker {0} has no device to poll", worker.name);
+            return;
+        } else if (_workers_stopping) {
+            logger.info("Worker {0} stopped, {1}", worker.name, worker.last_exit);
+            return;
+        }
+
+        logger.warn("Worker {0} {1}", worker.name, worker.last_exit);
+        schedule_restart(worker);
+    }
+
+    void IsolationSupervisor::schedule_restart(WorkerProcess &worker) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (worker.backoff.count() == 0 || now - worker.started >= Constants::stable_time) {
+            worker.backoff = Constants::min_backoff;
+        } else {
+            worker.backoff = std::min(worker.backoff * 2, Constants::max_backoff);
+        }
+
+        worker.next_start = now + worker.backoff;
+        ++worker.restarts;
+
+        logger.info("Restarting worker {0} in {1} ms", worker.name, worker.backoff.count());
+    }
+
+    void IsolationSupervisor::handle_message(WorkerProcess &worker, const std::string &message) {
+        auto separator = message.find('\n');
+        auto tag = message.substr(0, separator);
+        auto body = separator == std::string::npos ? std::string() : message.substr(separator + 1);
+
+        if (tag == "event") {
+            if (auto event = parse_event(message); event) {
+                EventServer events;
+                events.publish(*event);
+            }
+        } else if (tag == "status") {
+            worker.report = body;
+            worker.report_pending = false;
+            _report_condition.notify_all();
+        } else if (tag == "idle") {
+            worker.idle = true;
+            worker.report = body;
+        } else {
+            logger.warn("Unknown message {0} from worker {1}", tag, worker.name);
+        }
+    }
+
+    void IsolationSupervisor::supervisor_thread() {
+        SignalHandler signal_handler;
+        signal_handler.disable_signals_for_thread();
+
+        std::vector<char> buffer(Constants::max_message_size);
+
+        while (!_thread_stop) {
+            std::vector<pollfd> fds{{_wake_fd, POLLIN, 0}};
+            std::vector<WorkerProcess *> polled_workers;
+            int timeout = -1;
+
+            {
+                std::lock_guard<std::mutex> guard(_worker_mutex);
+                auto now = std::chrono::steady_clock::now();
+
+                for (auto &current_worker : _workers) {
+                    if (current_worker->pid < 0 && !current_worker->idle && !_workers_stopping &&
+                        current_worker->next_start <= now && !spawn(*current_worker)) {
+                        current_worker->started = now;
+                        current_worker->last_exit = "couldn't be started";
+                        schedule_restart(*current_worker);
+                    }
+
+                    if (current_worker->pid > 0) {
+                        fds.push_back({current_worker->socket, POLLIN, 0});
+                        polled_workers.push_back(current_worker.get());
+                    } else if (!current_worker->idle && !_workers_stopping) {
+                        int delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                        current_worker->next_start - now)
+                                        .count() +
+                                    1;
+                        timeout = timeout < 0 ? delay : std::min(timeout, delay);
+                    }
+                }
+            }
+
+            if (poll(fds.data(), fds.size(), timeout) < 0) {
+                if (errno != EINTR) {
+                    logger.warn("poll() error {0}", strerror(errno));
+                }
+                continue;
+            }
+
+            if (fds[0].revents & POLLIN) {
+                uint64_t value;
+                while (read(_wake_fd, &value, sizeof(value)) > 0) {
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(_worker_mutex);
+
+            for (size_t index = 0; index < polled_workers.size(); ++index) {
+                if (!fds[index + 1].revents) {
+                    continue;
+                }
+
+                auto &current_worker = *polled_workers[index];
+                ssize_t size = recv(current_worker.socket, buffer.data(), buffer.size(), MSG_DONTWAIT);
+
+                if (size > 0) {
+                    handle_message(current_worker, std::string(buffer.data(), size));
+                } else if (size == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    reap(current_worker);
+                }
+            }
+        }
+    }
+
+    void IsolationSupervisor::wake_up() {
+        uint64_t value = 1;
+
+        if (_wake_fd >= 0 && write(_wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            logger.warn("Couldn't wake up supervisor thread {0}", strerror(errno));
+        }
+    }
+
+    int IsolationSupervisor::worker_main(int control_socket) {
+        SaneHandler sane;
+        SignalHandler signals;
+        std::vector<char> buffer(Constants::max_message_size);
+
+        ssize_t size = recv(control_socket, buffer.data(), buffer.size(), 0);
+        std::istringstream devices_stream(std::string(buffer.data(), std::max<ssize_t>(size, 0)));
+        std::string line;
+
+        if (!std::getline(devices_stream, line) || line != "devices") {
+            logger.critical("Worker didn't get its devices");
+            return EXIT_FAILURE;
+        }
+
+        std::vector<std::string> devices;
+        while (std::getline(devices_stream, line)) {
+            devices.push_back(line);
+        }
+
+        sane.restrict_devices(devices);
+        sane.start();
+
+        if (!sane.polling()) {
+            send_message(control_socket, "idle\n" + sane.status());
+            return EXIT_SUCCESS;
+        }
+
+        while (!signals.should_exit()) {
+            pollfd control_fd{control_socket, POLLIN, 0};
+
+            if (int result = poll(&control_fd, 1, 1000); result < 0) {
+                if (errno != EINTR) {
+                    logger.warn("poll() error {0}", strerror(errno));
+                }
+                continue;
+            } else if (result == 0) {
+                continue;
+            }
+
+            // The supervisor is gone
+            if (size = recv(control_socket, buffer.data(), buffer.size(), 0); size <= 0) {
+                break;
+            }
+
+            std::istringstream message_stream(std::string(buffer.data(), size));
+            std::string tag;
+            std::getline(message_stream, tag);
+
+            if (tag == "trigger") {
+                std::string device;
+                std::string action;
+
+                if (std::getline(message_stream, device) && std::getline(message_stream, action)) {
+                    sane.trigger_action(device, action);
+                }
+            } else if (tag == "status") {
+                send_message(control_socket, "status\n" + sane.status());
+            } else if (tag == "stop") {
+                break;
+            }
+        }
+
+        sane.stop();
+        return EXIT_SUCCESS;
+    }
+}  // namespace scanbdpp
@@ -0,0 +1,402 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <grp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+// clang-format on
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+#include "launcher.h"
+#include "logging.h"
+#include "script.h"
+
+namespace scanbdpp {
+
+    // Has to be called before any threads are started, since the launcher is created with fork
+    bool Launcher::start(uid_t uid, gid_t gid) const {
+        std::lock_guard<std::mutex> guard(_instance_mutex);
+
+        if (_launcher_pid > 0) {
+            return true;
+        }
+
+        int sockets[2];
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) < 0) {
+            logger.critical("Couldn't create launcher socket {0}", strerror(errno));
+            return false;
+        }
+
+        if (pid_t pid = fork(); pid < 0) {
+            logger.critical("Couldn't fork launcher {0}", strerror(errno));
+            close(sockets[0]);
+            close(sockets[1]);
+            return false;
+        } else if (pid == 0) {
+            close(sockets[0]);
+            launcher_main(sockets[1]);
+        } else {
+            close(sockets[1]);
+            _control_socket = sockets[0];
+            _launcher_pid = pid;
+            _uid = uid;
+            _gid = gid;
+        }
+
+        logger.info("Started launcher process {0}", _launcher_pid);
+        return true;
+    }
+
+    void Launcher::stop() const {
+        std::lock_guard<std::mutex> guard(_instance_mutex);
+
+        if (_launcher_pid < 0) {
+            return;
+        }
+
+        // The launcher exits, when the control socket is closed
+        close(_control_socket);
+        waitpid(_launcher_pid, nullptr, 0);
+        logger.info("Stopped launcher process {0}", _launcher_pid);
+
+        _control_socket = -1;
+        _launcher_pid = -1;
+    }
+
+    bool Launcher::running() const {
+        std::lock_guard<std::mutex> guard(_instance_mutex);
+
+        return _launcher_pid > 0;
+    }
+
+    ScriptResult Launcher::run(const Script &script, char *const envp[], const ScriptLimits &limits,
+                               const std::vector<Redirection> &redirections,
+                               const std::function<void(pid_t)> &started) const {
+        std::vector<char> request(sizeof(RequestHeader));
+        RequestHeader header{};
+
+        if (redirections.size() > Constants::max_redirections) {
+            logger.critical("Too many descriptors for script {0}", script.path().c_str());
+            return {};
+        }
+
+        auto append = [&request](std::string_view value) {
+            request.insert(request.end(), value.begin(), value.end());
+            request.push_back('\0');
+        };
+
+        char working_directory[PATH_MAX];
+        append(getcwd(working_directory, sizeof(working_directory)) ? working_directory : "/");
+        append(limits.cgroup_procs);
+
+        header.address_space = limits.address_space;
+        header.cpu_time = limits.cpu_time;
+        header.nice = limits.nice;
+        header.ionice_class = limits.ionice_class;
+        header.ionice_level = limits.ionice_level;
+
+        append(script.path().native());
+        header.argc = 1;
+
+        for (auto current_env = envp; *current_env; ++current_env) {
+            append(*current_env);
+            ++header.envc;
+        }
+
+        if (request.size() > Constants::max_request_size) {
+            logger.critical("Environment of script {0} is too large for the launcher", script.path().c_str());
+            return {};
+        }
+
+        int reply_sockets[2];
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, reply_sockets) < 0) {
+            logger.critical("Couldn't create reply socket {0}", strerror(errno));
+            return {};
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(_instance_mutex);
+
+            header.uid = limits.uid.value_or(_uid);
+            header.gid = limits.gid.value_or(_gid);
+
+            // The script and the reply socket are followed by the descriptors of the redirections
+            std::vector<int> fds{script.fd(), reply_sockets[1]};
+            for (const auto &current_redirection : redirections) {
+                header.redirection_targets[header.redirection_count++] = current_redirection.to;
+                fds.push_back(current_redirection.from);
+            }
+
+            std::memcpy(request.data(), &header, sizeof(header));
+
+            char control[CMSG_SPACE(sizeof(int) * (2 + Constants::max_redirections))];
+            std::memset(control, 0, sizeof(control));
+
+            iovec io{request.data(), request.size()};
+            msghdr message{};
+            message.msg_iov = &io;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+            cmsghdr *control_message = CMSG_FIRSTHDR(&message);
+            control_message->cmsg_level = SOL_SOCKET;
+            control_message->cmsg_type = SCM_RIGHTS;
+            control_message->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+            std::memcpy(CMSG_DATA(control_message), fds.data(), sizeof(int) * fds.size());
+
+            if (_control_socket < 0 || sendmsg(_control_socket, &message, MSG_NOSIGNAL) < 0) {
+                logger.critical("Couldn't send request to launcher {0}", strerror(errno));
+                close(reply_sockets[0]);
+                close(reply_sockets[1]);
+                return {};
+            }
+        }
+
+        close(reply_sockets[1]);
+
+        ScriptResult result;
+        Reply reply;
+
+        // The deadline is enforced here, the launcher only reports the exit status
+        if (recv(reply_sockets[0], &reply, sizeof(reply), 0) != sizeof(reply)) {
+            logger.critical("Lost the child {0}", script.path().c_str());
+        } else if (reply.type != ReplyType::PID) {
+            logger.critical("Launcher couldn't start {0} {1}", script.path().c_str(), strerror(reply.value));
+        } else {
+            logger.info("Waiting for child {0} ({1})", script.path().c_str(), reply.value);
+            started(reply.value);
+
+            int reply_fd = reply_sockets[0];
+            result = detail::supervise_script(reply.value, limits, [reply_fd](auto timeout, auto &status) {
+                pollfd reply_poll{reply_fd, POLLIN, 0};
+                int ready;
+                while ((ready = poll(&reply_poll, 1, timeout.count() < 0 ? -1 : timeout.count())) < 0 &&
+                       errno == EINTR) {
+                }
+
+                if (ready == 0) {
+                    return false;
+                }
+
+                if (Reply status_reply; recv(reply_fd, &status_reply, sizeof(status_reply), 0) ==
+                                            sizeof(status_reply) &&
+                                        status_reply.type == ReplyType::STATUS) {
+                    status = status_reply.value;
+                }
+
+                return true;
+            });
+
+            if (!result.status) {
+                logger.critical("Lost the child {0}", script.path().c_str());
+            }
+        }
+
+        close(reply_sockets[0]);
+        return result;
+    }
+
+    void Launcher::launcher_main(int control_socket) {
+        // The signals are meant for the daemon, SIGTERM still ends the launcher
+        for (int current_signal : {SIGHUP, SIGUSR1, SIGUSR2, SIGINT, SIGPIPE}) {
+            signal(current_signal, SIG_IGN);
+        }
+        signal(SIGTERM, SIG_DFL);
+
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, nullptr);
+
+        int child_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+
+        if (child_fd < 0) {
+            _exit(EXIT_FAILURE);
+        }
+
+        std::vector<std::pair<pid_t, int>> children;
+
+        while (true) {
+            pollfd fds[] = {{control_socket, POLLIN, 0}, {child_fd, POLLIN, 0}};
+
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+
+            if (fds[1].revents & POLLIN) {
+                signalfd_siginfo info;
+                while (read(child_fd, &info, sizeof(info)) == sizeof(info)) {
+                }
+
+                int status = 0;
+                for (pid_t pid; (pid = waitpid(-1, &status, WNOHANG)) > 0;) {
+                    auto child = std::find_if(children.begin(), children.end(),
+                                              [pid](const auto &current) { return current.first == pid; });
+
+                    if (child == children.end()) {
+                        continue;
+                    }
+
+                    Reply reply{ReplyType::STATUS, status};
+                    send(child->second, &reply, sizeof(reply), MSG_NOSIGNAL);
+                    close(child->second);
+                    children.erase(child);
+                }
+            }
+
+            if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if (!handle_request(control_socket, children)) {
+                    break;
+                }
+            }
+        }
+
+        // Waiting threads of the daemon get an error, the scripts keep running
+        for (auto &child : children) {
+            close(child.second);
+        }
+
+        _exit(EXIT_SUCCESS);
+    }
+
+    bool Launcher::handle_request(int control_socket, std::vector<std::pair<pid_t, int>> &children) {
+        static char buf[Constants::max_request_size];
+        int fds[2 + Constants::max_redirections];
+        std::fill(std::begin(fds), std::end(fds), -1);
+        size_t fd_count = 0;
+        char control[CMSG_SPACE(sizeof(fds))];
+
+        iovec io{buf, sizeof(buf)};
+        msghdr message{};
+        message.msg_iov = &io;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        ssize_t length = recvmsg(control_socket, &message, MSG_CMSG_CLOEXEC);
+
+        if (length == 0) {
+            return false;
+        } else if (length < 0) {
+            return errno == EINTR || errno == EAGAIN;
+        }
+
+        if (cmsghdr *control_message = CMSG_FIRSTHDR(&message);
+            control_message && control_message->cmsg_level == SOL_SOCKET &&
+            control_message->cmsg_type == SCM_RIGHTS && control_message->cmsg_len >= CMSG_LEN(2 * sizeof(int))) {
+            fd_count = std::min((control_message->cmsg_len - CMSG_LEN(0)) / sizeof(int), std::size(fds));
+            std::memcpy(fds, CMSG_DATA(control_message), fd_count * sizeof(int));
+        }
+
+        int script_fd = fds[0];
+        int reply_fd = fds[1];
+
+        auto close_redirections = [&]() {
+            for (size_t index = 2; index < fd_count; ++index) {
+                close(fds[index]);
+            }
+        };
+
+        auto reject = [&](int error) {
+            if (reply_fd >= 0) {
+                Reply reply{ReplyType::ERROR, error};
+                send(reply_fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+                close(reply_fd);
+            }
+
+            if (script_fd >= 0) {
+                close(script_fd);
+            }
+
+            close_redirections();
+            return true;
+        };
+
+        if (script_fd < 0 || reply_fd < 0 || static_cast<size_t>(length) < sizeof(RequestHeader) ||
+            buf[length - 1] != '\0') {
+            return reject(EINVAL);
+        }
+
+        RequestHeader header;
+        std::memcpy(&header, buf, sizeof(header));
+
+        if (header.redirection_count != fd_count - 2) {
+            return reject(EINVAL);
+        }
+
+        Redirection redirections[Constants::max_redirections];
+        for (size_t index = 0; index < header.redirection_count; ++index) {
+            redirections[index] = Redirection{fds[2 + index], header.redirection_targets[index]};
+        }
+
+        // Working directory, cgroup, arguments and environment are stored one after another
+        std::vector<char *> strings;
+        for (char *current = buf + sizeof(RequestHeader); current < buf + length; current += strlen(current) + 1) {
+            strings.push_back(current);
+        }
+
+        if (strings.size() != 2 + header.argc + header.envc || header.argc == 0) {
+            return reject(EINVAL);
+        }
+
+        std::vector<char *> argv(strings.begin() + 2, strings.begin() + 2 + header.argc);
+        argv.push_back(nullptr);
+        std::vector<char *> envp(strings.begin() + 2 + header.argc, strings.end());
+        envp.push_back(nullptr);
+
+        ScriptLimits limits;
+        limits.address_space = header.address_space;
+        limits.cpu_time = header.cpu_time;
+        limits.nice = header.nice;
+        limits.ionice_class = header.ionice_class;
+        limits.ionice_level = header.ionice_level;
+        limits.cgroup_procs = strings[1];
+
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            return reject(errno);
+        } else if (pid == 0) {
+            close(control_socket);
+
+            if (getuid() == 0) {
+                gid_t gid = header.gid;
+                if (setgroups(1, &gid) < 0 || setgid(header.gid) < 0 || setuid(header.uid) < 0) {
+                    _exit(EXIT_FAILURE);
+                }
+            }
+
+            if (chdir(strings[0]) < 0) {
+                _exit(EXIT_FAILURE);
+            }
+
+            detail::exec_script(script_fd, argv.data(), envp.data(), redirections, header.redirection_count, &limits);
+        }
+
+        // Same as in the daemon, so the daemon can signal the group right away
+        setpgid(pid, pid);
+        close(script_fd);
+        close_redirections();
+
+        Reply reply{ReplyType::PID, pid};
+        send(reply_fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+        children.emplace_back(pid, reply_fd);
+
+        return true;
+    }
+}  // namespace scanbdpp
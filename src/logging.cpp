@@ -0,0 +1,191 @@
+// clang-format off
+#include "common.h"
+#include <syslog.h>
+// clang-format on
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <mutex>
+
+#include "logging.h"
+#include "signal_handler.h"
+
+namespace scanbdpp {
+    namespace {
+        struct Suppression {
+            // The format string (a literal) identifies the message, nullptr for a free slot
+            const char *format = nullptr;
+            spdlog::level::level_enum level = spdlog::level::info;
+            std::chrono::steady_clock::time_point window_start;
+            unsigned int count = 0;
+            uint64_t suppressed = 0;
+        };
+
+        // One slot per call site of a repeating message, slots are used in order and only freed by stop
+        constexpr size_t max_suppressions = 64;
+        // Shared by all threads, so the flush thread can report the counts
+        std::array<Suppression, max_suppressions> suppressions;
+        std::mutex suppressions_mutex;
+        std::condition_variable flush_condition;
+
+        // Reports the counts of the windows, which ended before now, returns the end of the next window with
+        // suppressed messages (or time_point::max()). Has to be called with suppressions_mutex held.
+        std::chrono::steady_clock::time_point report_suppressed(std::chrono::steady_clock::time_point now) {
+            auto next_end = std::chrono::steady_clock::time_point::max();
+            auto current = Logging::current();
+
+            for (auto &current_suppression : suppressions) {
+                if (!current_suppression.format) {
+                    break;
+                } else if (!current_suppression.suppressed) {
+                    continue;
+                }
+
+                if (auto window_end = current_suppression.window_start + Logger::Constants::window; window_end > now) {
+                    next_end = std::min(next_end, window_end);
+                    continue;
+                }
+
+                if (current) {
+                    current->log(current_suppression.level, "Suppressed {0} messages like: {1}",
+                                 current_suppression.suppressed, current_suppression.format);
+                }
+
+                current_suppression.suppressed = 0;
+            }
+
+            return next_end;
+        }
+    }  // namespace
+
+    void Logging::start(bool foreground) const {
+        _foreground = foreground;
+
+        if (foreground) {
+            replace(spdlog::stdout_color_mt(Constants::logger_name));
+        } else {
+            replace(spdlog::syslog_logger(Constants::logger_name, "scanbd", LOG_PID));
+        }
+    }
+
+    // Threads, which are started later, and forked children, which exec immediately, are fine with the
+    // background thread of the async logger, children which log after fork are not (it isn't forked along)
+    void Logging::start_async() const {
+        spdlog::set_async_mode(Constants::queue_size, spdlog::async_overflow_policy::discard_log_msg, nullptr,
+                               Constants::flush_interval);
+        spdlog::drop(Constants::logger_name);
+        start(_foreground);
+
+        std::lock_guard<std::mutex> guard(suppressions_mutex);
+
+        if (!_flush_thread_inst.joinable()) {
+            _flush_stop = false;
+            _flush_thread_inst = std::thread(flush_thread);
+        }
+    }
+
+    void Logging::level(bool debug, int debug_level) const {
+        if (!debug) {
+            _level = spdlog::level::info;
+        } else if (debug_level <= 1) {
+            _level = spdlog::level::err;
+        } else if (debug_level == 2) {
+            _level = spdlog::level::warn;
+        } else if (debug_level == 3) {
+            _level = spdlog::level::info;
+        } else {
+            _level = spdlog::level::debug;
+        }
+
+        if (auto current_logger = current(); current_logger) {
+            current_logger->set_level(_level);
+        }
+    }
+
+    void Logging::stop() const {
+        {
+            std::lock_guard<std::mutex> guard(suppressions_mutex);
+            _flush_stop = true;
+        }
+
+        flush_condition.notify_all();
+
+        if (_flush_thread_inst.joinable()) {
+            _flush_thread_inst.join();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(suppressions_mutex);
+            report_suppressed(std::chrono::steady_clock::time_point::max());
+            suppressions.fill(Suppression{});
+        }
+
+        if (auto current_logger = current(); current_logger) {
+            current_logger->flush();
+        }
+
+        _current = nullptr;
+        spdlog::drop_all();
+    }
+
+    void Logging::replace(std::shared_ptr<spdlog::logger> logger) {
+        logger->set_level(_level);
+        _loggers.push_back(logger);
+        _current = logger.get();
+    }
+
+    // Sleeps until the next window with suppressed messages ends, admit_message wakes it for new ones
+    void Logging::flush_thread() {
+        SignalHandler signal_handler;
+        signal_handler.disable_signals_for_thread();
+
+        std::unique_lock<std::mutex> guard(suppressions_mutex);
+
+        while (!_flush_stop) {
+            auto next_end = report_suppressed(std::chrono::steady_clock::now());
+
+            if (next_end == std::chrono::steady_clock::time_point::max()) {
+                flush_condition.wait(guard);
+            } else {
+                flush_condition.wait_until(guard, next_end);
+            }
+        }
+    }
+
+    std::optional<uint64_t> detail::admit_message(spdlog::level::level_enum level, const char *format) {
+        auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> guard(suppressions_mutex);
+
+        auto suppression = std::find_if(suppressions.begin(), suppressions.end(), [format](const auto &current) {
+            return !current.format || current.format == format;
+        });
+
+        // More call sites than slots, the remaining ones aren't limited
+        if (suppression == suppressions.end()) {
+            return 0;
+        }
+
+        if (!suppression->format || now - suppression->window_start >= Logger::Constants::window) {
+            uint64_t suppressed = suppression->suppressed;
+            suppression->format = format;
+            suppression->level = level;
+            suppression->window_start = now;
+            suppression->count = 1;
+            suppression->suppressed = 0;
+            return suppressed;
+        }
+
+        if (suppression->count < Logger::Constants::burst) {
+            ++suppression->count;
+            return 0;
+        }
+
+        if (!suppression->suppressed++) {
+            flush_condition.notify_all();
+        }
+
+        return {};
+    }
+}  // namespace scanbdpp
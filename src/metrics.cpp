@@ -0,0 +1,379 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+// clang-format on
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "config.h"
+#include "logging.h"
+#include "metrics.h"
+#include "signal_handler.h"
+
+namespace scanbdpp {
+    namespace {
+        std::string format_seconds(std::chrono::nanoseconds time) {
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "%g", time.count() / 1e9);
+            return buf;
+        }
+
+        // Adds a label to formatted labels ("" or {a="b"})
+        std::string add_label(const std::string &labels, const std::string &label) {
+            if (labels.empty()) {
+                return "{" + label + "}";
+            }
+
+            return labels.substr(0, labels.size() - 1) + "," + label + "}";
+        }
+    }  // namespace
+
+    Metrics::Metrics() {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        ++_instance_count;
+    }
+
+    Metrics::~Metrics() {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        --_instance_count;
+
+        if (!_instance_count) {
+            stop();
+        }
+    }
+
+    // The export thread is only started, if a file or a socket is configured, recording always works
+    void Metrics::start() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (_thread_started) {
+            return;
+        }
+
+        Config config;
+        auto file_option =
+            config.get<confusepp::Option<std::string>>(Config::Constants::global / Config::Constants::metrics_file);
+        auto socket_option =
+            config.get<confusepp::Option<std::string>>(Config::Constants::global / Config::Constants::metrics_socket);
+        auto interval_option =
+            config.get<confusepp::Option<int>>(Config::Constants::global / Config::Constants::metrics_interval);
+
+        std::experimental::filesystem::path file = file_option ? file_option->value() : "";
+        std::string socket_path = socket_option ? socket_option->value() : "";
+        std::chrono::seconds interval(interval_option ? std::max(interval_option->value(), 1) : 1);
+
+        if (file.empty() && socket_path.empty()) {
+            return;
+        }
+
+        int listen_fd = -1;
+
+        if (!socket_path.empty()) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+
+            if (socket_path.size() >= sizeof(address.sun_path)) {
+                logger.critical("Metrics socket path {0} is too long", socket_path);
+                return;
+            }
+
+            std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+            if (listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0); listen_fd < 0) {
+                logger.critical("Couldn't create metrics socket {0}", strerror(errno));
+                return;
+            }
+
+            unlink(address.sun_path);
+
+            if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+                listen(listen_fd, 4) < 0) {
+                logger.critical("Couldn't listen on metrics socket {0} {1}", socket_path, strerror(errno));
+                close(listen_fd);
+                return;
+            }
+
+            chmod(address.sun_path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        }
+
+        if (_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); _wake_fd < 0) {
+            logger.critical("Couldn't create eventfd {0}", strerror(errno));
+
+            if (listen_fd >= 0) {
+                close(listen_fd);
+                unlink(socket_path.c_str());
+            }
+            return;
+        }
+
+        _socket_path = socket_path;
+        _thread_stop = false;
+        _thread_started = true;
+        _thread_inst = std::thread(export_thread, listen_fd, file, interval);
+        logger.info("Starting metrics thread");
+    }
+
+    void Metrics::stop() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (!_thread_started) {
+            return;
+        }
+
+        _thread_stop = true;
+        wake_up();
+
+        if (_thread_inst.joinable()) {
+            _thread_inst.join();
+            logger.info("Stopped metrics thread");
+        }
+
+        close(_wake_fd);
+        _wake_fd = -1;
+
+        if (!_socket_path.empty()) {
+            unlink(_socket_path.c_str());
+        }
+        _thread_started = false;
+    }
+
+    auto Metrics::counter(const std::string &name, const std::string &help, const Labels &labels) const
+        -> Counter & {
+        std::lock_guard<std::mutex> guard(_families_mutex);
+
+        auto &metric = family(name, help, Type::COUNTER).counters[format_labels(labels)];
+        if (!metric) {
+            metric = std::make_unique<Counter>(0);
+        }
+
+        return *metric;
+    }
+
+    auto Metrics::gauge(const std::string &name, const std::string &help, const Labels &labels) const -> Gauge & {
+        std::lock_guard<std::mutex> guard(_families_mutex);
+
+        auto &metric = family(name, help, Type::GAUGE).gauges[format_labels(labels)];
+        if (!metric) {
+            metric = std::make_unique<Gauge>(0);
+        }
+
+        return *metric;
+    }
+
+    LatencyHistogram &Metrics::histogram(const std::string &name, const std::string &help,
+                                         const Labels &labels) const {
+        std::lock_guard<std::mutex> guard(_families_mutex);
+
+        auto &metric = family(name, help, Type::HISTOGRAM).histograms[format_labels(labels)];
+        if (!metric) {
+            metric = std::make_unique<LatencyHistogram>();
+        }
+
+        return *metric;
+    }
+
+    std::string Metrics::render() const { return format_metrics(); }
+
+    // Histograms are exported in seconds, the +Inf bucket and the count are taken from the same bucket values,
+    // so they are consistent while other threads record
+    std::string Metrics::format_metrics() {
+        std::lock_guard<std::mutex> guard(_families_mutex);
+
+        std::string text;
+
+        for (const auto &[name, current_family] : _families) {
+            text += "# HELP " + name + " " + current_family.help + "\n";
+
+            switch (current_family.type) {
+                case Type::COUNTER:
+                    text += "# TYPE " + name + " counter\n";
+                    for (const auto &[labels, value] : current_family.counters) {
+                        text += name + labels + " " + std::to_string(value->load(std::memory_order_relaxed)) + "\n";
+                    }
+                    break;
+                case Type::GAUGE:
+                    text += "# TYPE " + name + " gauge\n";
+                    for (const auto &[labels, value] : current_family.gauges) {
+                        text += name + labels + " " + std::to_string(value->load(std::memory_order_relaxed)) + "\n";
+                    }
+                    break;
+                case Type::HISTOGRAM:
+                    text += "# TYPE " + name + " histogram\n";
+                    for (const auto &[labels, value] : current_family.histograms) {
+                        uint64_t cumulative = 0;
+
+                        for (size_t index = 0; index < LatencyHistogram::bounds.size(); ++index) {
+                            cumulative += value->bucket(index);
+                            text += name + "_bucket" +
+                                    add_label(labels, "le=\"" + format_seconds(LatencyHistogram::bounds[index]) +
+                                                          "\"") +
+                                    " " + std::to_string(cumulative) + "\n";
+                        }
+
+                        cumulative += value->bucket(LatencyHistogram::bounds.size());
+                        text += name + "_bucket" + add_label(labels, "le=\"+Inf\"") + " " +
+                                std::to_string(cumulative) + "\n";
+                        text += name + "_sum" + labels + " " + format_seconds(value->sum()) + "\n";
+                        text += name + "_count" + labels + " " + std::to_string(cumulative) + "\n";
+                    }
+                    break;
+            }
+        }
+
+        return text;
+    }
+
+    // Has to be called with the families mutex locked. A name is always used with the same type and help.
+    auto Metrics::family(const std::string &name, const std::string &help, Type type) -> Family & {
+        auto [current_family, inserted] = _families.try_emplace(name);
+
+        if (inserted) {
+            current_family->second.type = type;
+            current_family->second.help = help;
+        }
+
+        return current_family->second;
+    }
+
+    std::string Metrics::format_labels(const Labels &labels) {
+        if (labels.empty()) {
+            return "";
+        }
+
+        std::string formatted = "{";
+
+        for (const auto &[name, value] : labels) {
+            if (formatted.size() > 1) {
+                formatted += ",";
+            }
+
+            formatted += name + "=\"";
+            for (char current_char : value) {
+                if (current_char == '\\' || current_char == '"') {
+                    formatted += '\\';
+                    formatted += current_char;
+                } else if (current_char == '\n') {
+                    formatted += "\\n";
+                } else {
+                    formatted += current_char;
+                }
+            }
+            formatted += "\"";
+        }
+
+        return formatted + "}";
+    }
+
+    void Metrics::export_thread(int listen_fd, std::experimental::filesystem::path file,
+                                std::chrono::seconds interval) {
+        SignalHandler signal_handler;
+        signal_handler.disable_signals_for_thread();
+
+        auto next_write = std::chrono::steady_clock::now();
+
+        while (!_thread_stop) {
+            auto now = std::chrono::steady_clock::now();
+
+            if (!file.empty() && now >= next_write) {
+                write_file(file);
+                next_write = now + interval;
+            }
+
+            std::vector<pollfd> fds{{_wake_fd, POLLIN, 0}};
+            if (listen_fd >= 0) {
+                fds.push_back({listen_fd, POLLIN, 0});
+            }
+
+            int timeout = -1;
+            if (!file.empty()) {
+                timeout = std::max<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                            next_write - std::chrono::steady_clock::now())
+                                                .count() +
+                                            1,
+                                        0);
+            }
+
+            if (poll(fds.data(), fds.size(), timeout) < 0) {
+                if (errno != EINTR) {
+                    logger.critical("Polling metrics socket failed {0}", strerror(errno));
+                    break;
+                }
+                continue;
+            }
+
+            if (fds[0].revents & POLLIN) {
+                uint64_t value;
+                while (read(_wake_fd, &value, sizeof(value)) == sizeof(value)) {
+                }
+            }
+
+            if (fds.size() < 2 || !(fds[1].revents & POLLIN)) {
+                continue;
+            }
+
+            // Every client gets the metrics and is disconnected, a client, which doesn't read, is given up after
+            // send_timeout
+            if (int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC); client_fd >= 0) {
+                timeval send_timeout{Constants::send_timeout.count(), 0};
+                setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+                auto text = format_metrics();
+
+                for (size_t sent = 0; sent < text.size();) {
+                    ssize_t written = send(client_fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+
+                    if (written <= 0) {
+                        break;
+                    }
+                    sent += written;
+                }
+
+                close(client_fd);
+            }
+        }
+
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+    }
+
+    void Metrics::write_file(const std::experimental::filesystem::path &file) {
+        auto text = format_metrics();
+
+        std::string temporary_path = file.native() + ".tmp";
+        int metrics_fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                              S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+        if (metrics_fd < 0) {
+            logger.warn("Couldn't create metrics file {0}", strerror(errno));
+            return;
+        }
+
+        bool written = write(metrics_fd, text.c_str(), text.size()) == static_cast<ssize_t>(text.size());
+        close(metrics_fd);
+
+        if (!written || rename(temporary_path.c_str(), file.c_str()) < 0) {
+            logger.warn("Couldn't write metrics file {0}", strerror(errno));
+            unlink(temporary_path.c_str());
+        }
+    }
+
+    void Metrics::wake_up() {
+        uint64_t value = 1;
+
+        if (_wake_fd >= 0 && write(_wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            logger.warn("Couldn't wake up metrics thread {0}", strerror(errno));
+        }
+    }
+}  // namespace scanbdpp
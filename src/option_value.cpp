@@ -0,0 +1,111 @@
+#include "common.h"
+
+#include <type_traits>
+#include <utility>
+
+#include "option_value.h"
+
+namespace scanbdpp {
+    double WordArray::element(size_t index) const {
+        if (type == SANE_TYPE_FIXED) {
+            return SANE_UNFIX(words[index]);
+        }
+
+        return static_cast<double>(words[index]);
+    }
+
+    // A 64 bit fingerprint without branches per word, used for change detection only
+    uint64_t WordArray::fingerprint() const {
+        uint64_t hash = 0xcbf29ce484222325ull ^ words.size();
+
+        for (SANE_Word current_word : words) {
+            hash = (hash ^ static_cast<uint32_t>(current_word)) * 0x100000001b3ull;
+            hash ^= hash >> 29;
+        }
+
+        return hash;
+    }
+
+    // Comma separated values for the environment of scripts and plugins
+    std::string WordArray::join() const {
+        std::string joined;
+
+        for (size_t index = 0; index < words.size(); ++index) {
+            if (index) {
+                joined += ',';
+            }
+
+            if (type == SANE_TYPE_FIXED) {
+                joined += std::to_string(element(index));
+            } else {
+                joined += std::to_string(words[index]);
+            }
+        }
+
+        return joined;
+    }
+
+    bool operator==(const WordArray &lhs, const WordArray &rhs) {
+        return lhs.type == rhs.type && lhs.words == rhs.words;
+    }
+
+    bool operator!=(const WordArray &lhs, const WordArray &rhs) { return !(lhs == rhs); }
+
+    // Bool options are single words by definition, but some backends don't care
+    bool detail::is_word_array(const SANE_Option_Descriptor &descriptor) {
+        return (descriptor.type == SANE_TYPE_INT || descriptor.type == SANE_TYPE_FIXED ||
+                descriptor.type == SANE_TYPE_BOOL) &&
+               descriptor.size > static_cast<SANE_Int>(sizeof(SANE_Word));
+    }
+
+    // The descriptor of the option name of an open device, the index is 0, if there is no such option
+    const SANE_Option_Descriptor *detail::find_descriptor(SANE_Handle handle, const std::string &name,
+                                                          SANE_Int &index) {
+        SANE_Int option_count = 0;
+
+        if (sane_control_option(handle, 0, SANE_ACTION_GET_VALUE, &option_count, nullptr) == SANE_STATUS_GOOD) {
+            for (index = 1; index < option_count; ++index) {
+                const SANE_Option_Descriptor *descriptor = sane_get_option_descriptor(handle, index);
+
+                if (descriptor && descriptor->name && name == descriptor->name) {
+                    return descriptor;
+                }
+            }
+        }
+
+        index = 0;
+        return nullptr;
+    }
+
+    OptionValue to_option_value(const sanepp::Option::value_type &value) {
+        return std::visit(
+            [](const auto &current_value) {
+                using type = std::decay_t<decltype(current_value)>;
+                return OptionValue(std::in_place_type<type>, current_value);
+            },
+            value);
+    }
+
+    // Word arrays are read through the handle of the device (like scan.cpp does), all other values through sanepp
+    std::optional<OptionValue> read_option_value(const sanepp::Device &device, const sanepp::Option &option) {
+        SANE_Int index = 0;
+
+        if (auto descriptor = detail::find_descriptor(device.handle(), option.info().name(), index);
+            descriptor && detail::is_word_array(*descriptor)) {
+            WordArray value{descriptor->type, std::vector<SANE_Word>(descriptor->size / sizeof(SANE_Word))};
+
+            if (sane_control_option(device.handle(), index, SANE_ACTION_GET_VALUE, value.words.data(), nullptr) !=
+                SANE_STATUS_GOOD) {
+                return {};
+            }
+
+            return OptionValue(std::in_place_type<WordArray>, std::move(value));
+        }
+
+        if (auto value = option.value_as_variant(); value) {
+            return to_option_value(*value);
+        }
+
+        return {};
+    }
+}  // namespace scanbdpp
@@ -0,0 +1,316 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+// clang-format on
+
+#include <cstdint>
+#include <cstring>
+
+#include "config.h"
+#include "logging.h"
+#include "output.h"
+#include "signal_handler.h"
+
+namespace scanbdpp {
+
+    OutputCollector::OutputCollector() {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        ++_instance_count;
+    }
+
+    OutputCollector::~OutputCollector() {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        --_instance_count;
+
+        if (!_instance_count) {
+            stop();
+        }
+    }
+
+    void OutputCollector::start() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (_thread_started) {
+            return;
+        }
+
+        Config config;
+        if (auto capture =
+                config.get<confusepp::Option<bool>>(Config::Constants::global / Config::Constants::capture_output);
+            capture && !capture->value()) {
+            return;
+        }
+
+        _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        _wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        epoll_event wake_event{};
+        wake_event.events = EPOLLIN;
+        wake_event.data.fd = _wake_fd;
+
+        if (_epoll_fd < 0 || _wake_fd < 0 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &wake_event) < 0) {
+            logger.critical("Couldn't set up output collector {0}", strerror(errno));
+
+            for (int *fd : {&_epoll_fd, &_wake_fd}) {
+                if (*fd >= 0) {
+                    close(*fd);
+                    *fd = -1;
+                }
+            }
+            return;
+        }
+
+        _thread_stop = false;
+        _thread_started = true;
+        _thread_inst = std::thread(collector_thread);
+        logger.info("Starting output thread");
+    }
+
+    void OutputCollector::stop() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (!_thread_started) {
+            return;
+        }
+
+        _thread_stop = true;
+        uint64_t value = 1;
+        if (write(_wake_fd, &value, sizeof(value)) < 0) {
+            logger.warn("Couldn't wake up output thread {0}", strerror(errno));
+        }
+
+        if (_thread_inst.joinable()) {
+            _thread_inst.join();
+            logger.info("Stopped output thread");
+        } else {
+            logger.info("Couldn't join output thread");
+        }
+
+        std::lock_guard<std::mutex> stream_guard(_stream_mutex);
+
+        for (auto &[fd, stream] : _streams) {
+            emit(*stream);
+            report_suppressed(*stream);
+            close(fd);
+        }
+        _streams.clear();
+
+        close(_epoll_fd);
+        close(_wake_fd);
+        _epoll_fd = -1;
+        _wake_fd = -1;
+        _thread_started = false;
+    }
+
+    bool OutputCollector::running() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        return _thread_started;
+    }
+
+    // Takes ownership of the descriptor
+    void OutputCollector::attach(int fd, bool is_error, std::string_view label, pid_t pid) const {
+        std::lock_guard<std::mutex> guard(_stream_mutex);
+
+        if (_epoll_fd < 0) {
+            close(fd);
+            return;
+        }
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+
+        auto stream = std::make_unique<Stream>();
+        stream->fd = fd;
+        stream->is_error = is_error;
+        stream->label = label;
+        stream->pid = pid;
+        stream->line.reserve(Constants::max_line_length);
+        stream->window_start = std::chrono::steady_clock::now();
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            logger.warn("Couldn't collect output of {0} ({1}) {2}", stream->label, pid, strerror(errno));
+            close(fd);
+            return;
+        }
+
+        _streams.emplace(fd, std::move(stream));
+    }
+
+    void OutputCollector::collector_thread() {
+        SignalHandler signal_handler;
+        signal_handler.disable_signals_for_thread();
+
+        epoll_event events[16];
+
+        while (!_thread_stop) {
+            int count = epoll_wait(_epoll_fd, events, std::size(events), -1);
+
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                logger.critical("Waiting for script output failed {0}", strerror(errno));
+                break;
+            }
+
+            std::lock_guard<std::mutex> guard(_stream_mutex);
+
+            for (int index = 0; index < count; ++index) {
+                auto stream = _streams.find(events[index].data.fd);
+
+                if (stream == _streams.end()) {
+                    continue;
+                }
+
+                if (!drain(*stream->second)) {
+                    emit(*stream->second);
+                    report_suppressed(*stream->second);
+                    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, stream->first, nullptr);
+                    close(stream->first);
+                    _streams.erase(stream);
+                }
+            }
+        }
+    }
+
+    // Returns false, when the script has closed the pipe. The number of reads is limited, so one script
+    // can't starve the others, epoll reports the rest again.
+    bool OutputCollector::drain(Stream &stream) {
+        char buf[Constants::read_size];
+
+        for (size_t reads = 0; reads < Constants::max_reads_per_event; ++reads) {
+            ssize_t length = read(stream.fd, buf, sizeof(buf));
+
+            if (length > 0) {
+                process(stream, std::string_view(buf, length));
+            } else if (length < 0 && errno == EINTR) {
+                continue;
+            } else if (length < 0 && errno == EAGAIN) {
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void OutputCollector::process(Stream &stream, std::string_view data) {
+        while (!data.empty()) {
+            auto newline = data.find('\n');
+            auto part = data.substr(0, newline);
+
+            // Everything after max_line_length is dropped up to the next newline
+            if (!stream.truncating) {
+                size_t space = Constants::max_line_length - stream.line.size();
+                stream.line.append(part.substr(0, space));
+                stream.truncating = part.size() > space;
+            }
+
+            if (newline == std::string_view::npos) {
+                return;
+            }
+
+            emit(stream);
+            stream.truncating = false;
+            data.remove_prefix(newline + 1);
+        }
+    }
+
+    void OutputCollector::emit(Stream &stream) {
+        if (stream.line.empty() && !stream.truncating) {
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (now - stream.window_start >= std::chrono::seconds(1)) {
+            report_suppressed(stream);
+            stream.window_start = now;
+            stream.window_lines = 0;
+        }
+
+        if (++stream.window_lines > Constants::max_lines_per_second) {
+            ++stream.suppressed;
+        } else if (stream.is_error) {
+            logger.warn("{0} ({1}): {2}{3}", stream.label, stream.pid, stream.line, stream.truncating ? "..." : "");
+        } else {
+            logger.info("{0} ({1}): {2}{3}", stream.label, stream.pid, stream.line, stream.truncating ? "..." : "");
+        }
+
+        stream.line.clear();
+    }
+
+    void OutputCollector::report_suppressed(Stream &stream) {
+        if (stream.suppressed) {
+            logger.warn("{0} ({1}): suppressed {2} lines", stream.label, stream.pid, stream.suppressed);
+            stream.suppressed = 0;
+        }
+    }
+
+    // Without a running collector the script inherits the stdout and stderr of the daemon
+    OutputCapture::OutputCapture() {
+        OutputCollector collector;
+
+        if (!collector.running()) {
+            return;
+        }
+
+        for (int index = 0; index < 2; ++index) {
+            int fds[2];
+
+            if (pipe2(fds, O_CLOEXEC) < 0) {
+                logger.warn("Couldn't create output pipe {0}", strerror(errno));
+                close_all();
+                return;
+            }
+
+            m_read[index] = fds[0];
+            m_write[index] = fds[1];
+        }
+    }
+
+    OutputCapture::~OutputCapture() { close_all(); }
+
+    void OutputCapture::add_redirections(std::vector<Redirection> &redirections) const {
+        if (m_write[0] >= 0 && m_write[1] >= 0) {
+            redirections.push_back({m_write[0], STDOUT_FILENO});
+            redirections.push_back({m_write[1], STDERR_FILENO});
+        }
+    }
+
+    // The write ends have to be closed, otherwise the collector would never see the end of the output
+    void OutputCapture::started(std::string_view label, pid_t pid) {
+        OutputCollector collector;
+
+        for (int index = 0; index < 2; ++index) {
+            if (m_write[index] >= 0) {
+                close(m_write[index]);
+                m_write[index] = -1;
+            }
+
+            if (m_read[index] >= 0) {
+                collector.attach(m_read[index], index == 1, label, pid);
+                m_read[index] = -1;
+            }
+        }
+    }
+
+    void OutputCapture::close_all() {
+        for (int *fd : {&m_read[0], &m_read[1], &m_write[0], &m_write[1]}) {
+            if (*fd >= 0) {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+}  // namespace scanbdpp
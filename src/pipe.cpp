@@ -9,14 +9,17 @@
 #include <cstring>
 
 #include <chrono>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 
-#include "spdlog/spdlog.h"
-
+#include "logging.h"
 #include "pipe.h"
 #include "sane.h"
 #include "signal_handler.h"
+#include "trace.h"
 
 namespace scanbdpp {
 
@@ -42,13 +45,13 @@ namespace scanbdpp {
         SaneHandler handler;
 
         if (mkfifo(Constants::pipe_path.c_str(), S_IRUSR | S_IWUSR) != 0) {
-            spdlog::get("logger")->warn("Error creating pipe {0}", strerror(errno));
+            logger.warn("Error creating pipe {0}", strerror(errno));
         }
 
         int pipe_des = open(Constants::pipe_path.c_str(), O_RDONLY | O_NONBLOCK);
 
         if (pipe_des < 0) {
-            spdlog::get("logger")->critical("Error opening pipe {0}", strerror(errno));
+            logger.critical("Error opening pipe {0}", strerror(errno));
             return;
         }
 
@@ -60,16 +63,25 @@ namespace scanbdpp {
                     case EAGAIN:
                         break;
                     default:
-                        spdlog::get("logger")->critical(strerror(errno));
+                        logger.critical(strerror(errno));
                         _thread_stop = true;
                 }
 
+            } else if (ret != 0 && std::string_view(buf) == Constants::status_message) {
+                SCANBDPP_TRACE_SPAN("pipe status");
+                write_status();
+            } else if (ret != 0 && std::string_view(buf) == Constants::trace_message) {
+                Tracer tracer;
+                if (tracer.dump(Constants::trace_path)) {
+                    logger.info("Wrote trace to {0}", Constants::trace_path.native());
+                }
             } else if (ret != 0) {
+                SCANBDPP_TRACE_SPAN("pipe trigger");
                 std::istringstream message(buf);
                 std::string device;
                 std::string action;
                 if (std::getline(message, device, ',') && std::getline(message, action, ',')) {
-                    spdlog::get("logger")->info("Received message to trigger action {0} on device {1}", action, device);
+                    logger.info("Received message to trigger action {0} on device {1}", action, device);
                     handler.trigger_action(device, action);
                 }
             }
@@ -81,13 +93,36 @@ namespace scanbdpp {
         unlink(Constants::pipe_path.c_str());
     }
 
+    // The report replaces the status file atomically, so a reader never sees a partial report
+    void PipeHandler::write_status() {
+        SaneHandler handler;
+        std::string report = handler.status();
+        logger.info("Status\n{0}", report);
+
+        std::string temporary_path = Constants::status_path.native() + ".tmp";
+        int status_fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+        if (status_fd < 0) {
+            logger.warn("Couldn't create status file {0}", strerror(errno));
+            return;
+        }
+
+        bool written = write(status_fd, report.c_str(), report.size()) == static_cast<ssize_t>(report.size());
+        close(status_fd);
+
+        if (!written || rename(temporary_path.c_str(), Constants::status_path.c_str()) < 0) {
+            logger.warn("Couldn't write status file {0}", strerror(errno));
+            unlink(temporary_path.c_str());
+        }
+    }
+
     void PipeHandler::start() const {
         std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
 
         if (!_thread_started) {
             _thread_started = true;
             _thread_inst = std::thread(PipeHandler::pipe_thread);
-            spdlog::get("logger")->info("Starting pipe thread");
+            logger.info("Starting pipe thread");
         }
     }
 
@@ -103,9 +138,9 @@ namespace scanbdpp {
         if (_thread_inst.joinable()) {
             _thread_inst.join();
             _thread_started = false;
-            spdlog::get("logger")->info("Stopped pipe thread");
+            logger.info("Stopped pipe thread");
         } else {
-            spdlog::get("logger")->info("Couldn't join pipe thread");
+            logger.info("Couldn't join pipe thread");
         }
     }
 
@@ -113,12 +148,12 @@ namespace scanbdpp {
         int pipe_des = open(Constants::pipe_path.c_str(), O_WRONLY | O_NONBLOCK);
 
         if (pipe_des < 0) {
-            spdlog::get("logger")->critical("Error opening pipe {0}", strerror(errno));
+            logger.critical("Error opening pipe {0}", strerror(errno));
             return;
         }
 
         if (message.size() > Constants::_max_message_size) {
-            spdlog::get("logger")->critical("Message is too long");
+            logger.critical("Message is too long");
             return;
         }
 
@@ -128,9 +163,44 @@ namespace scanbdpp {
         int written = write(pipe_des, (const void *)message.c_str(), message.size() + 1);
 
         if (written < 0) {
-            spdlog::get("logger")->critical("Error writing message {0}", strerror(errno));
+            logger.critical("Error writing message {0}", strerror(errno));
         } else if ((size_t)written != message.size() + 1) {
-            spdlog::get("logger")->critical("Writing was not atomic, shouldn't happen");
+            logger.critical("Writing was not atomic, shouldn't happen");
         }
+
+        close(pipe_des);
+    }
+
+    std::optional<std::string> PipeHandler::request_status() const {
+        if (!request_file(Constants::status_message, Constants::status_path)) {
+            return {};
+        }
+
+        std::ifstream status_file(Constants::status_path);
+        std::ostringstream report;
+        report << status_file.rdbuf();
+        return report.str();
+    }
+
+    bool PipeHandler::request_trace() const { return request_file(Constants::trace_message, Constants::trace_path); }
+
+    // Asks the daemon for a new file, which is detected by its new inode
+    bool PipeHandler::request_file(const char *message, const std::experimental::filesystem::path &path) const {
+        struct stat previous_file {};
+        bool had_file = stat(path.c_str(), &previous_file) == 0;
+
+        write_message(message);
+
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < Constants::status_timeout) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+            struct stat current_file {};
+            if (stat(path.c_str(), &current_file) == 0 && (!had_file || current_file.st_ino != previous_file.st_ino)) {
+                return true;
+            }
+        }
+
+        return false;
     }
 }  // namespace scanbdpp
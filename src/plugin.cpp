@@ -0,0 +1,271 @@
+#include "common.h"
+
+#include <dlfcn.h>
+
+#include "config.h"
+#include "logging.h"
+#include "metrics.h"
+#include "plugin.h"
+#include "signal_handler.h"
+
+namespace scanbdpp {
+    namespace {
+        Metrics::Gauge &queue_depth() {
+            static auto &depth = Metrics().gauge("scanbd_plugin_queue_depth", "Plugin calls waiting for the executor");
+            return depth;
+        }
+    }  // namespace
+
+    Plugin::Plugin(std::shared_ptr<void> library, scanbdpp_action_function function, const std::string &name)
+        : m_library(std::move(library)), m_function(function), m_name(name) {}
+
+    int Plugin::call(const scanbdpp_event &event) const { return m_function(&event); }
+
+    void Plugin::disable() { m_enabled = false; }
+
+    bool Plugin::enabled() const { return m_enabled; }
+
+    const std::string &Plugin::name() const { return m_name; }
+
+    std::shared_ptr<Plugin> PluginRegistry::resolve(const std::string &library, const std::string &symbol) {
+        std::lock_guard<std::mutex> guard(_instance_mutex);
+
+        Config config;
+        if (_config_generation != config.generation()) {
+            _plugins.clear();
+            _config_generation = config.generation();
+        }
+
+        if (auto plugin = _plugins.find({library, symbol}); plugin != _plugins.end()) {
+            return plugin->second;
+        }
+
+        // The library stays loaded as long as one of its plugins is used
+        std::shared_ptr<void> handle = _libraries[library].lock();
+
+        if (!handle) {
+            void *raw_handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+            if (!raw_handle) {
+                logger.critical("Couldn't load plugin {0} {1}", library, dlerror());
+                return nullptr;
+            }
+
+            handle = std::shared_ptr<void>(raw_handle, [](void *to_close) { dlclose(to_close); });
+            _libraries[library] = handle;
+        }
+
+        dlerror();
+        void *function = dlsym(handle.get(), symbol.c_str());
+
+        if (!function) {
+            logger.critical("Plugin {0} has no function {1}", library, symbol);
+            return nullptr;
+        }
+
+        auto plugin = std::make_shared<Plugin>(handle, reinterpret_cast<scanbdpp_action_function>(function),
+                                               library + ":" + symbol);
+        _plugins.emplace(std::make_pair(library, symbol), plugin);
+
+        return plugin;
+    }
+
+    PluginExecutor::PluginExecutor() {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        ++_instance_count;
+    }
+
+    PluginExecutor::~PluginExecutor() {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        --_instance_count;
+
+        if (!_instance_count) {
+            stop();
+        }
+    }
+
+    void PluginExecutor::start() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (!_thread_started) {
+            std::lock_guard<std::mutex> queue_guard(_queue_mutex);
+            _thread_stop = false;
+            _thread_started = true;
+            _thread_inst = std::thread(executor_thread, ++_worker_id);
+            _watchdog_inst = std::thread(watchdog_thread);
+            logger.info("Started plugin thread");
+        }
+    }
+
+    void PluginExecutor::stop() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (!_thread_started) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> queue_guard(_queue_mutex);
+            _thread_stop = true;
+            _queue.clear();
+        }
+        _queue_condition.notify_all();
+        _watchdog_condition.notify_all();
+
+        // Afterwards the worker isn't replaced anymore
+        if (_watchdog_inst.joinable()) {
+            _watchdog_inst.join();
+        }
+
+        bool is_hung = false;
+        {
+            std::lock_guard<std::mutex> queue_guard(_queue_mutex);
+            is_hung = current_call_is_hung();
+        }
+
+        // A worker, which is stuck in a plugin can't be joined
+        if (is_hung) {
+            _thread_inst.detach();
+            logger.warn("Abandoned hung plugin thread");
+        } else if (_thread_inst.joinable()) {
+            _thread_inst.join();
+            logger.info("Stopped plugin thread");
+        }
+
+        _thread_started = false;
+    }
+
+    bool PluginExecutor::execute(PluginEvent event) const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        {
+            std::lock_guard<std::mutex> queue_guard(_queue_mutex);
+
+            if (!_thread_started || _thread_stop) {
+                logger.warn("Plugin thread is not running, dropping event of action {0}", event.action);
+                return false;
+            }
+
+            if (!event.plugin->enabled()) {
+                logger.warn("Plugin {0} is disabled, dropping event of action {1}", event.plugin->name(), event.action);
+                return false;
+            }
+
+            if (_queue.size() >= Constants::max_queue_size) {
+                logger.warn("Plugin queue is full, dropping event of action {0}", event.action);
+                return false;
+            }
+
+            _queue.emplace_back(std::move(event));
+            queue_depth().store(_queue.size(), std::memory_order_relaxed);
+        }
+
+        _queue_condition.notify_one();
+        return true;
+    }
+
+    // Has to be called with the queue mutex locked
+    bool PluginExecutor::current_call_is_hung() {
+        return _current_plugin && _current_deadline.count() > 0 &&
+               std::chrono::steady_clock::now() - _current_start > _current_deadline;
+    }
+
+    // Has to be called with the queue mutex locked, the hung worker exits when the plugin ever returns
+    void PluginExecutor::replace_hung_worker() {
+        logger.critical("Plugin {0} of action {1} exceeded its deadline of {2} ms, disabling it",
+                        _current_plugin->name(), _current_action, _current_deadline.count());
+        Metrics()
+            .counter("scanbd_plugin_timeouts_total", "Plugin calls, which exceeded the deadline of their action",
+                     {{"plugin", _current_plugin->name()}, {"action", _current_action}})
+            .fetch_add(1, std::memory_order_relaxed);
+        _current_plugin->disable();
+        _current_plugin.reset();
+
+        // The action isn't blocked by the abandoned call, skip_while_running lets the next trigger through
+        if (_current_running) {
+            *_current_running = false;
+            _current_running.reset();
+        }
+
+        _thread_inst.detach();
+        _thread_inst = std::thread(executor_thread, ++_worker_id);
+    }
+
+    void PluginExecutor::executor_thread(unsigned int worker_id) {
+        SignalHandler signal_handler;
+        signal_handler.disable_signals_for_thread();
+
+        std::unique_lock<std::mutex> queue_guard(_queue_mutex);
+
+        while (true) {
+            _queue_condition.wait(queue_guard,
+                                  [worker_id] { return _thread_stop || !_queue.empty() || worker_id != _worker_id; });
+
+            if (_thread_stop || worker_id != _worker_id) {
+                return;
+            }
+
+            PluginEvent event = std::move(_queue.front());
+            _queue.pop_front();
+            queue_depth().store(_queue.size(), std::memory_order_relaxed);
+
+            _current_plugin = event.plugin;
+            _current_action = event.action;
+            _current_running = event.running;
+            _current_deadline = event.deadline;
+            _current_start = std::chrono::steady_clock::now();
+            queue_guard.unlock();
+            _watchdog_condition.notify_one();
+
+            std::vector<scanbdpp_function_value> functions;
+            functions.reserve(event.functions.size());
+            for (const auto &[name, value] : event.functions) {
+                functions.push_back({name.c_str(), value.c_str()});
+            }
+
+            scanbdpp_event plugin_event{SCANBDPP_PLUGIN_ABI_VERSION, event.device.c_str(), event.action.c_str(),
+                                        functions.size(), functions.data()};
+
+            if (int result = event.plugin->call(plugin_event); result != 0) {
+                logger.warn("Plugin {0} of action {1} returned {2}", event.plugin->name(), event.action, result);
+            }
+
+            if (event.running) {
+                *event.running = false;
+            }
+
+            queue_guard.lock();
+
+            // This worker was replaced, while it was stuck in the plugin
+            if (worker_id != _worker_id) {
+                return;
+            }
+
+            _current_plugin.reset();
+            _current_running.reset();
+        }
+    }
+
+    // Sleeps until the deadline of the current call, a plugin, which returns in time, ends the call before
+    void PluginExecutor::watchdog_thread() {
+        SignalHandler signal_handler;
+        signal_handler.disable_signals_for_thread();
+
+        std::unique_lock<std::mutex> queue_guard(_queue_mutex);
+
+        while (!_thread_stop) {
+            if (current_call_is_hung()) {
+                replace_hung_worker();
+                continue;
+            }
+
+            if (_current_plugin && _current_deadline.count() > 0) {
+                _watchdog_condition.wait_until(queue_guard, _current_start + _current_deadline);
+            } else {
+                _watchdog_condition.wait(queue_guard);
+            }
+        }
+    }
+}  // namespace scanbdpp
@@ -27,6 +27,11 @@ namespace scanbdpp {
         return _debug_level;
     }
 
+    bool RunConfiguration::worker() const {
+        std::lock_guard<std::mutex> guard{_instance_mutex};
+        return _worker;
+    }
+
     const std::experimental::filesystem::path &RunConfiguration::config_path() const {
         std::lock_guard<std::mutex> guard{_instance_mutex};
         return _config_path;
@@ -59,6 +64,11 @@ namespace scanbdpp {
         _debug_level = value;
         return *this;
     }
+    RunConfiguration &RunConfiguration::worker(bool value) {
+        std::lock_guard<std::mutex> guard{_instance_mutex};
+        _worker = value;
+        return *this;
+    }
 
     RunConfiguration &RunConfiguration::config_path(const std::experimental::filesystem::path &config_path) {
         std::lock_guard<std::mutex> guard{_instance_mutex};
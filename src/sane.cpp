@@ -1,5 +1,6 @@
 // clang-format off
 #include "common.h"
+#include <poll.h>
 #include <signal.h>
 #include <sys/wait.h>
 // clang-format on
@@ -7,18 +8,55 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <random>
 #include <regex>
 #include <thread>
 
-#include <spdlog/spdlog.h>
-
 #include "sane.h"
 #include "sanepp.h"
 #include "signal_handler.h"
 
+#include "bus.h"
 #include "config.h"
+#include "environment.h"
+#include "event_server.h"
+#include "isolation.h"
+#include "logging.h"
+#include "metrics.h"
+#include "option_value.h"
+#include "plugin.h"
+#include "run_configuration.h"
+#include "scan.h"
+#include "script.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "trigger.h"
 
 namespace scanbdpp {
+    namespace {
+        const char *device_state_name(detail::DeviceState state) {
+            switch (state) {
+                case detail::DeviceState::OPENING:
+                    return "opening";
+                case detail::DeviceState::POLLING:
+                    return "polling";
+                case detail::DeviceState::RELEASED:
+                    return "released";
+                case detail::DeviceState::SCANNING:
+                    return "scanning";
+                case detail::DeviceState::BACKOFF:
+                    return "backoff";
+                case detail::DeviceState::FAILED:
+                    return "failed";
+            }
+
+            return "unknown";
+        }
+    }  // namespace
 
     SaneHandler::SaneHandler() {
         std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
@@ -31,39 +69,130 @@ namespace scanbdpp {
 
         if (!_instance_count) {
             stop();
+
+            // The daemon exits, threads, which are still stuck, can't be joined. Their handlers have to outlive
+            // them, the devices are closed by the exit of the process.
+            for (auto &current_handler : _stuck_handlers) {
+                logger.critical("Polling thread of device {0} is still stuck in a read on exit",
+                                current_handler->device_info().name());
+                current_handler->poll_thread().detach();
+                current_handler.release();
+            }
+            _stuck_handlers.clear();
         }
     }
 
+    // The config is matched against all devices first (in parallel, opening a device can take a while), only
+    // devices with at least one action get a polling thread. With isolation the devices are polled by worker
+    // processes instead, which run this in turn for their own devices.
     void SaneHandler::start() {
         std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
 
-        if (!_device_threads.empty()) {
+        if (!_device_threads.empty() || !_idle_devices.empty()) {
             return;
         }
 
-        spdlog::get("logger")->info("Starting polling threads");
+        if (RunConfiguration run_config; !run_config.worker()) {
+            if (auto mode = isolation_mode(); mode != IsolationMode::NONE) {
+                IsolationSupervisor supervisor;
+                supervisor.start(mode);
+                return;
+            }
+        }
+
+        SCANBDPP_TRACE_SPAN("sane start");
+        logger.info("Starting polling threads");
+
+        join_stuck_handlers();
 
         sanepp::Sane sane_instance;
         auto devices = sane_instance.devices(true);
+        std::vector<std::unique_ptr<detail::PollHandler>> handlers;
+        std::vector<std::future<bool>> prepared;
+
         for (auto device_info : devices) {
-            spdlog::get("logger")->info("Starting polling thread for device {0}", device_info.name());
-            _device_threads.emplace_back(std::make_unique<detail::PollHandler>(sane_instance, device_info));
+            if (!_restricted_devices.empty() &&
+                std::find(_restricted_devices.begin(), _restricted_devices.end(), device_info.name()) ==
+                    _restricted_devices.end()) {
+                continue;
+            }
+
+            // The stuck thread still holds the device open, so stuck threads don't pile up over reloads
+            if (std::any_of(_stuck_handlers.cbegin(), _stuck_handlers.cend(), [&device_info](const auto &handler) {
+                    return handler->device_info().name() == device_info.name();
+                })) {
+                logger.warn("Polling thread of device {0} is still stuck, not polling it until the next start",
+                            device_info.name());
+                _idle_devices.push_back(IdleDevice{device_info.name(), "polling thread is stuck in a read"});
+                continue;
+            }
+
+            handlers.emplace_back(std::make_unique<detail::PollHandler>(sane_instance, device_info));
+            prepared.emplace_back(
+                std::async(std::launch::async, &detail::PollHandler::prepare, handlers.back().get()));
+        }
+
+        BusScheduler buses;
+        buses.clear();
+
+        for (size_t index = 0; index < handlers.size(); ++index) {
+            if (!prepared[index].get()) {
+                // Devices, which couldn't be opened, are retried by their polling thread
+                if (handlers[index]->state() == detail::DeviceState::BACKOFF) {
+                    logger.warn("Couldn't open device {0}, retrying", handlers[index]->device_info().name());
+                } else {
+                    logger.info("Device {0} is idle: {1}", handlers[index]->device_info().name(),
+                                handlers[index]->idle_reason());
+                    _idle_devices.push_back(
+                        IdleDevice{handlers[index]->device_info().name(), handlers[index]->idle_reason()});
+                    continue;
+                }
+            }
+
+            handlers[index]->bus_slot(buses.add(handlers[index]->bus()));
+            _device_threads.emplace_back(std::move(handlers[index]));
+        }
+
+        // All devices of a bus have to be known, before the first one starts polling
+        for (auto &current_handler : _device_threads) {
+            logger.info("Starting polling thread for device {0}", current_handler->device_info().name());
+            current_handler->start();
         }
 
-        spdlog::get("logger")->info("Started polling threads");
+        logger.info("Started {0} polling threads, {1} devices are idle", _device_threads.size(), _idle_devices.size());
     }
 
     void SaneHandler::stop() {
+        SCANBDPP_TRACE_SPAN("sane stop");
         std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
 
+        IsolationSupervisor supervisor;
+        supervisor.stop();
+
+        _idle_devices.clear();
+
         if (_device_threads.empty()) {
             return;
         }
 
-        spdlog::get("logger")->info("Stopping {0} polling threads", _device_threads.size());
+        logger.info("Stopping {0} polling threads", _device_threads.size());
         for (auto &current_handler : _device_threads) {
-            // stopping poll thread for device
             current_handler->stop();
+        }
+
+        // A read of a wedged device can block for a long time, such threads are left behind instead of
+        // blocking the daemon
+        auto deadline = std::chrono::steady_clock::now() + Constants::stop_timeout;
+        size_t stuck = 0;
+
+        for (auto &current_handler : _device_threads) {
+            if (!current_handler->wait_stopped(deadline)) {
+                logger.warn("Polling thread of device {0} didn't stop within {1} s, leaving it behind",
+                            current_handler->device_info().name(), Constants::stop_timeout.count());
+                _stuck_handlers.emplace_back(std::move(current_handler));
+                ++stuck;
+                continue;
+            }
 
             if (current_handler->poll_thread().joinable()) {
                 current_handler->poll_thread().join();
@@ -71,46 +200,311 @@ namespace scanbdpp {
         }
 
         _device_threads.clear();
-        spdlog::get("logger")->info("Terminated all polling threads");
+        join_stuck_handlers();
+
+        if (stuck) {
+            logger.warn("Terminated polling threads, {0} are stuck", stuck);
+        } else {
+            logger.info("Terminated all polling threads");
+        }
+    }
+
+    void SaneHandler::join_stuck_handlers() {
+        for (auto current_handler = _stuck_handlers.begin(); current_handler != _stuck_handlers.end();) {
+            if (!(*current_handler)->finished()) {
+                ++current_handler;
+                continue;
+            }
+
+            logger.info("Stuck polling thread of device {0} finished", (*current_handler)->device_info().name());
+            (*current_handler)->poll_thread().join();
+            current_handler = _stuck_handlers.erase(current_handler);
+        }
     }
 
     void SaneHandler::trigger_action(const std::string &device_name, const std::string &action_name) {
         std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
 
+        if (IsolationSupervisor supervisor; supervisor.running()) {
+            if (!supervisor.trigger_action(device_name, action_name)) {
+                logger.warn("Device {0} is not polled", device_name);
+            }
+            return;
+        }
+
         for (auto &current_handler : _device_threads) {
             if (current_handler->device_info().name() == device_name) {
                 current_handler->trigger_action(action_name);
-                break;
+                return;
             }
         }
+
+        logger.warn("Device {0} is not polled", device_name);
+    }
+
+    // Only devices of the restricted list are polled, used by the worker processes
+    void SaneHandler::restrict_devices(const std::vector<std::string> &device_names) {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        _restricted_devices = device_names;
+    }
+
+    bool SaneHandler::polling() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        return !_device_threads.empty();
+    }
+
+    std::string SaneHandler::status() const {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        if (IsolationSupervisor supervisor; supervisor.running()) {
+            return supervisor.status();
+        }
+
+        std::string report = std::to_string(_device_threads.size()) + " polled devices, " +
+                             std::to_string(_idle_devices.size()) + " idle devices\n";
+
+        for (const auto &current_handler : _device_threads) {
+            report += current_handler->status("polled");
+        }
+
+        for (const auto &current_device : _idle_devices) {
+            report += "idle " + current_device.name + ": " + current_device.reason + "\n";
+        }
+
+        for (const auto &current_handler : _stuck_handlers) {
+            report += current_handler->status("stuck");
+        }
+
+        BusScheduler buses;
+        report += buses.status();
+
+        return report;
     }
 
     detail::PollHandler::PollHandler(sanepp::Sane instance, sanepp::DeviceInfo device_info)
         : m_instance(instance),
           m_device_info(device_info),
           m_terminate(false),
-          m_poll_thread(std::bind(&PollHandler::poll_device, this)) {}
+          m_read_latency(Metrics().histogram("scanbd_poll_read_seconds",
+                                             "Time to read all polled options of a device in one poll cycle",
+                                             {{"device", device_info.name()}})),
+          m_trigger_latency(Metrics().histogram("scanbd_trigger_to_exec_seconds",
+                                                "Time from a trigger to the start of its script or scan",
+                                                {{"device", device_info.name()}})),
+          m_poll_cycles(Metrics().counter("scanbd_poll_cycles_total", "Poll cycles of a device",
+                                          {{"device", device_info.name()}})) {}
+
+    // Opens the device and matches the config against its options. Without any action the device is closed
+    // again and idle_reason tells why. If the device can't be opened, the state is backoff and the poll thread
+    // retries to open it.
+    bool detail::PollHandler::prepare() {
+        SCANBDPP_TRACE_SPAN("prepare device");
+        SignalHandler signal_handler;
+        signal_handler.disable_signals_for_thread();
+
+        if (auto location = usb_location(device_info().name()); location) {
+            m_bus = "usb:" + std::to_string(location->bus);
+            m_port_path = location->port_path;
+        }
+
+        m_device = device_info().open();
+
+        if (!m_device) {
+            m_idle_reason = "couldn't open device";
+            m_state = DeviceState::BACKOFF;
+            return false;
+        }
+
+        if (!match_config(*m_device)) {
+            m_device.reset();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool detail::PollHandler::match_config(const sanepp::Device &device) {
+        Config config;
+        auto global_section = config.get<confusepp::Section>(Config::Constants::global);
+
+        if (!global_section) {
+            m_idle_reason = "config is invalid";
+            return false;
+        }
+
+        find_matching_options(device, *global_section);
+        find_matching_functions(device, *global_section);
+
+        if (auto device_multi_section = config.get<confusepp::Multisection>(Config::Constants::device);
+            device_multi_section) {
+            for (const auto &device_section : device_multi_section->sections()) {
+                auto device_filter = device_section.get<confusepp::Option<std::string>>(Config::Constants::filter);
+                if (!device_filter) {
+                    continue;
+                }
+
+                std::regex device_regex;
+
+                try {
+                    device_regex.assign(device_filter->value(), std::regex_constants::extended);
+                } catch (std::regex_error) {
+                    logger.warn("Couldn't compile device filter for device section {0}", device_section.title());
+                    continue;
+                }
+
+                if (!std::regex_match(device_info().name(), device_regex)) {
+                    continue;
+                }
+
+                auto local_actions = device_section.get<confusepp::Multisection>(Config::Constants::action);
+
+                if (!local_actions) {
+                    continue;
+                }
+
+                logger.info("Found local actions for device {0}", device_info().name());
+
+                find_matching_options(device, device_section);
+                find_matching_functions(device, device_section);
+            }
+        }
+
+        if (m_actions.empty()) {
+            m_idle_reason = "no matching actions";
+            return false;
+        }
+
+        find_polled_options();
+        m_matched = true;
+        return true;
+    }
+
+    void detail::PollHandler::start() { m_poll_thread = std::thread(&PollHandler::poll_device, this); }
+
+    void detail::PollHandler::stop() {
+        {
+            std::lock_guard<std::mutex> guard(m_terminate_mutex);
+            m_terminate = true;
+        }
+
+        m_terminate_condition.notify_all();
+    }
 
-    void detail::PollHandler::stop() { m_terminate = true; }
+    bool detail::PollHandler::wait_terminate(std::chrono::steady_clock::time_point end) {
+        std::unique_lock<std::mutex> guard(m_terminate_mutex);
+        return m_terminate_condition.wait_until(guard, end, [this] { return m_terminate.load(); });
+    }
 
     const sanepp::DeviceInfo &detail::PollHandler::device_info() const { return m_device_info; }
 
+    const std::string &detail::PollHandler::idle_reason() const { return m_idle_reason; }
+
+    auto detail::PollHandler::state() const -> DeviceState { return m_state; }
+
+    const std::string &detail::PollHandler::bus() const { return m_bus; }
+
+    void detail::PollHandler::bus_slot(size_t new_bus_slot) { m_bus_slot = new_bus_slot; }
+
+    // Only uses members, which don't change after prepare, and atomic counters
+    std::string detail::PollHandler::status(const std::string &state) const {
+        auto current_state = m_state.load();
+        std::string report = state + " " + device_info().name() + ": " + device_state_name(current_state);
+
+        if (current_state == DeviceState::BACKOFF) {
+            auto next_retry = std::chrono::nanoseconds(m_next_retry) - std::chrono::steady_clock::now().time_since_epoch();
+            report += " (retry in " +
+                      std::to_string(std::max<long>(
+                          std::chrono::duration_cast<std::chrono::milliseconds>(next_retry).count(), 0)) +
+                      " ms)";
+        } else if (current_state == DeviceState::FAILED) {
+            report += std::string(" (") + m_failure.load() + ")";
+        }
+
+        report += ", " + std::to_string(m_retries) + " retries, " + std::to_string(m_open_failures) +
+                  " failed opens";
+
+        if (!m_bus.empty()) {
+            report += ", " + m_bus + (m_port_path.empty() ? "" : " port " + m_port_path);
+        }
+
+        // The actions and options are only known, once the device was opened
+        if (!m_matched) {
+            return report + "\n";
+        }
+
+        report += ", " + std::to_string(m_actions.size()) + " actions, " + std::to_string(m_polled_options.size()) +
+                  " options";
+
+        if (m_degraded && m_bus_busy) {
+            report += ", degraded: bus busy";
+        } else if (m_degraded) {
+            report += ", degraded: reading " + m_polled_options[m_slow_option].option_info().name() + " took " +
+                      std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                         std::chrono::nanoseconds(m_slow_read_time))
+                                         .count()) +
+                      " ms";
+        }
+
+        if (int64_t read_start = m_read_start; read_start) {
+            auto reading = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::nanoseconds(read_start);
+
+            if (reading > m_read_deadline) {
+                report += ", reading " + m_polled_options[m_reading_option].option_info().name() + " since " +
+                          std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(reading).count()) +
+                          " ms";
+            }
+        }
+        report += "\n  reads: " + m_read_latency.summary("cycles") + "\n";
+
+        for (const auto &current_option : m_polled_options) {
+            report += "  option " + current_option.option_info().name() + ": " +
+                      current_option.latency().summary("reads") + "\n";
+        }
+
+        for (const auto &current_action : m_actions) {
+            report += "  action " + current_action.action_name() + " (" + current_action.option_info().name() +
+                      "): suppressed " + std::to_string(current_action.suppressed()) + ", timeouts " +
+                      std::to_string(current_action.timeouts()) + ", kills " +
+                      std::to_string(current_action.kills()) + "\n";
+        }
+
+        return report;
+    }
+
     const std::atomic_bool &detail::PollHandler::should_stop() const { return m_terminate; }
 
     const std::thread &detail::PollHandler::poll_thread() const { return m_poll_thread; }
 
     std::thread &detail::PollHandler::poll_thread() { return m_poll_thread; }
 
+    bool detail::PollHandler::wait_stopped(std::chrono::steady_clock::time_point deadline) const {
+        while (!m_finished && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        return m_finished;
+    }
+
+    bool detail::PollHandler::finished() const { return m_finished; }
+
     void detail::PollHandler::trigger_action(const std::string &action) {
+        if (!m_matched) {
+            logger.warn("Device {0} isn't opened yet", device_info().name());
+            return;
+        }
+
         auto matching_action = std::find_if(m_actions.begin(), m_actions.end(), [&action](const auto &current_action) {
             return action == current_action.action_name();
         });
 
         if (matching_action != m_actions.end()) {
-            spdlog::get("logger")->info("Triggering Action {0} for device {1}", action, device_info().name());
+            logger.info("Triggering Action {0} for device {1}", action, device_info().name());
             matching_action->set_trigger();
+            m_trigger_pending = true;
         } else {
-            spdlog::get("logger")->warn("Action {0} was not found for device {1}", action, device_info().name());
+            logger.warn("Action {0} was not found for device {1}", action, device_info().name());
         }
     }
 
@@ -127,8 +521,7 @@ namespace scanbdpp {
                     try {
                         function_regex.assign(filter->value(), std::regex_constants::extended);
                     } catch (std::regex_error) {
-                        spdlog::get("logger")->critical("Couldn't compile regex for function section {0}",
-                                                        current_function.title());
+                        logger.critical("Couldn't compile regex for function section {0}", current_function.title());
                         regex_is_valid = false;
                     }
 
@@ -149,20 +542,17 @@ namespace scanbdpp {
                                     return current.option_info() == current_option.info();
                                 });
                             if (function_with_option != m_functions.end()) {
-                                spdlog::get("logger")->warn(
-                                    "Setting function with value {0} to value {1} for option {2} of device {3}",
-                                    function_with_option->env(), env->value(), current_option.info().name(),
-                                    device.info().name());
+                                logger.warn("Setting function with value {0} to value {1} for option {2} of device {3}",
+                                            function_with_option->env(), env->value(), current_option.info().name(),
+                                            device.info().name());
                                 function_with_option->env(env->value());
                             } else {
-                                spdlog::get("logger")->info(
-                                    "Adding function with value {0} for option {1} of device {2}", env->value(),
-                                    current_option.info().name(), device.info().name());
+                                logger.info("Adding function with value {0} for option {1} of device {2}", env->value(),
+                                            current_option.info().name(), device.info().name());
                                 m_functions.emplace_back(Function(current_option.info()).env(env->value()));
                             }
                         } else {
-                            spdlog::get("logger")->warn("Function {0} sets no environment variable",
-                                                        current_function.title());
+                            logger.warn("Function {0} sets no environment variable", current_function.title());
                         }
                     }
                 }
@@ -172,6 +562,8 @@ namespace scanbdpp {
 
     void detail::PollHandler::find_matching_options(const sanepp::Device &device, const confusepp::Section &root) {
         Config config;
+        ScriptRegistry scripts;
+        PluginRegistry plugins;
 
         if (auto action_multi_section = root.get<confusepp::Multisection>(Config::Constants::action);
             action_multi_section) {
@@ -185,7 +577,7 @@ namespace scanbdpp {
                     try {
                         action_regex.assign(filter->value(), std::regex_constants::extended);
                     } catch (std::regex_error) {
-                        spdlog::get("logger")->warn("Couldn't compile regular expression for the option filter");
+                        logger.warn("Couldn't compile regular expression for the option filter");
                         regex_is_valid = false;
                     }
 
@@ -194,18 +586,37 @@ namespace scanbdpp {
                     }
 
                     auto script = current_action.get<confusepp::Option<std::string>>(Config::Constants::script);
+                    auto plugin = current_action.get<confusepp::Option<std::string>>(Config::Constants::plugin);
+                    auto scan_directory =
+                        current_action.get<confusepp::Option<std::string>>(Config::Constants::scan_directory);
 
-                    if (!script) {
-                        spdlog::get("logger")->warn("No script was set for action {0}", current_action.title());
+                    if (!script && !plugin && !scan_directory) {
+                        logger.warn("No script, plugin or scan directory was set for action {0}",
+                                    current_action.title());
                         continue;
                     }
 
+                    // Without its plugin the action can't do anything, so it isn't added to any option
+                    std::shared_ptr<Plugin> resolved_plugin;
+                    if (plugin && !scan_directory) {
+                        auto symbol = current_action.get<confusepp::Option<std::string>>(Config::Constants::symbol);
+                        resolved_plugin = plugins.resolve(plugin->value(),
+                                                          symbol ? symbol->value() : Config::Constants::symbol_def);
+
+                        if (!resolved_plugin) {
+                            logger.critical("Plugin {0} of action {1} can't be used, dropping the action",
+                                            plugin->value(), current_action.title());
+                            continue;
+                        }
+                    }
+
                     for (auto current_option : device.options()) {
-                        auto value = current_option.value_as_variant();
                         if (!std::regex_match(current_option.info().name(), action_regex)) {
                             continue;
                         }
 
+                        auto value = read_option_value(device, current_option);
+
                         if (!value || std::holds_alternative<sanepp::Group>(*value) ||
                             std::holds_alternative<sanepp::Button>(*value)) {
                             continue;
@@ -221,396 +632,1149 @@ namespace scanbdpp {
 
                         // TODO check if this correct
                         if (option_with_script != m_actions.cend() && !multiple_actions_allowed) {
-                            spdlog::get("logger")->info(
-                                "Overwriting existing action {0} with {1} for option {2} of device {3}",
-                                option_with_script->action_name(), current_action.title(),
-                                option_with_script->option_info().name(), device.info().name());
+                            logger.info("Overwriting existing action {0} with {1} for option {2} of device {3}",
+                                        option_with_script->action_name(), current_action.title(),
+                                        option_with_script->option_info().name(), device.info().name());
                             option_with_script->option_info(current_option.info());
                         } else {
-                            spdlog::get("logger")->info("Adding new action {0} for option {1} of device {2}",
-                                                        current_action.title(), current_option.info().name(),
-                                                        device.info().name());
+                            logger.info("Adding new action {0} for option {1} of device {2}", current_action.title(),
+                                        current_option.info().name(), device.info().name());
                             m_actions.emplace_back(current_option.info());
                             option_with_script = m_actions.end() - 1;
                         }
 
                         option_with_script->action_name(current_action.title());
-                        option_with_script->script(script->value());
-                        option_with_script->option_info(current_option.info());
-                        option_with_script->last_value(current_option.value_as_variant());
-
-                        auto init_range_values = [&current_action, &option_with_script](const auto &sane_value) {
-                            using current_type = std::decay_t<decltype(sane_value)>;
-                            if constexpr (std::is_same_v<current_type, int> ||
-                                          std::is_same_v<current_type, sanepp::Fixed> ||
-                                          std::is_same_v<current_type, bool>) {
-                                auto trigger_section =
-                                    current_action.get<confusepp::Section>(Config::Constants::numerical_trigger);
-
-                                if (trigger_section) {
-                                    if (auto int_value =
-                                            trigger_section->get<confusepp::Option<int>>(Config::Constants::from_value);
-                                        int_value) {
-                                        option_with_script->from_value(ActionValue<int>(int_value->value()));
-                                    } else {
-                                        spdlog::get("logger")->warn("No from-value was set for action {0}",
-                                                                    current_action.title());
-                                    }
-
-                                    if (auto int_value =
-                                            trigger_section->get<confusepp::Option<int>>(Config::Constants::to_value);
-                                        int_value) {
-                                        option_with_script->to_value(ActionValue<int>(int_value->value()));
-                                    } else {
-                                        spdlog::get("logger")->warn("No to-value was set for action {0}",
-                                                                    current_action.title());
-                                    }
-                                } else {
-                                    spdlog::get("logger")->warn("No trigger values were set for action {0}",
-                                                                current_action.title());
-                                    option_with_script->from_value(
-                                        ActionValue<int>(Config::Constants::from_value_def_int));
-                                    option_with_script->to_value(ActionValue<int>(Config::Constants::to_value_def_int));
-                                }
-                            } else if constexpr (std::is_same_v<current_type, std::string>) {
-                                auto trigger_section =
-                                    current_action.get<confusepp::Section>(Config::Constants::string_trigger);
-
-                                if (trigger_section) {
-                                    try {
-                                        if (auto string_value = trigger_section->get<confusepp::Option<std::string>>(
-                                                Config::Constants::from_value);
-                                            string_value) {
-                                            option_with_script->from_value(
-                                                ActionValue<std::string>(string_value->value()));
-                                        } else {
-                                            spdlog::get("logger")->warn("No from-value was set for action {0}",
-                                                                        current_action.title());
-                                        }
-
-                                        if (auto string_value = trigger_section->get<confusepp::Option<std::string>>(
-                                                Config::Constants::to_value);
-                                            string_value) {
-                                            option_with_script->to_value(
-                                                ActionValue<std::string>(string_value->value()));
-                                        } else {
-                                            spdlog::get("logger")->warn("No to-value was set for action {0}",
-                                                                        current_action.title());
-                                        }
-                                    } catch (std::regex_error) {
-                                        spdlog::get("logger")->warn(
-                                            "Couldn't compile regular expressions for action {0}",
+                        option_with_script->scan(std::optional<ScanSettings>{});
+
+                        if (scan_directory) {
+                            auto source =
+                                current_action.get<confusepp::Option<std::string>>(Config::Constants::scan_source);
+                            auto pages = current_action.get<confusepp::Option<int>>(Config::Constants::scan_pages);
+                            option_with_script->script("");
+                            option_with_script->resolved_script(nullptr);
+                            option_with_script->plugin(nullptr);
+                            option_with_script->scan(
+                                ScanSettings{scan_directory->value(),
+                                             source ? source->value() : Config::Constants::scan_source_def,
+                                             pages ? pages->value() : Config::Constants::scan_pages_def});
+                        } else if (resolved_plugin) {
+                            option_with_script->script("");
+                            option_with_script->resolved_script(nullptr);
+                            option_with_script->plugin(resolved_plugin);
+                        } else {
+                            option_with_script->plugin(nullptr);
+                            option_with_script->script(script->value());
+                            option_with_script->resolved_script(scripts.resolve(script->value()));
+
+                            if (!option_with_script->resolved_script()) {
+                                logger.critical("Script {0} of action {1} can't be used", script->value(),
+                                                current_action.title());
+                            }
+                        }
+
+                        option_with_script->worker_mode(WorkerMode::NONE);
+                        if (auto worker = current_action.get<confusepp::Option<std::string>>(Config::Constants::worker);
+                            worker && !worker->value().empty()) {
+                            if (worker->value() == Config::Constants::worker_action) {
+                                option_with_script->worker_mode(WorkerMode::ACTION);
+                            } else if (worker->value() == Config::Constants::worker_device) {
+                                option_with_script->worker_mode(WorkerMode::DEVICE);
+                            } else {
+                                logger.warn("Unknown worker mode {0} for action {1}", worker->value(),
                                             current_action.title());
-                                        option_with_script->from_value(
-                                            ActionValue<std::string>(Config::Constants::from_value_def_str));
-                                        option_with_script->to_value(
-                                            ActionValue<std::string>(Config::Constants::to_value_def_str));
-                                    }
-                                } else {
-                                    spdlog::get("logger")->warn("No trigger values were set for action {0}",
-                                                                current_action.title());
-                                    option_with_script->from_value(
-                                        ActionValue<std::string>(Config::Constants::from_value_def_str));
-                                    option_with_script->to_value(
-                                        ActionValue<std::string>(Config::Constants::to_value_def_str));
-                                }
                             }
-                        };
+                        }
 
-                        if (current_option.value_as_variant()) {
-                            std::visit(init_range_values, *current_option.value_as_variant());
-                        } else {
-                            spdlog::get("logger")->critical("Couldn't get value of current option");
+                        option_with_script->limits(read_script_limits(current_action));
+                        if (auto order = current_action.get<confusepp::Option<int>>(Config::Constants::order); order) {
+                            option_with_script->order(order->value());
                         }
+                        if (auto debounce = current_action.get<confusepp::Option<int>>(Config::Constants::debounce);
+                            debounce) {
+                            option_with_script->debounce(std::chrono::milliseconds(std::max(debounce->value(), 0)));
+                        }
+                        if (auto min_interval =
+                                current_action.get<confusepp::Option<int>>(Config::Constants::min_interval);
+                            min_interval) {
+                            option_with_script->min_interval(
+                                std::chrono::milliseconds(std::max(min_interval->value(), 0)));
+                        }
+                        if (auto skip_while_running =
+                                current_action.get<confusepp::Option<bool>>(Config::Constants::skip_while_running);
+                            skip_while_running) {
+                            option_with_script->skip_while_running(skip_while_running->value());
+                        }
+                        option_with_script->option_info(current_option.info());
+                        option_with_script->last_value(value);
+                        option_with_script->condition(read_trigger_condition(current_action, *value));
                     }
                 }
             }
         }
     }
 
-    void detail::PollHandler::poll_device() {
-        SignalHandler signal_handler;
-        signal_handler.disable_signals_for_thread();
+    // Options which are polled anyway are not read again, otherwise the value is read into read_value
+    const std::optional<OptionValue> &detail::PollHandler::function_value(
+        const Function &function, const sanepp::Device &device,
+        std::optional<OptionValue> &read_value) const {
+        auto option_polled = std::find_if(
+            m_polled_options.cbegin(), m_polled_options.cend(),
+            [&function](const auto &option) { return function.option_info() == option.option_info(); });
 
-        auto device = device_info().open();
+        if (option_polled != m_polled_options.cend()) {
+            return option_polled->value();
+        }
 
-        if (!device) {
-            spdlog::get("logger")->critical("Couldn't open device {0}", device_info().name());
-            return;
+        if (auto option = device.find_option(function.option_info()); option) {
+            read_value = read_option_value(device, *option);
         }
 
-        Config config;
-        auto global_section = config.get<confusepp::Section>(Config::Constants::global);
+        return read_value;
+    }
 
-        if (!global_section) {
-            spdlog::get("logger")->critical("Config is invalid");
-            return;
+    void detail::PollHandler::dispatch_plugin(const Action &action, const sanepp::Device &device) {
+        PluginEvent event{action.plugin(), action.deadline(), device_info().name(), action.action_name(), {},
+                          action.running()};
+
+        for (const auto &current_function : m_functions) {
+            std::optional<OptionValue> read_value;
+            const auto &current_value = function_value(current_function, device, read_value);
+
+            if (!current_value) {
+                continue;
+            }
+
+            std::visit(
+                [&event, &current_function](const auto &value) {
+                    using type = std::decay_t<decltype(value)>;
+
+                    if constexpr (std::is_same_v<type, int> || std::is_same_v<type, bool>) {
+                        event.functions.emplace_back(current_function.env(), std::to_string(value));
+                    } else if constexpr (std::is_same_v<type, sanepp::Fixed>) {
+                        event.functions.emplace_back(current_function.env(), std::to_string(value.value()));
+                    } else if constexpr (std::is_same_v<type, std::string>) {
+                        event.functions.emplace_back(current_function.env(), value);
+                    } else if constexpr (std::is_same_v<type, WordArray>) {
+                        event.functions.emplace_back(current_function.env(), value.join());
+                    }
+                },
+                *current_value);
         }
 
-        find_matching_options(*device, *global_section);
-        find_matching_functions(*device, *global_section);
+        logger.info("Calling plugin {0} for action {1} of device {2}", action.plugin()->name(), action.action_name(),
+                    device_info().name());
 
-        if (auto device_multi_section = config.get<confusepp::Multisection>(Config::Constants::device);
-            device_multi_section) {
-            for (const auto &device_section : device_multi_section->sections()) {
-                auto device_filter = device_section.get<confusepp::Option<std::string>>(Config::Constants::filter);
-                if (!device_filter) {
-                    continue;
+        PluginExecutor executor;
+        *action.running() = true;
+        if (!executor.execute(std::move(event))) {
+            *action.running() = false;
+        }
+    }
+
+    void detail::PollHandler::prepare_environment(const Action &action, const sanepp::Device &device,
+                                                  Environment &environment) {
+        environment.reset().device(device_info().name()).action(action.action_name());
+
+        for (const auto &current_function : m_functions) {
+            std::optional<OptionValue> read_value;
+            const auto &current_value = function_value(current_function, device, read_value);
+
+            if (!current_value) {
+                continue;
+            }
+
+            std::visit(
+                [&environment, &current_function](const auto &value) {
+                    using type = std::decay_t<decltype(value)>;
+
+                    if constexpr (std::is_same_v<type, int> || std::is_same_v<type, bool> ||
+                                  std::is_same_v<type, std::string>) {
+                        environment.add(current_function.env(), value);
+                    } else if constexpr (std::is_same_v<type, sanepp::Fixed>) {
+                        environment.add(current_function.env(), value.value());
+                    } else if constexpr (std::is_same_v<type, WordArray>) {
+                        environment.add(current_function.env(), value.join());
+                    }
+                },
+                *current_value);
+        }
+    }
+
+    // Reads every option of the device once, values which were just polled are reused
+    OptionSnapshot detail::PollHandler::take_snapshot(const sanepp::Device &device) const {
+        OptionSnapshot snapshot;
+
+        for (const auto &current_option : device.options()) {
+            auto option_polled = std::find_if(
+                m_polled_options.cbegin(), m_polled_options.cend(),
+                [&current_option](const auto &option) { return current_option.info() == option.option_info(); });
+
+            if (option_polled != m_polled_options.cend()) {
+                if (option_polled->value()) {
+                    snapshot.add(current_option.info().name(), *option_polled->value());
                 }
+            } else if (auto value = read_option_value(device, current_option); value) {
+                snapshot.add(current_option.info().name(), *value);
+            }
+        }
 
-                std::regex device_regex;
+        return snapshot;
+    }
 
-                try {
-                    device_regex.assign(device_filter->value(), std::regex_constants::extended);
-                } catch (std::regex_error) {
-                    spdlog::get("logger")->warn("Couldn't compile device filter for device section {0}",
-                                                device_section.title());
-                    continue;
+    // Has to be called with the device released
+    void detail::PollHandler::run_script(Action &action, Environment &environment, int snapshot_fd) {
+        // Build the array before forking, the child must not allocate
+        char *const *environment_variables = environment.envp();
+
+        // Scripts are resolved when the config is loaded, only changed scripts are resolved again
+        ScriptRegistry scripts;
+        scripts.update();
+        if (!action.resolved_script() || !action.resolved_script()->valid()) {
+            action.resolved_script(scripts.resolve(action.script()));
+        }
+
+        if (auto script = action.resolved_script(); script) {
+            using namespace std::string_literals;
+            if (action.action_name() != ""s) {
+                std::vector<Redirection> redirections;
+                if (snapshot_fd >= 0) {
+                    redirections.push_back({snapshot_fd, OptionSnapshot::Constants::script_fd});
                 }
 
-                if (!std::regex_match(device_info().name(), device_regex)) {
-                    continue;
+                SCANBDPP_TRACE_SPAN("script");
+                auto script_start = std::chrono::steady_clock::now();
+                ScriptResult result = script->run(environment_variables, action.limits(), redirections,
+                                                  device_info().name() + "/" + action.action_name());
+
+                Metrics metrics;
+                metrics
+                    .histogram("scanbd_script_duration_seconds", "Run time of action scripts",
+                               {{"device", device_info().name()}, {"action", action.action_name()}})
+                    .record(std::chrono::steady_clock::now() - script_start);
+
+                action.record_result(result);
+                if (result.timed_out) {
+                    logger.warn("Action {0} of device {1} timed out {2} times, killed {3} times", action.action_name(),
+                                device_info().name(), action.timeouts(), action.kills());
                 }
 
-                auto local_actions = device_section.get<confusepp::Multisection>(Config::Constants::action);
+                const auto &status = result.status;
 
-                if (!local_actions) {
-                    continue;
+                // Same convention as the shell, 128 + signal for scripts which were killed
+                int exit_status = -1;
+                if (status && WIFEXITED(*status)) {
+                    exit_status = WEXITSTATUS(*status);
+                } else if (status && WIFSIGNALED(*status)) {
+                    exit_status = 128 + WTERMSIG(*status);
                 }
 
-                spdlog::get("logger")->info("Found local actions for device {0}", device_info().name());
+                metrics
+                    .counter("scanbd_script_exits_total", "Finished action scripts by exit status",
+                             {{"device", device_info().name()},
+                              {"action", action.action_name()},
+                              {"status", std::to_string(exit_status)}})
+                    .fetch_add(1, std::memory_order_relaxed);
 
-                find_matching_options(*device, device_section);
-                find_matching_functions(*device, device_section);
+                EventServer events;
+                events.publish(Event{Event::Type::SCRIPT, device_info().name(), action.action_name(), exit_status});
             }
+        } else {
+            logger.warn("Script {0} can't be used", action.script().c_str());
         }
+    }
 
-        int timeout =
-            config.get<confusepp::Option<int>>(Config::Constants::global / Config::Constants::timeout)->value();
+    // All script actions of one poll cycle share a single release of the device. Actions with the same order run
+    // in parallel, the groups run one after another. Scans don't release the device, they are started by
+    // start_scans afterwards.
+    bool detail::PollHandler::run_triggered(std::vector<Action *> &triggered, std::optional<sanepp::Device> &device,
+                                            int timeout, bool option_snapshot) {
+        struct Launch {
+            Action *action;
+            Environment &environment;
+            int snapshot_fd;
+        };
+
+        SCANBDPP_TRACE_SPAN("run triggered");
+        auto triggered_time = std::chrono::steady_clock::now();
+
+        std::stable_sort(triggered.begin(), triggered.end(),
+                         [](const Action *first, const Action *second) { return first->order() < second->order(); });
+
+        // Every launch gets its own environment, they are kept, so the next trigger reuses their buffers
+        while (m_launch_environments.size() < triggered.size()) {
+            m_launch_environments.emplace_back(std::make_unique<Environment>(m_environment));
+        }
 
-        spdlog::get("logger")->info("Start polling for device {0}", device_info().name());
-        while (!m_terminate) {
-            for (auto current_action = m_actions.begin(); current_action != m_actions.end(); ++current_action) {
-                // Only get a value once, because otherwise the backend might reset the value after
-                // the value has been checked (Check original scanbd for reference)
-                auto option_first_used =
-                    std::find_if(m_actions.begin(), current_action, [&current_action](const auto &action) {
-                        return current_action->option_info() == action.option_info();
-                    });
+        // Everything, which needs the device is prepared before it is released
+        std::optional<OptionSnapshot> snapshot;
+        std::vector<Launch> launches;
+        launches.reserve(triggered.size());
+
+        for (auto current_action : triggered) {
+            auto &environment = *m_launch_environments[launches.size()];
+            int snapshot_fd = -1;
+
+            prepare_environment(*current_action, *device, environment);
+
+            // Every script gets its own descriptor, so they don't share the file offset
+            if (option_snapshot) {
+                if (!snapshot) {
+                    snapshot = take_snapshot(*device);
+                }
+
+                if ((snapshot_fd = snapshot->seal()) >= 0) {
+                    environment.add(OptionSnapshot::Constants::env_name, OptionSnapshot::Constants::script_fd);
+                }
+            }
+
+            // Triggers, which arrive until the device is reopened, are dropped for skip_while_running
+            current_action->running(true);
+            launches.push_back(Launch{current_action, environment, snapshot_fd});
+        }
+
+        {
+            SCANBDPP_TRACE_SPAN("release device");
+            // The polled options hold a reference to the device, so they have to be released as well
+            detach_polled_options();
+            // Destroys current value of the optional thus freeing the resource (the device that the
+            // optional holds)
+            logger.info("Closing device {0}", device_info().name());
+            device.reset();
+            m_state = DeviceState::RELEASED;
+        }
+
+        {
+            SCANBDPP_TRACE_SPAN("sleep before scripts");
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+        }
+
+        for (auto group_begin = launches.begin(); group_begin != launches.end();) {
+            auto group_end = std::find_if(group_begin, launches.end(), [group_begin](const Launch &launch) {
+                return launch.action->order() != group_begin->action->order();
+            });
 
-                if (option_first_used != current_action) {
-                    current_action->current_value(option_first_used->current_value());
+            auto group_scripts = std::distance(group_begin, group_end);
+            std::vector<std::thread> scripts;
+
+            for (auto current_launch = group_begin; current_launch != group_end; ++current_launch) {
+                logger.info("Start script of action {0} for device {1}", current_launch->action->action_name(),
+                            device_info().name());
+                m_trigger_latency.record(std::chrono::steady_clock::now() - triggered_time);
+
+                if (group_scripts == 1) {
+                    run_script(*current_launch->action, current_launch->environment, current_launch->snapshot_fd);
                 } else {
-                    current_action->current_value(
-                        device->find_option(current_action->option_info())->value_as_variant());
+                    scripts.emplace_back([this, current_launch] {
+                        run_script(*current_launch->action, current_launch->environment,
+                                   current_launch->snapshot_fd);
+                    });
                 }
+            }
 
-                auto current_value = current_action->current_value();
+            // A script of the group might use the device as well
+            for (auto &current_script : scripts) {
+                current_script.join();
+            }
 
-                if (!current_value) {
-                    spdlog::get("logger")->warn("Couldn't get current value of option {0} of device {1}",
-                                                current_action->option_info().name(), device_info().name());
-                    continue;
+            group_begin = group_end;
+        }
+
+        for (auto &current_launch : launches) {
+            if (current_launch.snapshot_fd >= 0) {
+                close(current_launch.snapshot_fd);
+            }
+            current_launch.action->reset_last_value();
+            current_launch.action->running(false);
+        }
+
+        logger.info("Reopen device {0}", device_info().name());
+
+        if (!open_device(device)) {
+            return false;
+        }
+
+        attach_polled_options(*device);
+        return true;
+    }
+
+    // The scans run one after another by order on the open device. The poll thread keeps waiting for the next
+    // cycles meanwhile, so stop and the status report aren't blocked by a scan.
+    void detail::PollHandler::start_scans(const sanepp::Device &device) {
+        std::stable_sort(m_scan_actions.begin(), m_scan_actions.end(),
+                         [](const Action *first, const Action *second) { return first->order() < second->order(); });
+
+        for (auto current_action : m_scan_actions) {
+            current_action->running(true);
+        }
+
+        m_scanning = true;
+        m_state = DeviceState::SCANNING;
+
+        SANE_Handle handle = device.handle();
+        auto triggered_time = std::chrono::steady_clock::now();
+
+        m_scan_thread = std::thread([this, handle, triggered_time] {
+            SignalHandler signal_handler;
+            signal_handler.disable_signals_for_thread();
+
+            EventServer events;
+
+            for (auto current_action : m_scan_actions) {
+                if (m_terminate) {
+                    break;
                 }
 
-                if (!current_action->last_value()) {
-                    current_action->last_value(current_value);
+                logger.info("Start scan of action {0} for device {1}", current_action->action_name(),
+                            device_info().name());
+                m_trigger_latency.record(std::chrono::steady_clock::now() - triggered_time);
+                ScanJob job(handle, device_info().name(), *current_action->scan(), m_terminate);
+                events.publish(
+                    Event{Event::Type::SCAN, device_info().name(), current_action->action_name(), job.run()});
+            }
+
+            m_scanning = false;
+        });
+    }
+
+    // Joins the scan thread, once it finished. Returns true, while the scan thread still uses the device.
+    bool detail::PollHandler::scan_running() {
+        if (!m_scan_thread.joinable()) {
+            return false;
+        }
+
+        if (m_scanning) {
+            return true;
+        }
+
+        m_scan_thread.join();
+
+        for (auto current_action : m_scan_actions) {
+            current_action->reset_last_value();
+            current_action->running(false);
+        }
+
+        m_scan_actions.clear();
+        // The actions have lost their last values
+        m_evaluate_all = true;
+        m_state = DeviceState::POLLING;
+        return false;
+    }
+
+    // sane_cancel may be called while another thread is in sane_read, the page is ended right away
+    void detail::PollHandler::stop_scans(const sanepp::Device &device) {
+        if (!m_scan_thread.joinable()) {
+            return;
+        }
+
+        if (m_scanning) {
+            logger.info("Cancel scan of device {0}", device_info().name());
+            sane_cancel(device.handle());
+        }
+
+        m_scan_thread.join();
+        m_scan_actions.clear();
+    }
+
+    // Retries with a jittered exponential backoff, the delay is drawn from [delay / 2, delay], so devices on the
+    // same bus, which failed together, don't retry together. Returns false, if the device failed or polling
+    // stops.
+    bool detail::PollHandler::open_device(std::optional<sanepp::Device> &device) {
+        BusScheduler buses;
+
+        while (!m_terminate) {
+            m_state = DeviceState::OPENING;
+
+            {
+                SCANBDPP_TRACE_SPAN("open device");
+                // A bus, which isn't free within the read deadline, counts as a failed open
+                auto bus_guard = m_read_deadline.count()
+                                     ? buses.try_lock(m_bus, m_read_deadline)
+                                     : std::optional<BusScheduler::Guard>(buses.lock(m_bus));
+
+                if (bus_guard) {
+                    device = device_info().open();
+                } else {
+                    logger.warn("Bus {0} of device {1} was busy for {2} ms", m_bus, device_info().name(),
+                                m_read_deadline.count());
                 }
+            }
 
-                auto has_value_changed = [&current_action](const auto &current_value) -> bool {
-                    using type = std::decay_t<decltype(current_value)>;
+            if (device) {
+                if (m_retries) {
+                    logger.info("Opened device {0} after {1} retries", device_info().name(), m_retries.load());
+                }
 
-                    if (!std::holds_alternative<type>(*current_action->last_value())) {
-                        spdlog::get("logger")->critical("Type of action has changed should never happen");
-                        return false;
-                    }
+                m_retries = 0;
+                m_state = DeviceState::POLLING;
+                return true;
+            }
 
-                    if constexpr (std::is_same_v<type, int> || std::is_same_v<type, sanepp::Fixed> ||
-                                  std::is_same_v<type, bool>) {
-                        auto to_value = std::get<ActionValue<int>>(current_action->to_value());
-                        auto from_value = std::get<ActionValue<int>>(current_action->from_value());
-                        auto last_value = std::get<type>(current_action->last_value().value());
+            ++m_open_failures;
 
-                        return to_value == current_value && from_value == last_value;
-                    }
-                    if constexpr (std::is_same_v<type, std::string>) {
-                        auto to_value = std::get<ActionValue<std::string>>(current_action->to_value());
-                        auto from_value = std::get<ActionValue<std::string>>(current_action->from_value());
-                        auto last_value = std::get<type>(current_action->last_value().value());
+            if (m_max_retries && m_retries >= m_max_retries) {
+                logger.critical("Couldn't open device {0} after {1} retries, giving up", device_info().name(),
+                                m_retries.load());
+                m_failure = "couldn't open device";
+                m_state = DeviceState::FAILED;
+                return false;
+            }
 
-                        return to_value == current_value && from_value == last_value;
-                    }
-                    spdlog::get("logger")->critical("Action has invalid type, this should never happen");
+            auto delay = std::min<std::chrono::milliseconds>(
+                Constants::min_open_backoff * (1 << std::min(m_retries.load(), 16u)), Constants::max_open_backoff);
+            delay = std::chrono::milliseconds(
+                std::uniform_int_distribution<long>(delay.count() / 2, delay.count())(m_random));
+            ++m_retries;
 
-                    return false;
-                };
+            logger.warn("Couldn't open device {0}, retry {1} in {2} ms", device_info().name(), m_retries.load(),
+                        delay.count());
 
-                bool value_changed = std::visit(has_value_changed, *current_value);
-                current_action->last_value(current_value);
+            auto next_retry = std::chrono::steady_clock::now() + delay;
+            m_next_retry = next_retry.time_since_epoch().count();
+            m_state = DeviceState::BACKOFF;
+
+            wait_terminate(next_retry);
+        }
 
-                if (value_changed || current_action->is_triggered()) {
-                    current_action->unset_trigger();
-                    // Destroys current value of the optional thus freeing the resource (the device that the
-                    // optional holds)
-                    auto env_vars = environment();
+        return false;
+    }
+
+    void detail::PollHandler::find_polled_options() {
+        m_polled_options.clear();
+
+        for (auto &current_action : m_actions) {
+            auto option_polled = std::find_if(
+                m_polled_options.cbegin(), m_polled_options.cend(),
+                [&current_action](const auto &option) { return current_action.option_info() == option.option_info(); });
+
+            if (option_polled == m_polled_options.cend()) {
+                Metrics metrics;
+                m_polled_options.emplace_back(
+                    current_action.option_info(),
+                    metrics.histogram("scanbd_option_read_seconds", "Time to read an option of a device",
+                                      {{"device", device_info().name()}, {"option", current_action.option_info().name()}}));
+                option_polled = m_polled_options.cend() - 1;
+            }
 
-                    if (auto device_env = config.get<confusepp::Option<std::string>>(
-                            Config::Constants::global / Config::Constants::environment / Config::Constants::device);
-                        device_env) {
-                        env_vars.emplace_back(device_env->value() + "=" + device->info().name());
+            current_action.polled_option(std::distance(m_polled_options.cbegin(), option_polled));
+        }
+
+        m_packed_values.assign(m_polled_options.size(), 0);
+        m_last_packed_values.assign(m_polled_options.size(), 0);
+        m_packed.assign(m_polled_options.size(), false);
+        m_always_evaluate = std::any_of(m_actions.cbegin(), m_actions.cend(), [](const auto &current_action) {
+            return current_action.condition().fires_without_change();
+        });
+        m_evaluate_all = true;
+    }
+
+    // Actions of the same device can share a worker, if they use the same script
+    void detail::PollHandler::start_workers() {
+        for (auto &current_action : m_actions) {
+            current_action.worker(nullptr);
+
+            if (current_action.worker_mode() == WorkerMode::NONE || !current_action.resolved_script()) {
+                continue;
+            }
+
+            std::string name = device_info().name() + ":" +
+                               (current_action.worker_mode() == WorkerMode::DEVICE
+                                    ? current_action.resolved_script()->path().native()
+                                    : current_action.action_name());
+
+            auto worker = std::find_if(m_workers.begin(), m_workers.end(),
+                                       [&name](const auto &current) { return current->name() == name; });
+
+            if (worker == m_workers.end()) {
+                Environment worker_environment = m_environment;
+                worker_environment.reset().device(device_info().name());
+
+                if (current_action.worker_mode() == WorkerMode::ACTION) {
+                    worker_environment.action(current_action.action_name());
+                }
+
+                m_workers.emplace_back(
+                    std::make_unique<ScriptWorker>(name, current_action.resolved_script(), worker_environment));
+                worker = m_workers.end() - 1;
+            }
+
+            current_action.worker(worker->get());
+        }
+
+        // Filled every cycle, so it doesn't allocate afterwards
+        m_worker_fds.reserve(m_workers.size());
+    }
+
+    void detail::PollHandler::attach_polled_options(const sanepp::Device &device) {
+        for (auto &current_option : m_polled_options) {
+            current_option.attach(device);
+        }
+    }
+
+    void detail::PollHandler::detach_polled_options() {
+        for (auto &current_option : m_polled_options) {
+            current_option.detach();
+        }
+    }
+
+    void detail::PollHandler::poll_device() {
+        // Tells stop on every return path, that the thread can be joined
+        struct FinishedGuard {
+            std::atomic_bool &finished;
+            ~FinishedGuard() { finished = true; }
+        } finished_guard{m_finished};
+
+        SignalHandler signal_handler;
+        signal_handler.disable_signals_for_thread();
+
+        auto device = std::move(m_device);
+        m_device.reset();
+
+        Config config;
+
+        int timeout =
+            config.get<confusepp::Option<int>>(Config::Constants::global / Config::Constants::timeout)->value();
+
+        m_max_retries = static_cast<unsigned int>(std::max(
+            config.get<confusepp::Option<int>>(Config::Constants::global / Config::Constants::open_retries)->value(),
+            0));
+
+        m_read_deadline = std::chrono::milliseconds(
+            config.get<confusepp::Option<int>>(Config::Constants::global / Config::Constants::read_deadline)->value());
+
+        // The device couldn't be opened by prepare, so the config isn't matched yet
+        if (!device) {
+            if (!open_device(device)) {
+                return;
+            }
+
+            if (!match_config(*device)) {
+                logger.info("Device {0} is idle: {1}", device_info().name(), m_idle_reason);
+                m_failure = m_idle_reason.c_str();
+                m_state = DeviceState::FAILED;
+                return;
+            }
+        }
+
+        m_state = DeviceState::POLLING;
+
+        bool option_snapshot = config
+                                   .get<confusepp::Option<bool>>(Config::Constants::global /
+                                                                 Config::Constants::option_snapshot)
+                                   ->value();
+
+        EventServer events;
+        BusScheduler buses;
+
+        // Devices on the same bus start with an offset, so their reads are spread over the poll interval
+        if (size_t bus_devices = buses.devices(m_bus); !m_bus.empty() && bus_devices > 1) {
+            auto offset = std::chrono::milliseconds(timeout) * m_bus_slot / bus_devices;
+            wait_terminate(std::chrono::steady_clock::now() + offset);
+        }
+
+        attach_polled_options(*device);
+        start_workers();
+
+        std::vector<Action *> triggered;
+
+        logger.info("Start polling for device {0}", device_info().name());
+        while (!m_terminate) {
+            SCANBDPP_TRACE_SPAN("poll cycle");
+            triggered.clear();
+            m_poll_cycles.fetch_add(1, std::memory_order_relaxed);
+
+            // A cycle, which didn't get the bus, isn't evaluated
+            if (scan_running() || !read_polled_options()) {
+                wait_next_cycle(std::chrono::milliseconds(timeout));
+                continue;
+            }
+
+            bool evaluate_all = m_evaluate_all || m_trigger_pending.exchange(false);
+            bool unpacked = false;
+            uint64_t changed = 0;
+
+            for (size_t index = 0; index < m_polled_options.size(); ++index) {
+                m_packed[index] = m_polled_options[index].pack(m_packed_values[index]);
+                unpacked |= !m_packed[index];
+            }
+
+            // Kept free of branches, so the compiler can vectorize it
+            for (size_t index = 0; index < m_packed_values.size(); ++index) {
+                changed |= m_packed_values[index] ^ m_last_packed_values[index];
+            }
+
+            auto now = std::chrono::steady_clock::now();
+
+            // Only actions of changed options are evaluated, a cycle without any change ends here
+            if (changed || unpacked || evaluate_all || m_always_evaluate) {
+                for (auto current_action = m_actions.begin(); current_action != m_actions.end(); ++current_action) {
+                    size_t option_index = current_action->polled_option();
+
+                    // Packed options, which didn't change, can't trigger
+                    if (!evaluate_all && m_packed[option_index] &&
+                        m_packed_values[option_index] == m_last_packed_values[option_index] &&
+                        !current_action->condition().fires_without_change()) {
+                        continue;
                     }
 
-                    if (auto action_env = config.get<confusepp::Option<std::string>>(
-                            Config::Constants::global / Config::Constants::environment / Config::Constants::action);
-                        action_env) {
-                        env_vars.emplace_back(action_env->value() + "=" + current_action->action_name());
+                    const auto &current_value = m_polled_options[option_index].value();
+
+                    // Reported by read_polled_options
+                    if (!current_value) {
+                        continue;
                     }
-                    for (auto current_function : m_functions) {
-                        auto option_first_used =
-                            std::find_if(m_actions.cbegin(), m_actions.cend(), [&current_function](const auto &action) {
-                                return current_function.option_info() == action.option_info();
-                            });
 
-                        std::optional<sanepp::Option::value_type> current_value;
+                    if (!current_action->last_value()) {
+                        current_action->last_value(current_value);
+                    }
+
+                    bool value_changed = current_action->evaluate_trigger(*current_value, now);
+                    current_action->last_value(current_value);
+
+                    if (value_changed || current_action->is_triggered()) {
+                        current_action->unset_trigger();
 
-                        if (option_first_used != m_actions.cend()) {
-                            current_value = option_first_used->current_value();
-                        } else {
-                            current_value = device->find_option(current_function.option_info())->value_as_variant();
+                        if (!current_action->accept_trigger(now)) {
+                            SCANBDPP_LOG_DEBUG("Suppressed action {0} of device {1} ({2} times)",
+                                               current_action->action_name(), device_info().name(),
+                                               current_action->suppressed());
+                            continue;
+                        }
+
+                        events.publish(
+                            Event{Event::Type::BUTTON, device_info().name(), current_action->action_name()});
+
+                        // Plugins are called in process, so the device doesn't have to be released
+                        if (current_action->plugin()) {
+                            dispatch_plugin(*current_action, *device);
+                            continue;
+                        }
+
+                        // Workers are already running, they only get the event
+                        if (current_action->worker()) {
+                            prepare_environment(*current_action, *device, m_environment);
+                            current_action->worker()->send(m_environment.dynamic_entries());
+                            continue;
                         }
 
-                        if (!current_value) {
+                        if (current_action->scan()) {
+                            m_scan_actions.push_back(&*current_action);
                             continue;
                         }
 
-                        std::visit(
-                            [&env_vars, &current_function](const auto &value) {
-                                using type = std::decay_t<decltype(value)>;
-
-                                std::string as_string;
-
-                                if constexpr (std::is_same_v<type, int> || std::is_same_v<type, bool>) {
-                                    as_string = std::to_string(value);
-                                } else if constexpr (std::is_same_v<type, sanepp::Fixed>) {
-                                    as_string = std::to_string(value.value());
-                                } else if constexpr (std::is_same_v<type, std::string>) {
-                                    as_string = value;
-                                } else {
-                                    return;
-                                }
-
-                                env_vars.emplace_back(current_function.env() + "=" + as_string);
-                            },
-                            *current_value);
+                        triggered.push_back(&*current_action);
                     }
+                }
+            }
 
-                    spdlog::get("logger")->info("Closing device {0}", device_info().name());
-                    device.reset();
+            std::swap(m_packed_values, m_last_packed_values);
+            m_evaluate_all = false;
 
-                    spdlog::get("logger")->info("Start script for device {0}", device_info().name());
+            if (!triggered.empty()) {
+                if (!run_triggered(triggered, device, timeout, option_snapshot)) {
+                    return;
+                }
 
-                    std::unique_ptr<const char *[]> environment_variables =
-                        std::make_unique<const char *[]>(env_vars.size() + 1);
+                // The actions have lost their last values
+                m_evaluate_all = true;
+            }
 
-                    size_t index = 0;
-                    for (auto &current_env : env_vars) {
-                        environment_variables[index++] = current_env.c_str();
-                    }
-                    environment_variables[env_vars.size()] = nullptr;
+            if (!m_scan_actions.empty()) {
+                start_scans(*device);
+            }
 
-                    auto script_absolute_path = make_script_path_absolute(current_action->script());
+            for (auto &current_worker : m_workers) {
+                current_worker->flush();
+            }
 
-                    if (std::experimental::filesystem::exists(script_absolute_path)) {
-                        using namespace std::string_literals;
-                        if (current_action->action_name() != ""s) {
-                            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+            wait_next_cycle(std::chrono::milliseconds(timeout));
+        }
 
-                            pid_t cpid;
+        stop_scans(*device);
+        m_workers.clear();
 
-                            if ((cpid = fork()) < 0) {
-                                spdlog::get("logger")->critical("Can't fork {0}", strerror(errno));
-                            } else if (cpid > 0) {
-                                spdlog::get("logger")->info("Waiting for child {0}", script_absolute_path.c_str());
-                                int status = 0;
+        for (const auto &current_action : m_actions) {
+            if (current_action.suppressed()) {
+                logger.info("Suppressed action {0} of device {1} {2} times", current_action.action_name(),
+                            device_info().name(), current_action.suppressed());
+            }
+        }
 
-                                if (waitpid(cpid, &status, 0) < 0) {
-                                    spdlog::get("logger")->critical("waitpid: {0}", script_absolute_path.c_str());
-                                }
+        logger.info("Stopped polling device {0}", device->info().name());
+    }
 
-                                if (WIFEXITED(status)) {
-                                    spdlog::get("logger")->info("Child {0} exited with status: {1}",
-                                                                script_absolute_path.c_str(), WEXITSTATUS(status));
-                                }
+    // Every option is read only once per cycle, otherwise the backend might reset the value after it has been checked
+    // (see the original scanbd). The bus is waited for up to the read deadline, otherwise the cycle is skipped.
+    // Degraded devices read without the bus, so a wedged device doesn't stall the other devices on its bus.
+    bool detail::PollHandler::read_polled_options() {
+        SCANBDPP_TRACE_SPAN("read options");
+        BusScheduler buses;
+        bool slow_read = false;
+        auto bus_guard = m_degraded                ? std::optional<BusScheduler::Guard>(BusScheduler::Guard())
+                         : m_read_deadline.count() ? buses.try_lock(m_bus, m_read_deadline)
+                                                   : std::optional<BusScheduler::Guard>(buses.lock(m_bus));
+
+        if (!bus_guard) {
+            ++m_slow_cycles;
+            m_bus_busy = true;
+
+            if (!m_degraded.exchange(true)) {
+                logger.warn("Device {0} is degraded: bus {1} was busy for {2} ms, skipping the poll cycle",
+                            device_info().name(), m_bus, m_read_deadline.count());
+            }
 
-                                if (WIFSIGNALED(status)) {
-                                    spdlog::get("logger")->info("Child {0} signaled with signal: {1}",
-                                                                script_absolute_path.c_str(), WTERMSIG(status));
-                                }
-                            } else {
-                                // TODO add the rest
+            return false;
+        }
 
-                                if (execle(script_absolute_path.c_str(), script_absolute_path.c_str(), NULL,
-                                           environment_variables.get()) < 0) {
-                                    spdlog::get("logger")->critical("execle: {0}", strerror(errno));
-                                }
+        auto cycle_start = std::chrono::steady_clock::now();
 
-                                exit(EXIT_FAILURE);
-                            }
-                        }
-                    } else {
-                        spdlog::get("logger")->warn("Script {0} does not exist", script_absolute_path.c_str());
-                    }
+        for (size_t index = 0; index < m_polled_options.size(); ++index) {
+            auto read_start = std::chrono::steady_clock::now();
+            m_reading_option = index;
+            m_read_start = read_start.time_since_epoch().count();
 
-                    spdlog::get("logger")->info("Reopen device {0}", device_info().name());
-                    device = device_info().open();
+            bool had_value = m_polled_options[index].value().has_value();
 
-                    if (!device) {
-                        spdlog::get("logger")->critical("Couldn't reopen device");
-                        return;
-                    }
+            // An option, which can't be read, is reported once instead of in every cycle
+            if (!m_polled_options[index].read() && (had_value || m_evaluate_all)) {
+                logger.warn("Couldn't get current value of option {0} of device {1}",
+                            m_polled_options[index].option_info().name(), device_info().name());
+            }
+
+            auto read_time = std::chrono::steady_clock::now() - read_start;
+            m_read_start = 0;
+            m_polled_options[index].latency().record(read_time);
+
+            if (m_read_deadline.count() && read_time > m_read_deadline) {
+                slow_read = true;
+                m_slow_option = index;
+                m_slow_read_time = read_time.count();
+                // The device is degraded, the remaining reads don't hold the bus
+                bus_guard.reset();
+            }
+        }
+
+        m_read_latency.record(std::chrono::steady_clock::now() - cycle_start);
+        update_degraded(slow_read);
+        return true;
+    }
+
+    void detail::PollHandler::update_degraded(bool slow_read) {
+        if (slow_read) {
+            ++m_slow_cycles;
+            m_bus_busy = false;
+
+            if (!m_degraded.exchange(true)) {
+                logger.warn(
+                    "Device {0} is degraded: reading option {1} took {2} ms (deadline {3} ms), backing off polling",
+                    device_info().name(), m_polled_options[m_slow_option].option_info().name(),
+                    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::nanoseconds(m_slow_read_time))
+                        .count(),
+                    m_read_deadline.count());
+            }
+        } else if (m_degraded.exchange(false)) {
+            m_bus_busy = false;
+            logger.info("Device {0} recovered after {1} slow poll cycles", device_info().name(), m_slow_cycles);
+            m_slow_cycles = 0;
+        }
+    }
+
+    // Degraded devices are polled less often (doubling per slow cycle), the wait ends early on stop. Workers,
+    // which exit meanwhile, are reaped right away.
+    void detail::PollHandler::wait_next_cycle(std::chrono::milliseconds timeout) {
+        SCANBDPP_TRACE_SPAN("wait next cycle");
+        auto interval = timeout;
 
-                    current_action->last_value(std::optional<sanepp::Option::value_type>{});
+        if (m_degraded) {
+            interval = std::min<std::chrono::milliseconds>(timeout * (1 << std::min(m_slow_cycles, 6u)),
+                                                           Constants::max_degraded_interval);
+        }
+
+        for (auto end = std::chrono::steady_clock::now() + interval;
+             !m_terminate && std::chrono::steady_clock::now() < end;) {
+            auto wait = std::min<std::chrono::steady_clock::duration>(timeout, end - std::chrono::steady_clock::now());
+
+            m_worker_fds.clear();
+            for (const auto &current_worker : m_workers) {
+                if (int pid_fd = current_worker->pid_fd(); pid_fd >= 0) {
+                    m_worker_fds.push_back(pollfd{pid_fd, POLLIN, 0});
                 }
             }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+            if (m_worker_fds.empty()) {
+                wait_terminate(std::chrono::steady_clock::now() + wait);
+                continue;
+            }
+
+            if (poll(m_worker_fds.data(), m_worker_fds.size(),
+                     std::chrono::ceil<std::chrono::milliseconds>(wait).count()) > 0) {
+                for (auto &current_worker : m_workers) {
+                    current_worker->flush();
+                }
+            }
         }
-        spdlog::get("logger")->info("Stopped polling device {0}", device->info().name());
     }
 
     detail::Action::Action(const sanepp::OptionInfo &option_info) : m_option_info(option_info) {}
     detail::Action::Action(Action &&other)
-        : m_from_value(std::move(other.m_from_value)),
-          m_to_value(std::move(other.m_to_value)),
+        : m_condition(std::move(other.m_condition)),
           m_option_info(std::move(other.m_option_info)),
+          m_polled_option(other.m_polled_option),
           m_last_value(std::move(other.m_last_value)),
-          m_current_value(std::move(other.m_current_value)),
           m_script(std::move(other.m_script)),
+          m_resolved_script(std::move(other.m_resolved_script)),
+          m_plugin(std::move(other.m_plugin)),
+          m_limits(std::move(other.m_limits)),
+          m_timeouts(other.m_timeouts.load()),
+          m_kills(other.m_kills.load()),
+          m_scan(std::move(other.m_scan)),
+          m_order(other.m_order),
+          m_worker_mode(other.m_worker_mode),
+          m_worker(other.m_worker),
           m_action_name(std::move(other.m_action_name)),
-          m_trigger((bool)other.m_trigger) {}
+          m_trigger((bool)other.m_trigger),
+          m_debounce(other.m_debounce),
+          m_min_interval(other.m_min_interval),
+          m_skip_while_running(other.m_skip_while_running),
+          m_running(std::move(other.m_running)),
+          m_bouncing(other.m_bouncing),
+          m_last_change(other.m_last_change),
+          m_last_fired(other.m_last_fired),
+          m_suppressed(other.m_suppressed.load()) {}
+
+    // Called from the pipe and dbus threads
+    void detail::Action::set_trigger() {
+        if (m_skip_while_running && *m_running) {
+            ++m_suppressed;
+            return;
+        }
 
-    void detail::Action::set_trigger() { m_trigger = true; }
+        m_trigger = true;
+    }
     void detail::Action::unset_trigger() { m_trigger = false; }
     void detail::Action::script(const std::experimental::filesystem::path &new_script) { m_script = new_script; }
+    void detail::Action::resolved_script(std::shared_ptr<Script> new_resolved_script) {
+        m_resolved_script = std::move(new_resolved_script);
+    }
+    void detail::Action::plugin(std::shared_ptr<Plugin> new_plugin) { m_plugin = std::move(new_plugin); }
+    void detail::Action::limits(const ScriptLimits &new_limits) { m_limits = new_limits; }
+    void detail::Action::scan(const std::optional<ScanSettings> &new_scan) { m_scan = new_scan; }
+    void detail::Action::order(int new_order) { m_order = new_order; }
+    void detail::Action::worker_mode(WorkerMode new_worker_mode) { m_worker_mode = new_worker_mode; }
+    void detail::Action::worker(ScriptWorker *new_worker) { m_worker = new_worker; }
     void detail::Action::action_name(const std::string &new_action_name) { m_action_name = new_action_name; }
     void detail::Action::option_info(const sanepp::OptionInfo &new_option_info) { m_option_info = new_option_info; }
-    void detail::Action::current_value(const std::optional<sanepp::Option::value_type> new_current_value) {
-        m_current_value = new_current_value;
-    }
-    void detail::Action::last_value(const std::optional<sanepp::Option::value_type> new_last_value) {
+    void detail::Action::polled_option(size_t new_polled_option) { m_polled_option = new_polled_option; }
+    // Assigns in place, if both values hold the same type no memory is allocated (as long as a string fits)
+    void detail::Action::last_value(const std::optional<OptionValue> &new_last_value) {
         m_last_value = new_last_value;
     }
-    void detail::Action::from_value(const value_type &new_from_value) { m_from_value = new_from_value; }
-    void detail::Action::to_value(const value_type &new_to_value) { m_to_value = new_to_value; }
+    void detail::Action::reset_last_value() { m_last_value.reset(); }
+
+    void detail::Action::record_result(const ScriptResult &result) {
+        m_timeouts += result.timed_out;
+        m_kills += result.killed;
+    }
+    void detail::Action::condition(const TriggerCondition &new_condition) { m_condition = new_condition; }
+    void detail::Action::debounce(std::chrono::milliseconds new_debounce) { m_debounce = new_debounce; }
+    void detail::Action::min_interval(std::chrono::milliseconds new_min_interval) {
+        m_min_interval = new_min_interval;
+    }
+    void detail::Action::skip_while_running(bool new_skip_while_running) {
+        m_skip_while_running = new_skip_while_running;
+    }
+    void detail::Action::running(bool new_running) { *m_running = new_running; }
 
     bool detail::Action::is_triggered() const { return m_trigger; }
     const std::string &detail::Action::action_name() const { return m_action_name; }
     const std::experimental::filesystem::path &detail::Action::script() const { return m_script; }
-    const std::optional<sanepp::Option::value_type> &detail::Action::current_value() const { return m_current_value; }
-    const std::optional<sanepp::Option::value_type> &detail::Action::last_value() const { return m_last_value; }
+    const std::shared_ptr<Script> &detail::Action::resolved_script() const { return m_resolved_script; }
+    const std::shared_ptr<Plugin> &detail::Action::plugin() const { return m_plugin; }
+    std::chrono::milliseconds detail::Action::deadline() const { return m_limits.deadline; }
+    const ScriptLimits &detail::Action::limits() const { return m_limits; }
+    unsigned int detail::Action::timeouts() const { return m_timeouts; }
+    unsigned int detail::Action::kills() const { return m_kills; }
+    const std::optional<ScanSettings> &detail::Action::scan() const { return m_scan; }
+    int detail::Action::order() const { return m_order; }
+    auto detail::Action::worker_mode() const -> WorkerMode { return m_worker_mode; }
+    ScriptWorker *detail::Action::worker() const { return m_worker; }
+    size_t detail::Action::polled_option() const { return m_polled_option; }
+    const std::optional<OptionValue> &detail::Action::last_value() const { return m_last_value; }
     const sanepp::OptionInfo &detail::Action::option_info() const { return m_option_info; }
-    auto detail::Action::from_value() const -> const value_type & { return m_from_value; }
-    auto detail::Action::to_value() const -> const value_type & { return m_to_value; }
+    const TriggerCondition &detail::Action::condition() const { return m_condition; }
+
+    const std::shared_ptr<std::atomic_bool> &detail::Action::running() const { return m_running; }
+    unsigned int detail::Action::suppressed() const { return m_suppressed; }
+
+    // Compares against the last value, the caller updates the last value afterwards
+    bool detail::Action::evaluate_trigger(const OptionValue &current_value,
+                                          std::chrono::steady_clock::time_point now) {
+        if (!m_last_value || m_last_value->index() != current_value.index()) {
+            logger.critical("Type of action has changed should never happen");
+            return false;
+        }
+
+        bool triggered = m_condition.evaluate(*m_last_value, current_value);
+
+        if (m_bouncing && now - m_last_change >= m_debounce) {
+            m_bouncing = false;
+        }
+
+        if (TriggerCondition::changed(*m_last_value, current_value)) {
+            m_last_change = now;
+        }
+
+        if (triggered && m_bouncing) {
+            ++m_suppressed;
+            return false;
+        }
+
+        return triggered;
+    }
+
+    // Decides, if a triggered action is started. Has to be called once per trigger.
+    bool detail::Action::accept_trigger(std::chrono::steady_clock::time_point now) {
+        if ((m_skip_while_running && *m_running) ||
+            (m_min_interval.count() > 0 && m_last_fired && now - *m_last_fired < m_min_interval)) {
+            ++m_suppressed;
+            return false;
+        }
+
+        m_last_fired = now;
+        m_last_change = now;
+        m_bouncing = m_debounce.count() > 0;
+        return true;
+    }
+
+    detail::PolledOption::PolledOption(const sanepp::OptionInfo &option_info, LatencyHistogram &latency)
+        : m_option_info(option_info), m_latency(&latency) {}
+
+    bool detail::PolledOption::read() {
+        if (!m_option) {
+            m_value.reset();
+            return false;
+        }
+
+        if (m_handle && m_type != SANE_TYPE_STRING) {
+            if (sane_control_option(m_handle, m_index, SANE_ACTION_GET_VALUE, m_words.data(), nullptr) !=
+                SANE_STATUS_GOOD) {
+                m_value.reset();
+                return false;
+            }
+
+            // The held array has the size of the option
+            if (auto held_value = m_value ? std::get_if<WordArray>(&*m_value) : nullptr; held_value) {
+                held_value->type = m_type;
+                held_value->words.assign(m_words.cbegin(), m_words.cend());
+            } else {
+                m_value = WordArray{m_type, m_words};
+            }
+
+            return true;
+        } else if (m_handle) {
+            if (sane_control_option(m_handle, m_index, SANE_ACTION_GET_VALUE, m_buffer.data(), nullptr) !=
+                SANE_STATUS_GOOD) {
+                m_value.reset();
+                return false;
+            }
+
+            size_t length = strnlen(m_buffer.data(), m_buffer.size());
+
+            // The held string only grows up to the longest value
+            if (auto held_value = m_value ? std::get_if<std::string>(&*m_value) : nullptr; held_value) {
+                held_value->assign(m_buffer.data(), length);
+            } else {
+                m_value = std::string(m_buffer.data(), length);
+            }
+
+            return true;
+        }
+
+        auto current_value = m_option->value_as_variant();
+
+        if (!current_value) {
+            m_value.reset();
+            return false;
+        }
+
+        if (!m_value || m_value->index() != current_value->index()) {
+            m_value = to_option_value(*current_value);
+            return true;
+        }
+
+        // Assigned into the held alternative
+        std::visit(
+            [](auto &held_value, const auto &read_value) {
+                if constexpr (std::is_same_v<std::decay_t<decltype(held_value)>,
+                                             std::decay_t<decltype(read_value)>>) {
+                    held_value = read_value;
+                }
+            },
+            *m_value, *current_value);
+        return true;
+    }
+
+    // Stores bool, int and fixed values as one word, the bits of fixed values are copied. Strings are stored as
+    // their hash, so unchanged strings aren't matched against the regular expressions of their actions every cycle,
+    // word arrays as their fingerprint.
+    bool detail::PolledOption::pack(uint64_t &word) const {
+        if (!m_value) {
+            return false;
+        }
+
+        if (auto int_value = std::get_if<int>(&*m_value); int_value) {
+            word = static_cast<uint32_t>(*int_value);
+        } else if (auto bool_value = std::get_if<bool>(&*m_value); bool_value) {
+            word = *bool_value;
+        } else if (auto fixed_value = std::get_if<sanepp::Fixed>(&*m_value); fixed_value) {
+            double value = fixed_value->value();
+            std::memcpy(&word, &value, sizeof(word));
+        } else if (auto string_value = std::get_if<std::string>(&*m_value); string_value) {
+            word = std::hash<std::string>()(*string_value);
+        } else if (auto array_value = std::get_if<WordArray>(&*m_value); array_value) {
+            word = array_value->fingerprint();
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    // The buffers keep their size across reopens of the device
+    void detail::PolledOption::attach(const sanepp::Device &device) {
+        m_option = device.find_option(m_option_info);
+        m_handle = nullptr;
+
+        if (!m_option) {
+            return;
+        }
+
+        auto descriptor = detail::find_descriptor(device.handle(), m_option_info.name(), m_index);
+
+        if (!descriptor) {
+            return;
+        } else if (descriptor->type == SANE_TYPE_STRING && descriptor->size > 0) {
+            m_handle = device.handle();
+            m_type = descriptor->type;
+            m_buffer.resize(descriptor->size);
+        } else if (detail::is_word_array(*descriptor)) {
+            m_handle = device.handle();
+            m_type = descriptor->type;
+            m_words.resize(descriptor->size / sizeof(SANE_Word));
+        }
+    }
+
+    void detail::PolledOption::detach() {
+        m_option.reset();
+        m_handle = nullptr;
+    }
+
+    const sanepp::OptionInfo &detail::PolledOption::option_info() const { return m_option_info; }
+
+    const std::optional<OptionValue> &detail::PolledOption::value() const { return m_value; }
+
+    LatencyHistogram &detail::PolledOption::latency() { return *m_latency; }
+
+    const LatencyHistogram &detail::PolledOption::latency() const { return *m_latency; }
 
     detail::Function::Function(const sanepp::OptionInfo &option_info) : m_option_info(option_info) {}
 
@@ -0,0 +1,274 @@
+#include "common.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+#include "logging.h"
+#include "scan.h"
+#include "trace.h"
+
+namespace scanbdpp {
+    namespace {
+        const char *pnm_magic(const SANE_Parameters &parameters) {
+            if (parameters.format == SANE_FRAME_RGB) {
+                return "P6";
+            }
+
+            return parameters.depth == 1 ? "P4" : "P5";
+        }
+    }  // namespace
+
+    ScanJob::ScanJob(SANE_Handle handle, const std::string &device_name, const ScanSettings &settings,
+                     const std::atomic_bool &stop)
+        : m_handle(handle), m_device_name(device_name), m_settings(settings), m_stop(stop) {
+        std::string device_part = device_name;
+        std::replace_if(device_part.begin(), device_part.end(), [](char c) { return !std::isalnum(c); }, '_');
+
+        char time_part[32];
+        std::time_t now = std::time(nullptr);
+        std::tm local_time;
+        localtime_r(&now, &local_time);
+        std::strftime(time_part, sizeof(time_part), "%Y%m%d-%H%M%S", &local_time);
+
+        m_job_name = device_part + "_" + time_part;
+    }
+
+    // Returns the number of pages, which were scanned
+    int ScanJob::run() {
+        SCANBDPP_TRACE_SPAN("scan");
+
+        if (!m_settings.source.empty() && !select_source()) {
+            logger.warn("Couldn't select source {0} of device {1}", m_settings.source, m_device_name);
+        }
+
+        std::error_code error;
+        std::experimental::filesystem::create_directories(m_settings.directory, error);
+
+        m_free_buffers.assign(Constants::buffer_count, std::vector<SANE_Byte>(Constants::buffer_size));
+        std::thread writer(&ScanJob::writer_thread, this);
+
+        // pages == 0 means, that pages are scanned until the document feeder is empty
+        int pages = 0;
+        while ((m_settings.pages <= 0 || pages < m_settings.pages) && !m_stop) {
+            SANE_Status status = sane_start(m_handle);
+
+            if (status == SANE_STATUS_NO_DOCS) {
+                logger.info("Document feeder of device {0} is empty", m_device_name);
+                break;
+            } else if (status != SANE_STATUS_GOOD) {
+                logger.warn("Couldn't start scan on device {0} {1}", m_device_name, sane_strstatus(status));
+                break;
+            }
+
+            SANE_Parameters parameters;
+
+            if (status = sane_get_parameters(m_handle, &parameters); status != SANE_STATUS_GOOD) {
+                logger.warn("Couldn't get scan parameters of device {0} {1}", m_device_name, sane_strstatus(status));
+                break;
+            }
+
+            if (!parameters.last_frame ||
+                (parameters.format != SANE_FRAME_GRAY && parameters.format != SANE_FRAME_RGB)) {
+                logger.warn("Device {0} uses multiple frames per page, which is not supported", m_device_name);
+                break;
+            }
+
+            if (!read_page(parameters, pages + 1)) {
+                break;
+            }
+
+            ++pages;
+        }
+
+        // Ends the scan, the device is polled again afterwards
+        sane_cancel(m_handle);
+
+        push(Chunk{Chunk::Kind::FINISH, {}, {}, {}, 0});
+        writer.join();
+
+        logger.info("Scanned {0} pages with device {1}", pages, m_device_name);
+        return pages;
+    }
+
+    bool ScanJob::select_source() const {
+        SANE_Int option_count = 0;
+
+        if (sane_control_option(m_handle, 0, SANE_ACTION_GET_VALUE, &option_count, nullptr) != SANE_STATUS_GOOD) {
+            return false;
+        }
+
+        for (SANE_Int index = 1; index < option_count; ++index) {
+            const SANE_Option_Descriptor *descriptor = sane_get_option_descriptor(m_handle, index);
+
+            if (!descriptor || !descriptor->name || std::strcmp(descriptor->name, "source") != 0 ||
+                descriptor->type != SANE_TYPE_STRING) {
+                continue;
+            }
+
+            std::vector<char> value(std::max<size_t>(descriptor->size, m_settings.source.size() + 1), '\0');
+            std::copy(m_settings.source.begin(), m_settings.source.end(), value.begin());
+
+            return sane_control_option(m_handle, index, SANE_ACTION_SET_VALUE, value.data(), nullptr) ==
+                   SANE_STATUS_GOOD;
+        }
+
+        return false;
+    }
+
+    // Fills the buffers as far as possible, before they are handed to the writer
+    bool ScanJob::read_page(const SANE_Parameters &parameters, int page) {
+        push(Chunk{Chunk::Kind::BEGIN_PAGE, parameters, page_path(page), {}, 0});
+
+        while (true) {
+            std::vector<SANE_Byte> buffer = take_buffer();
+            size_t length = 0;
+            SANE_Status status = SANE_STATUS_GOOD;
+
+            while (length < buffer.size() && status == SANE_STATUS_GOOD) {
+                SANE_Int read_length = 0;
+                status = sane_read(m_handle, buffer.data() + length, buffer.size() - length, &read_length);
+                length += read_length;
+            }
+
+            push(Chunk{Chunk::Kind::DATA, {}, {}, std::move(buffer), length});
+
+            if (status == SANE_STATUS_EOF) {
+                push(Chunk{Chunk::Kind::END_PAGE, {}, {}, {}, 0});
+                return true;
+            } else if (status != SANE_STATUS_GOOD) {
+                logger.warn("Reading page {0} from device {1} failed {2}", page, m_device_name, sane_strstatus(status));
+                push(Chunk{Chunk::Kind::ABORT_PAGE, {}, {}, {}, 0});
+                return false;
+            }
+        }
+    }
+
+    std::experimental::filesystem::path ScanJob::page_path(int page) const {
+        char page_part[16];
+        std::snprintf(page_part, sizeof(page_part), "_%04d.pnm", page);
+
+        return m_settings.directory / (m_job_name + page_part);
+    }
+
+    void ScanJob::push(Chunk chunk) {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_chunks.emplace_back(std::move(chunk));
+        }
+        m_condition.notify_all();
+    }
+
+    auto ScanJob::pop() -> Chunk {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        m_condition.wait(guard, [this] { return !m_chunks.empty(); });
+
+        Chunk chunk = std::move(m_chunks.front());
+        m_chunks.pop_front();
+        return chunk;
+    }
+
+    // Blocks until the writer has written one of the buffers
+    std::vector<SANE_Byte> ScanJob::take_buffer() {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        m_condition.wait(guard, [this] { return !m_free_buffers.empty(); });
+
+        std::vector<SANE_Byte> buffer = std::move(m_free_buffers.back());
+        m_free_buffers.pop_back();
+        return buffer;
+    }
+
+    void ScanJob::return_buffer(std::vector<SANE_Byte> buffer) {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_free_buffers.emplace_back(std::move(buffer));
+        }
+        m_condition.notify_all();
+    }
+
+    void ScanJob::writer_thread() {
+        FILE *page_file = nullptr;
+        SANE_Parameters parameters{};
+        std::experimental::filesystem::path path;
+        size_t written = 0;
+        bool failed = false;
+
+        auto close_page = [&](bool keep) {
+            if (!page_file) {
+                return;
+            }
+
+            // The height is only known for sure after the page was read, the header reserves space for it
+            if (keep && !failed && parameters.bytes_per_line > 0) {
+                std::fseek(page_file, 0, SEEK_SET);
+                std::fprintf(page_file, "%s\n%d %10zu\n", pnm_magic(parameters), parameters.pixels_per_line,
+                             written / parameters.bytes_per_line);
+            }
+
+            if (std::fclose(page_file) != 0) {
+                failed = true;
+            }
+            page_file = nullptr;
+
+            if (!keep || failed) {
+                std::experimental::filesystem::remove(path);
+            } else {
+                logger.info("Wrote page {0}", path.c_str());
+            }
+        };
+
+        while (true) {
+            Chunk chunk = pop();
+
+            switch (chunk.kind) {
+                case Chunk::Kind::BEGIN_PAGE:
+                    parameters = chunk.parameters;
+                    path = chunk.path;
+                    written = 0;
+                    failed = false;
+
+                    if (page_file = std::fopen(path.c_str(), "wb"); !page_file) {
+                        logger.critical("Couldn't create {0} {1}", path.c_str(), strerror(errno));
+                        failed = true;
+                        break;
+                    }
+
+                    std::fprintf(page_file, "%s\n%d %10d\n", pnm_magic(parameters), parameters.pixels_per_line,
+                                 std::max(parameters.lines, 0));
+                    if (parameters.depth != 1) {
+                        std::fprintf(page_file, "%d\n", parameters.depth == 16 ? 65535 : 255);
+                    }
+                    break;
+                case Chunk::Kind::DATA:
+                    // PNM stores 16 bit samples in big endian, sane in the native byte order
+                    if (parameters.depth == 16 && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) {
+                        for (size_t index = 0; index + 1 < chunk.length; index += 2) {
+                            std::swap(chunk.data[index], chunk.data[index + 1]);
+                        }
+                    }
+
+                    if (page_file && !failed &&
+                        std::fwrite(chunk.data.data(), 1, chunk.length, page_file) != chunk.length) {
+                        logger.critical("Couldn't write {0} {1}", path.c_str(), strerror(errno));
+                        failed = true;
+                    }
+                    written += chunk.length;
+                    return_buffer(std::move(chunk.data));
+                    break;
+                case Chunk::Kind::END_PAGE:
+                    close_page(true);
+                    break;
+                case Chunk::Kind::ABORT_PAGE:
+                    close_page(false);
+                    break;
+                case Chunk::Kind::FINISH:
+                    close_page(false);
+                    return;
+            }
+        }
+    }
+}  // namespace scanbdpp
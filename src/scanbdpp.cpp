@@ -13,11 +13,17 @@
 #include <thread>
 
 #include "cxxopts.hpp"
-#include "spdlog/spdlog.h"
 
 #include "config.h"
 #include "daemonize.h"
+#include "event_server.h"
+#include "isolation.h"
+#include "launcher.h"
+#include "logging.h"
+#include "metrics.h"
+#include "output.h"
 #include "pipe.h"
+#include "plugin.h"
 #include "run_configuration.h"
 #include "sane.h"
 #include "signal_handler.h"
@@ -35,6 +41,7 @@ int main(int argc, char *argv[]) {
     signals.install();
 
     RunConfiguration run_config;
+    int worker_socket = -1;
 
     cxxopts::Options options("scanbd", "scanbd is a scanner button daemon");
 
@@ -47,6 +54,9 @@ int main(int argc, char *argv[]) {
         ("c,config", "provide custom config file", cxxopts::value<std::string>())
         ("t,trigger", "which device to trigger (use in combination with action)", cxxopts::value<std::string>())
         ("a,action", "which action to use", cxxopts::value<std::string>())
+        ("status", "print the polled and idle devices of the running daemon")
+        ("trace", "dump the trace of the running daemon (needs trace = true)")
+        ("worker", "poll the devices sent over this socket (started by scanbd with isolation)", cxxopts::value<int>())
         ("h,help", "print this help menu");
     // clang-format on
 
@@ -62,6 +72,11 @@ int main(int argc, char *argv[]) {
         run_config.signal(options.count("signal"));
         run_config.foreground(options.count("foreground"));
 
+        if (options.count("worker")) {
+            run_config.worker(true);
+            worker_socket = options["worker"].as<int>();
+        }
+
         if (options.count("debug")) {
             run_config.debug(true);
             run_config.debug_level(options["debug"].as<int>());
@@ -71,6 +86,30 @@ int main(int argc, char *argv[]) {
             run_config.config_path(options["config"].as<std::string>());
         }
 
+        if (options.count("status")) {
+            PipeHandler handler;
+
+            if (auto report = handler.request_status(); report) {
+                std::cout << *report;
+                die(EXIT_SUCCESS);
+            }
+
+            std::cout << "scanbd didn't answer" << std::endl;
+            die(EXIT_FAILURE);
+        }
+
+        if (options.count("trace")) {
+            PipeHandler handler;
+
+            if (handler.request_trace()) {
+                std::cout << "Trace written to " << PipeHandler::Constants::trace_path.native() << std::endl;
+                die(EXIT_SUCCESS);
+            }
+
+            std::cout << "scanbd didn't answer" << std::endl;
+            die(EXIT_FAILURE);
+        }
+
         // TODO check if trigger or device is number for legacy support
         if (options.count("trigger") && options.count("action")) {
             PipeHandler handler;
@@ -108,21 +147,22 @@ int main(int argc, char *argv[]) {
         return (EXIT_FAILURE);
     }
 
-    if (run_config.foreground()) {
-        spdlog::stdout_color_mt("logger");
-    } else {
-        spdlog::syslog_logger("logger", "scanbd", LOG_PID);
-    }
+    Logging logging;
+    logging.start(run_config.foreground());
 
     Config config;
 
     if (!config) {
-        spdlog::get("logger")->info("Exiting scanbd");
-        spdlog::drop_all();
+        logger.info("Exiting scanbd");
+        logging.stop();
         return EXIT_FAILURE;
     }
 
     PipeHandler pipe;
+    Metrics metrics;
+    EventServer events;
+    OutputCollector output;
+    PluginExecutor plugins;
     SaneHandler sane;
     UDevHandler udev;
 
@@ -136,6 +176,25 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    logging.level(run_config.debug(), run_config.debug_level());
+
+    // Workers inherit the dropped privileges of the daemon, which started them, so they don't daemonize, write
+    // the pidfile or serve the event socket. They start their scripts without the launcher.
+    if (run_config.worker()) {
+        logging.start_async();
+        events.forward(worker_socket);
+        output.start();
+        plugins.start();
+
+        int exit_code = IsolationSupervisor::worker_main(worker_socket);
+
+        sane.stop();
+        plugins.stop();
+        output.stop();
+        logging.stop();
+        return exit_code;
+    }
+
     using namespace std::string_literals;
     if ("scanbm"s == argv[0]) {
         run_config.manager_mode(true);
@@ -160,32 +219,32 @@ int main(int argc, char *argv[]) {
 
             if (kill(scanbd_pid, SIGUSR1) < 0) {
                 // Can't send Signal
-                spdlog::get("logger")->critical("Can't send signal to stop polling threads");
+                logger.critical("Can't send signal to stop polling threads");
                 die(EXIT_FAILURE);
             }
 
             std::this_thread::sleep_for(std::chrono::seconds(1));
         } else {
-            spdlog::get("logger")->critical("Dbus is not supported");
+            logger.critical("Dbus is not supported");
             die(EXIT_FAILURE);
         }
 
         if (pid_t spid = fork(); spid < 0) {
-            spdlog::get("logger")->critical("Couldn't fork");
+            logger.critical("Couldn't fork");
             die(EXIT_FAILURE);
         } else if (spid > 0) {
             int status = 0;
 
             if (waitpid(spid, &status, 0) < 0) {
-                spdlog::get("logger")->critical("Waiting for saned failed");
+                logger.critical("Waiting for saned failed");
                 die(EXIT_FAILURE);
             }
 
             if (WIFEXITED(status)) {
-                spdlog::get("logger")->info("Sane exited normally");
+                logger.info("Sane exited normally");
             }
             if (WIFSIGNALED(status)) {
-                spdlog::get("logger")->info("Sane exited due to signal");
+                logger.info("Sane exited due to signal");
             }
 
             if (run_config.signal()) {
@@ -195,11 +254,11 @@ int main(int argc, char *argv[]) {
                 if (scanbd_pid > 0) {
                     if (kill(scanbd_pid, SIGUSR2) < 0) {
                         // Can't send signal
-                        spdlog::get("logger")->critical("Can't send signal to start polling threads");
+                        logger.critical("Can't send signal to start polling threads");
                     }
                 }
             } else {
-                spdlog::get("logger")->critical("Dbus is not supported");
+                logger.critical("Dbus is not supported");
                 die(EXIT_FAILURE);
             }
         } else {
@@ -208,13 +267,13 @@ int main(int argc, char *argv[]) {
                 value) {
                 saned = value->value();
             } else {
-                spdlog::get("logger")->critical("Path to saned is not set");
+                logger.critical("Path to saned is not set");
                 die(EXIT_FAILURE);
             }
             if (getenv("LISTEND_PID") != nullptr) {
                 std::string listen_fds = std::to_string((long)getpid());
                 setenv("LISTEN_PID", listen_fds.c_str(), 1);
-                spdlog::get("logger")->info("Systemd detected: Updating LISTEN_PID env. variable");
+                logger.info("Systemd detected: Updating LISTEN_PID env. variable");
             }
 
             if (auto env_list =
@@ -227,21 +286,21 @@ int main(int argc, char *argv[]) {
                     std::string value;
                     if (std::getline(env_stream, variable, '=') && std::getline(env_stream, value, '=')) {
                         if (setenv(variable.c_str(), value.c_str(), 1) < 0) {
-                            spdlog::get("logger")->critical("Couldn't set environment variable");
+                            logger.critical("Couldn't set environment variable");
                         } else {
-                            spdlog::get("logger")->info("Environment variable were updated");
+                            logger.info("Environment variable were updated");
                         }
                     } else {
-                        spdlog::get("logger")->warn("Malformed environment variables in config file");
+                        logger.warn("Malformed environment variables in config file");
                     }
                 }
             }
 
             if (setsid() < 0) {
-                spdlog::get("logger")->critical("Error setting process id group {0}", strerror(errno));
+                logger.critical("Error setting process id group {0}", strerror(errno));
             }
             if (execl(saned.c_str(), "saned", nullptr) < 0) {
-                spdlog::get("logger")->critical("execl with saned failed");
+                logger.critical("execl with saned failed");
                 die(EXIT_FAILURE);
             }
 
@@ -249,7 +308,7 @@ int main(int argc, char *argv[]) {
         }
     } else {
         if (!run_config.foreground()) {
-            spdlog::get("logger")->info("Daemonizing scanbd");
+            logger.info("Daemonizing scanbd");
             if (!daemonize()) {
                 return EXIT_FAILURE;
             }
@@ -266,29 +325,29 @@ int main(int argc, char *argv[]) {
 
         using namespace std::string_literals;
         if (euser == ""s || egroup == ""s) {
-            spdlog::get("logger")->critical("No user or group defined");
+            logger.critical("No user or group defined");
         }
 
-        spdlog::get("logger")->info("Dropping privileges to uid");
+        logger.info("Dropping privileges to uid");
         struct passwd *pwd = getpwnam(euser.c_str());
 
         if (pwd == nullptr) {
             if (errno != 0) {
-                spdlog::get("logger")->critical("No user {0} {1}", euser, strerror(errno));
+                logger.critical("No user {0} {1}", euser, strerror(errno));
             } else {
-                spdlog::get("logger")->critical("No user {0}", euser);
+                logger.critical("No user {0}", euser);
             }
             die(EXIT_FAILURE);
         }
 
-        spdlog::get("logger")->info("Dropping privileges to gid");
+        logger.info("Dropping privileges to gid");
         struct group *grp = getgrnam(egroup.c_str());
 
         if (grp == nullptr) {
             if (errno != 0) {
-                spdlog::get("logger")->critical("No group {0} {1}", egroup, strerror(errno));
+                logger.critical("No group {0} {1}", egroup, strerror(errno));
             } else {
-                spdlog::get("logger")->critical("No group {0}", egroup);
+                logger.critical("No group {0}", egroup);
             }
             die(EXIT_FAILURE);
         }
@@ -304,65 +363,81 @@ int main(int argc, char *argv[]) {
                 open(scanbd_pid_path.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 
             if (pid_fd < 0) {
-                spdlog::get("logger")->critical("Couldn't create pidfile {0}", strerror(errno));
+                logger.critical("Couldn't create pidfile {0}", strerror(errno));
                 die(EXIT_FAILURE);
             }
 
             if (ftruncate(pid_fd, 0) < 0) {
-                spdlog::get("logger")->critical("Couldn't clear pidfile {0}", strerror(errno));
+                logger.critical("Couldn't clear pidfile {0}", strerror(errno));
                 die(EXIT_FAILURE);
             }
             std::string pid_string = std::to_string(getpid());
             if (write(pid_fd, pid_string.c_str(), pid_string.size()) < 0) {
-                spdlog::get("logger")->critical("Couldn't write to pidfile {0}", strerror(errno));
+                logger.critical("Couldn't write to pidfile {0}", strerror(errno));
                 die(EXIT_FAILURE);
             }
 
             if (close(pid_fd) < 0) {
-                spdlog::get("logger")->critical("Couldn't close pidfile {0}", strerror(errno));
+                logger.critical("Couldn't close pidfile {0}", strerror(errno));
                 die(EXIT_FAILURE);
             }
 
             if (chown(scanbd_pid_path.c_str(), pwd->pw_uid, grp->gr_gid) < 0) {
-                spdlog::get("logger")->critical("Couldn't chown pidfile {0}", strerror(errno));
+                logger.critical("Couldn't chown pidfile {0}", strerror(errno));
                 die(EXIT_FAILURE);
             }
         }
 
+        // The launcher has to be forked before any thread is started and before sane is initialized
+        Launcher launcher;
+        if (auto value = config.get<Option<bool>>(Config::Constants::global / Config::Constants::launcher);
+            value && value->value()) {
+            if (!launcher.start(pwd->pw_uid, grp->gr_gid)) {
+                logger.warn("Starting scripts without launcher");
+            }
+        }
+
         if (grp != nullptr) {
             unsigned int index = 0;
             while (grp->gr_mem[index]) {
                 if (index == 0) {
-                    spdlog::get("logger")->info("Group {0} has member : ", grp->gr_name);
+                    logger.info("Group {0} has member : ", grp->gr_name);
                 }
-                spdlog::get("logger")->info("{0}", grp->gr_mem[index]);
+                logger.info("{0}", grp->gr_mem[index]);
                 ++index;
             }
-            spdlog::get("logger")->info("Dropping privileges to gid: {0}", grp->gr_gid);
+            logger.info("Dropping privileges to gid: {0}", grp->gr_gid);
             if (setegid(grp->gr_gid) < 0) {
-                spdlog::get("logger")->warn("Couldn't set the effective gid to {0}", grp->gr_gid);
+                logger.warn("Couldn't set the effective gid to {0}", grp->gr_gid);
             } else {
-                spdlog::get("logger")->info("Running as effective gid {0}", grp->gr_gid);
+                logger.info("Running as effective gid {0}", grp->gr_gid);
             }
         }
 
         if (pwd != nullptr) {
-            spdlog::get("logger")->info("Dropping privileges to uid: {0}", pwd->pw_uid);
+            logger.info("Dropping privileges to uid: {0}", pwd->pw_uid);
             if (seteuid(pwd->pw_uid) < 0) {
                 setgroups(0, nullptr);
-                spdlog::get("logger")->warn("Couldn't set effective uid to {0}", pwd->pw_uid);
+                logger.warn("Couldn't set effective uid to {0}", pwd->pw_uid);
             } else {
-                spdlog::get("logger")->info("Running as effective uid {0}", grp->gr_gid);
+                logger.info("Running as effective uid {0}", grp->gr_gid);
             }
         }
 
         if (getenv("SANE_CONFIG_DIR") != nullptr) {
             // SANE_CONFIG_DIR = (SANE_CONFIG_DIR)
         } else {
-            spdlog::get("logger")->warn("SANE_CONFIG_DIR not set");
+            logger.warn("SANE_CONFIG_DIR not set");
         }
 
+        // Nothing forks and logs in the child anymore
+        logging.start_async();
+
         if (!signals.should_exit()) {
+            events.start();
+            metrics.start();
+            output.start();
+            plugins.start();
             sane.start();
             udev.start();
             pipe.start();
@@ -373,14 +448,19 @@ int main(int argc, char *argv[]) {
                 sane.stop();
                 udev.stop();
                 pipe.stop();
-                spdlog::get("logger")->info("Exiting scanbd");
-                spdlog::drop_all();
+                plugins.stop();
+                metrics.stop();
+                events.stop();
+                output.stop();
+                launcher.stop();
+                logger.info("Exiting scanbd");
+                logging.stop();
                 return EXIT_SUCCESS;
             }
 
             if (pause() < 0) {
                 if (errno != EINTR) {
-                    spdlog::get("logger")->warn("pause() error {0}", strerror(errno));
+                    logger.warn("pause() error {0}", strerror(errno));
                 }
             }
         }
@@ -0,0 +1,497 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <grp.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+// clang-format on
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "config.h"
+#include "launcher.h"
+#include "logging.h"
+#include "output.h"
+#include "script.h"
+#include "trace.h"
+
+namespace scanbdpp {
+
+    Script::Script(const std::experimental::filesystem::path &script_path, int fd) : m_path(script_path), m_fd(fd) {}
+
+    Script::~Script() {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    void Script::invalidate() { m_valid = false; }
+
+    bool Script::valid() const { return m_valid; }
+
+    int Script::fd() const { return m_fd; }
+
+    const std::experimental::filesystem::path &Script::path() const { return m_path; }
+
+    namespace {
+        // The names are resolved when the config is loaded, so the launcher only gets numbers
+        void read_script_credentials(const confusepp::Section &section, ScriptLimits &limits) {
+            if (auto user = section.get<confusepp::Option<std::string>>(Config::Constants::user);
+                user && !user->value().empty()) {
+                if (passwd *pwd = getpwnam(user->value().c_str()); pwd) {
+                    limits.uid = pwd->pw_uid;
+                } else {
+                    logger.critical("No user {0}, the script runs as the daemon user", user->value());
+                }
+            }
+
+            if (auto group = section.get<confusepp::Option<std::string>>(Config::Constants::group);
+                group && !group->value().empty()) {
+                if (struct group *grp = getgrnam(group->value().c_str()); grp) {
+                    limits.gid = grp->gr_gid;
+                } else {
+                    logger.critical("No group {0}, the script runs with the daemon group", group->value());
+                }
+            }
+
+            if (Launcher launcher; !launcher.running() && ((limits.uid && *limits.uid != geteuid()) ||
+                                                           (limits.gid && *limits.gid != getegid()))) {
+                logger.warn("user and group of a script are only applied by the launcher, they are ignored");
+            }
+        }
+    }  // namespace
+
+    ScriptLimits read_script_limits(const confusepp::Section &section) {
+        ScriptLimits limits;
+        limits.kill_delay = std::chrono::milliseconds(Config::Constants::kill_delay_def);
+        limits.ionice_level = Config::Constants::ionice_level_def;
+
+        if (auto deadline = section.get<confusepp::Option<int>>(Config::Constants::deadline); deadline) {
+            limits.deadline = std::chrono::milliseconds(std::max(deadline->value(), 0));
+        }
+
+        read_script_credentials(section, limits);
+
+        auto limits_section = section.get<confusepp::Section>(Config::Constants::limits);
+
+        if (!limits_section) {
+            return limits;
+        }
+
+        if (auto kill_delay = limits_section->get<confusepp::Option<int>>(Config::Constants::kill_delay); kill_delay) {
+            limits.kill_delay = std::chrono::milliseconds(std::max(kill_delay->value(), 0));
+        }
+
+        // The address space is configured in MiB
+        if (auto address_space = limits_section->get<confusepp::Option<int>>(Config::Constants::address_space);
+            address_space && address_space->value() > 0) {
+            limits.address_space = static_cast<rlim_t>(address_space->value()) * 1024 * 1024;
+        }
+
+        if (auto cpu_time = limits_section->get<confusepp::Option<int>>(Config::Constants::cpu_time);
+            cpu_time && cpu_time->value() > 0) {
+            limits.cpu_time = cpu_time->value();
+        }
+
+        if (auto nice = limits_section->get<confusepp::Option<int>>(Config::Constants::nice); nice) {
+            limits.nice = nice->value();
+        }
+
+        if (auto ionice_class = limits_section->get<confusepp::Option<int>>(Config::Constants::ionice_class);
+            ionice_class) {
+            limits.ionice_class = ionice_class->value();
+        }
+
+        if (auto ionice_level = limits_section->get<confusepp::Option<int>>(Config::Constants::ionice_level);
+            ionice_level) {
+            limits.ionice_level = ionice_level->value();
+        }
+
+        if (auto cgroup = limits_section->get<confusepp::Option<std::string>>(Config::Constants::cgroup);
+            cgroup && !cgroup->value().empty()) {
+            limits.cgroup_procs = (std::experimental::filesystem::path(cgroup->value()) / "cgroup.procs").native();
+        }
+
+        return limits;
+    }
+
+    // Is called in the child after fork, so only async signal safe functions may be used.
+    // The poll threads block all signals and those masks would be inherited by the script otherwise.
+    void detail::exec_script(int fd, char *const argv[], char *const envp[], const Redirection *redirections,
+                             size_t redirection_count, const ScriptLimits *limits) {
+        // The script gets its own process group, so a deadline can kill everything it started
+        setpgid(0, 0);
+
+        if (limits) {
+            if (!limits->cgroup_procs.empty()) {
+                int cgroup_fd = open(limits->cgroup_procs.c_str(), O_WRONLY | O_CLOEXEC);
+
+                if (cgroup_fd < 0 || write(cgroup_fd, "0", 1) != 1) {
+                    _exit(EXIT_FAILURE);
+                }
+                close(cgroup_fd);
+            }
+
+            if (limits->address_space != RLIM_INFINITY) {
+                rlimit limit{limits->address_space, limits->address_space};
+                setrlimit(RLIMIT_AS, &limit);
+            }
+
+            // SIGXCPU is sent at the soft limit, SIGKILL a second later
+            if (limits->cpu_time != RLIM_INFINITY) {
+                rlimit limit{limits->cpu_time, limits->cpu_time + 1};
+                setrlimit(RLIMIT_CPU, &limit);
+            }
+
+            if (limits->nice != 0) {
+                setpriority(PRIO_PROCESS, 0, limits->nice);
+            }
+
+            // There is no glibc wrapper for ioprio_set, 1 is IOPRIO_WHO_PROCESS
+            if (limits->ionice_class != 0) {
+                syscall(SYS_ioprio_set, 1, 0, (limits->ionice_class << 13) | limits->ionice_level);
+            }
+        }
+
+        // Move the script and the sources out of the way first, so none of them can be overwritten by a target
+        int sources[16];
+        redirection_count = std::min(redirection_count, sizeof(sources) / sizeof(int));
+        if (redirection_count > 0 && (fd = fcntl(fd, F_DUPFD_CLOEXEC, 64)) < 0) {
+            _exit(EXIT_FAILURE);
+        }
+
+        for (size_t index = 0; index < redirection_count; ++index) {
+            sources[index] = fcntl(redirections[index].from, F_DUPFD_CLOEXEC, 64);
+        }
+
+        for (size_t index = 0; index < redirection_count; ++index) {
+            if (sources[index] < 0 || dup2(sources[index], redirections[index].to) < 0) {
+                _exit(EXIT_FAILURE);
+            }
+        }
+
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, nullptr);
+
+        for (int current_signal = 1; current_signal < NSIG; ++current_signal) {
+            signal(current_signal, SIG_DFL);
+        }
+
+        fexecve(fd, argv, envp);
+
+        // The interpreter of a #! script opens the script through /dev/fd, which fails with ENOENT for a
+        // close-on-exec descriptor. Only then the descriptor is passed on.
+        if (errno == ENOENT) {
+            fcntl(fd, F_SETFD, 0);
+            fexecve(fd, argv, envp);
+        }
+        _exit(EXIT_FAILURE);
+    }
+
+    // After the deadline the process group gets SIGTERM and after the kill delay SIGKILL
+    ScriptResult detail::supervise_script(pid_t pid, const ScriptLimits &limits, const ChildWaiter &wait) {
+        ScriptResult result;
+
+        if (limits.deadline.count() <= 0) {
+            wait(std::chrono::milliseconds(-1), result.status);
+            return result;
+        }
+
+        if (wait(limits.deadline, result.status)) {
+            return result;
+        }
+
+        result.timed_out = true;
+        kill(-pid, SIGTERM);
+
+        if (wait(limits.kill_delay, result.status)) {
+            return result;
+        }
+
+        result.killed = true;
+        kill(-pid, SIGKILL);
+        wait(std::chrono::milliseconds(-1), result.status);
+
+        return result;
+    }
+
+    ScriptResult Script::run(char *const envp[], const ScriptLimits &limits,
+                             const std::vector<Redirection> &redirections, std::string_view label) const {
+        ScriptResult result;
+
+        OutputCapture capture;
+        std::vector<Redirection> all_redirections = redirections;
+        capture.add_redirections(all_redirections);
+
+        std::string output_label = label.empty() ? m_path.filename().native() : std::string(label);
+        auto started = [&capture, &output_label](pid_t pid) { capture.started(output_label, pid); };
+
+        if (Launcher launcher; launcher.running()) {
+            result = launcher.run(*this, envp, limits, all_redirections, started);
+        } else {
+            char *const argv[] = {const_cast<char *>(m_path.c_str()), nullptr};
+
+            [[maybe_unused]] auto fork_start = std::chrono::steady_clock::now();
+            pid_t cpid = fork();
+
+            if (cpid < 0) {
+                logger.critical("Can't fork {0}", strerror(errno));
+                return {};
+            } else if (cpid == 0) {
+                detail::exec_script(m_fd, argv, envp, all_redirections.data(), all_redirections.size(), &limits);
+            }
+
+#ifdef SCANBDPP_TRACING
+            // Not a scoped span, the child must not record (the first span of a thread takes a lock)
+            if (Tracer tracer; tracer.enabled()) {
+                tracer.record("fork", fork_start, std::chrono::steady_clock::now());
+            }
+#endif
+
+            // Set it in the parent as well, otherwise an early kill could miss the group
+            setpgid(cpid, cpid);
+            started(cpid);
+
+            logger.info("Waiting for child {0}", m_path.c_str());
+
+#ifdef SYS_pidfd_open
+            int pid_fd = syscall(SYS_pidfd_open, cpid, 0);
+#else
+            int pid_fd = -1;
+#endif
+
+            result = detail::supervise_script(cpid, limits, [this, cpid, pid_fd](auto timeout, auto &status) {
+                // Without pidfds (before Linux 5.3) the child is polled
+                if (timeout.count() >= 0 && pid_fd >= 0) {
+                    pollfd pid_poll{pid_fd, POLLIN, 0};
+                    int ready;
+                    while ((ready = poll(&pid_poll, 1, timeout.count())) < 0 && errno == EINTR) {
+                    }
+
+                    if (ready == 0) {
+                        return false;
+                    }
+                } else if (timeout.count() >= 0) {
+                    auto end = std::chrono::steady_clock::now() + timeout;
+
+                    for (int wait_status = 0;;) {
+                        if (pid_t pid = waitpid(cpid, &wait_status, WNOHANG); pid == cpid) {
+                            status = wait_status;
+                            return true;
+                        } else if (pid < 0 && errno != EINTR) {
+                            logger.critical("waitpid: {0}", m_path.c_str());
+                            return true;
+                        } else if (std::chrono::steady_clock::now() >= end) {
+                            return false;
+                        }
+
+                        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                    }
+                }
+
+                int wait_status = 0;
+                while (waitpid(cpid, &wait_status, 0) < 0) {
+                    if (errno != EINTR) {
+                        logger.critical("waitpid: {0}", m_path.c_str());
+                        return true;
+                    }
+                }
+
+                status = wait_status;
+                return true;
+            });
+
+            if (pid_fd >= 0) {
+                close(pid_fd);
+            }
+        }
+
+        if (result.timed_out) {
+            logger.warn("Child {0} exceeded its deadline of {1} ms{2}", m_path.c_str(), limits.deadline.count(),
+                        result.killed ? " and was killed" : "");
+        }
+
+        if (!result.status) {
+            return result;
+        }
+
+        if (WIFEXITED(*result.status)) {
+            logger.info("Child {0} exited with status: {1}", m_path.c_str(), WEXITSTATUS(*result.status));
+        }
+
+        if (WIFSIGNALED(*result.status)) {
+            logger.info("Child {0} signaled with signal: {1}", m_path.c_str(), WTERMSIG(*result.status));
+        }
+
+        return result;
+    }
+
+    std::shared_ptr<Script> ScriptRegistry::resolve(const std::experimental::filesystem::path &script_path) {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+
+        Config config;
+        if (_config_generation != config.generation()) {
+            _scripts.clear();
+            _config_generation = config.generation();
+        }
+
+        process_changes();
+
+        auto absolute_path = make_script_path_absolute(script_path);
+
+        if (auto script = _scripts.find(absolute_path); script != _scripts.end()) {
+            return script->second;
+        }
+
+        int fd = open_script(absolute_path);
+
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        watch(absolute_path.parent_path());
+
+        auto script = std::make_shared<Script>(absolute_path, fd);
+        _scripts.emplace(absolute_path, script);
+
+        return script;
+    }
+
+    // Only reads pending events of the directory watches, this doesn't touch any of the scripts
+    void ScriptRegistry::update() {
+        std::lock_guard<std::recursive_mutex> guard(_instance_mutex);
+        process_changes();
+    }
+
+    int ScriptRegistry::open_script(const std::experimental::filesystem::path &absolute_path) {
+        int fd = open(absolute_path.c_str(), O_PATH | O_CLOEXEC);
+
+        if (fd < 0) {
+            logger.critical("Couldn't open script {0} {1}", absolute_path.c_str(), strerror(errno));
+            return -1;
+        }
+
+        struct stat script_stat;
+
+        if (fstat(fd, &script_stat) < 0) {
+            logger.critical("Couldn't stat script {0} {1}", absolute_path.c_str(), strerror(errno));
+            close(fd);
+            return -1;
+        }
+
+        if (!S_ISREG(script_stat.st_mode)) {
+            logger.critical("Script {0} is not a regular file", absolute_path.c_str());
+            close(fd);
+            return -1;
+        }
+
+        if (faccessat(AT_FDCWD, absolute_path.c_str(), X_OK, AT_EACCESS) < 0) {
+            logger.critical("Script {0} is not executable", absolute_path.c_str());
+            close(fd);
+            return -1;
+        }
+
+        if (script_stat.st_mode & S_IWOTH) {
+            logger.critical("Script {0} is writable by everyone, refusing to use it", absolute_path.c_str());
+            close(fd);
+            return -1;
+        }
+
+        if (script_stat.st_uid != 0 && script_stat.st_uid != geteuid()) {
+            logger.critical("Script {0} is owned by uid {1}, not by root or the daemon user, refusing to use it",
+                            absolute_path.c_str(), script_stat.st_uid);
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    void ScriptRegistry::watch(const std::experimental::filesystem::path &directory) {
+        if (_inotify_fd < 0) {
+            _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+            if (_inotify_fd < 0) {
+                logger.warn("Couldn't watch script directories {0}", strerror(errno));
+                return;
+            }
+        }
+
+        int wd = inotify_add_watch(_inotify_fd, directory.c_str(),
+                                   IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE |
+                                       IN_DELETE_SELF | IN_MOVE_SELF);
+
+        if (wd < 0) {
+            logger.warn("Couldn't watch script directory {0} {1}", directory.c_str(), strerror(errno));
+            return;
+        }
+
+        _watches[wd] = directory;
+    }
+
+    void ScriptRegistry::process_changes() {
+        if (_inotify_fd < 0) {
+            return;
+        }
+
+        alignas(inotify_event) char buf[4096];
+
+        while (true) {
+            ssize_t length = read(_inotify_fd, buf, sizeof(buf));
+
+            if (length <= 0) {
+                break;
+            }
+
+            for (char *current = buf; current < buf + length;) {
+                auto event = reinterpret_cast<const inotify_event *>(current);
+                current += sizeof(inotify_event) + event->len;
+
+                auto directory = _watches.find(event->wd);
+
+                if (directory == _watches.end()) {
+                    continue;
+                }
+
+                // The whole directory is gone, so every script in it has to be resolved again
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    for (auto script = _scripts.begin(); script != _scripts.end();) {
+                        if (script->first.parent_path() == directory->second) {
+                            logger.info("Script {0} has changed", script->first.c_str());
+                            script->second->invalidate();
+                            script = _scripts.erase(script);
+                        } else {
+                            ++script;
+                        }
+                    }
+
+                    if (event->mask & IN_IGNORED) {
+                        _watches.erase(directory);
+                    }
+                    continue;
+                }
+
+                if (event->len == 0) {
+                    continue;
+                }
+
+                if (auto script = _scripts.find(directory->second / event->name); script != _scripts.end()) {
+                    logger.info("Script {0} has changed", script->first.c_str());
+                    script->second->invalidate();
+                    _scripts.erase(script);
+                }
+            }
+        }
+    }
+}  // namespace scanbdpp
@@ -62,6 +62,11 @@ namespace scanbdpp {
             exit(EXIT_FAILURE);
         }
 
+        // Writes to a worker or a client, which went away, fail with EPIPE instead of killing the daemon
+        if (install_signal(SIGPIPE, SIG_IGN, {}) < 0) {
+            exit(EXIT_FAILURE);
+        }
+
         _installed_signal_handlers = true;
     }
 
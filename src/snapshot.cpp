@@ -0,0 +1,134 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <sys/mman.h>
+// clang-format on
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <variant>
+
+#include "logging.h"
+#include "snapshot.h"
+
+namespace scanbdpp {
+
+    // Groups and buttons don't have a value, so they are not part of the snapshot
+    void OptionSnapshot::add(std::string_view name, const OptionValue &value) {
+        std::visit(
+            [this, name](const auto &current_value) {
+                using type = std::decay_t<decltype(current_value)>;
+                char buf[64];
+
+                if constexpr (std::is_same_v<type, int>) {
+                    m_data += "{\"name\":";
+                    detail::append_json_string(m_data, name);
+                    m_data += ",\"type\":\"int\",\"value\":";
+                    m_data.append(buf, std::to_chars(buf, buf + sizeof(buf), current_value).ptr - buf);
+                    m_data += "}\n";
+                } else if constexpr (std::is_same_v<type, sanepp::Fixed>) {
+                    m_data += "{\"name\":";
+                    detail::append_json_string(m_data, name);
+                    m_data += ",\"type\":\"fixed\",\"value\":";
+                    int written = std::snprintf(buf, sizeof(buf), "%f", current_value.value());
+                    m_data.append(buf, written < 0 ? 0 : std::min(static_cast<size_t>(written), sizeof(buf) - 1));
+                    m_data += "}\n";
+                } else if constexpr (std::is_same_v<type, bool>) {
+                    m_data += "{\"name\":";
+                    detail::append_json_string(m_data, name);
+                    m_data += ",\"type\":\"bool\",\"value\":";
+                    m_data += current_value ? "true" : "false";
+                    m_data += "}\n";
+                } else if constexpr (std::is_same_v<type, std::string>) {
+                    m_data += "{\"name\":";
+                    detail::append_json_string(m_data, name);
+                    m_data += ",\"type\":\"string\",\"value\":";
+                    detail::append_json_string(m_data, current_value);
+                    m_data += "}\n";
+                } else if constexpr (std::is_same_v<type, WordArray>) {
+                    m_data += "{\"name\":";
+                    detail::append_json_string(m_data, name);
+                    m_data += current_value.type == SANE_TYPE_FIXED  ? ",\"type\":\"fixed[]\",\"value\":["
+                              : current_value.type == SANE_TYPE_BOOL ? ",\"type\":\"bool[]\",\"value\":["
+                                                                     : ",\"type\":\"int[]\",\"value\":[";
+
+                    for (size_t index = 0; index < current_value.words.size(); ++index) {
+                        if (index) {
+                            m_data += ',';
+                        }
+
+                        if (current_value.type == SANE_TYPE_FIXED) {
+                            int written = std::snprintf(buf, sizeof(buf), "%f", current_value.element(index));
+                            m_data.append(buf,
+                                          written < 0 ? 0 : std::min(static_cast<size_t>(written), sizeof(buf) - 1));
+                        } else if (current_value.type == SANE_TYPE_BOOL) {
+                            m_data += current_value.words[index] ? "true" : "false";
+                        } else {
+                            m_data.append(
+                                buf, std::to_chars(buf, buf + sizeof(buf), current_value.words[index]).ptr - buf);
+                        }
+                    }
+
+                    m_data += "]}\n";
+                }
+            },
+            value);
+    }
+
+    void detail::append_json_string(std::string &data, std::string_view value) {
+        data += '"';
+
+        for (char current : value) {
+            if (current == '"' || current == '\\') {
+                data += '\\';
+                data += current;
+            } else if (static_cast<unsigned char>(current) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", current);
+                data += buf;
+            } else {
+                data += current;
+            }
+        }
+
+        data += '"';
+    }
+
+    // Returns a read only descriptor positioned at the start of the snapshot or -1 on failure
+    int OptionSnapshot::seal() const {
+        int fd = memfd_create("scanbd-options", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+        if (fd < 0) {
+            logger.warn("Couldn't create option snapshot {0}", strerror(errno));
+            return -1;
+        }
+
+        for (size_t written = 0; written < m_data.size();) {
+            ssize_t length = write(fd, m_data.data() + written, m_data.size() - written);
+
+            if (length < 0 && errno == EINTR) {
+                continue;
+            } else if (length <= 0) {
+                logger.warn("Couldn't write option snapshot {0}", strerror(errno));
+                close(fd);
+                return -1;
+            }
+
+            written += length;
+        }
+
+        if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0 ||
+            lseek(fd, 0, SEEK_SET) < 0) {
+            logger.warn("Couldn't seal option snapshot {0}", strerror(errno));
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    size_t OptionSnapshot::size() const { return m_data.size(); }
+}  // namespace scanbdpp
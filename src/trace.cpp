@@ -0,0 +1,140 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+// clang-format on
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "logging.h"
+#include "snapshot.h"
+#include "trace.h"
+
+namespace scanbdpp {
+    Tracer::RingOwner::~RingOwner() {
+        if (ring) {
+            ring->in_use.store(false, std::memory_order_release);
+        }
+    }
+
+    void Tracer::enable(bool enabled) const {
+        if (_enabled.exchange(enabled, std::memory_order_relaxed) != enabled) {
+            logger.info("Tracing {0}", enabled ? "enabled" : "disabled");
+        }
+    }
+
+    // Only the first span of a thread takes the lock to get its ring
+    auto Tracer::ring() -> Ring & {
+        thread_local RingOwner owner;
+
+        if (!owner.ring) {
+            std::lock_guard<std::mutex> guard(_rings_mutex);
+
+            for (const auto &current_ring : _rings) {
+                bool in_use = false;
+
+                if (current_ring->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire)) {
+                    owner.ring = current_ring;
+                    break;
+                }
+            }
+
+            if (!owner.ring) {
+                owner.ring = std::make_shared<Ring>();
+                _rings.push_back(owner.ring);
+            }
+
+            owner.ring->thread_id.store(syscall(SYS_gettid), std::memory_order_relaxed);
+        }
+
+        return *owner.ring;
+    }
+
+    void Tracer::record(const char *name, std::chrono::steady_clock::time_point start,
+                        std::chrono::steady_clock::time_point end) const {
+        auto &current_ring = ring();
+        uint64_t index = current_ring.head.load(std::memory_order_relaxed);
+        auto &entry = current_ring.entries[index % Constants::ring_size];
+
+        entry.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        entry.name.store(name, std::memory_order_relaxed);
+        entry.start.store(std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count(),
+                          std::memory_order_relaxed);
+        entry.duration.store(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                             std::memory_order_relaxed);
+
+        entry.sequence.store(index + 1, std::memory_order_release);
+        current_ring.head.store(index + 1, std::memory_order_release);
+    }
+
+    // Entries, which are overwritten while they are copied, are skipped. The file is replaced atomically.
+    bool Tracer::dump(const std::experimental::filesystem::path &path) const {
+        std::vector<std::shared_ptr<Ring>> rings;
+        {
+            std::lock_guard<std::mutex> guard(_rings_mutex);
+            rings = _rings;
+        }
+
+        std::string data = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        char buf[128];
+        auto pid = getpid();
+
+        for (const auto &current_ring : rings) {
+            auto thread_id = current_ring->thread_id.load(std::memory_order_relaxed);
+            uint64_t head = current_ring->head.load(std::memory_order_acquire);
+
+            for (uint64_t index = head > Constants::ring_size ? head - Constants::ring_size : 0; index < head;
+                 ++index) {
+                auto &entry = current_ring->entries[index % Constants::ring_size];
+
+                if (entry.sequence.load(std::memory_order_acquire) != index + 1) {
+                    continue;
+                }
+
+                const char *name = entry.name.load(std::memory_order_relaxed);
+                int64_t start = entry.start.load(std::memory_order_relaxed);
+                int64_t duration = entry.duration.load(std::memory_order_relaxed);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (entry.sequence.load(std::memory_order_relaxed) != index + 1) {
+                    continue;
+                }
+
+                data += first ? "{\"name\":" : ",\n{\"name\":";
+                first = false;
+                detail::append_json_string(data, name);
+                std::snprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                              start / 1e3, duration / 1e3, static_cast<int>(pid), static_cast<int>(thread_id));
+                data += buf;
+            }
+        }
+
+        data += "]}\n";
+
+        std::string temporary_path = path.native() + ".tmp";
+        int trace_fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+        if (trace_fd < 0) {
+            logger.warn("Couldn't create trace file {0}", strerror(errno));
+            return false;
+        }
+
+        bool written = write(trace_fd, data.c_str(), data.size()) == static_cast<ssize_t>(data.size());
+        close(trace_fd);
+
+        if (!written || rename(temporary_path.c_str(), path.c_str()) < 0) {
+            logger.warn("Couldn't write trace file {0}", strerror(errno));
+            unlink(temporary_path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+}  // namespace scanbdpp
@@ -0,0 +1,457 @@
+#include <cctype>
+#include <cstdlib>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "config.h"
+#include "logging.h"
+#include "trigger.h"
+
+namespace scanbdpp {
+    namespace {
+        struct Token {
+            enum struct Kind { WORD, NUMBER, STRING, OPERATOR, WILDCARD };
+
+            Kind kind;
+            std::string text;
+            double number = 0;
+        };
+
+        std::optional<std::vector<Token>> tokenize(std::string_view expression) {
+            std::vector<Token> tokens;
+
+            for (size_t index = 0; index < expression.size();) {
+                char current = expression[index];
+                char next = index + 1 < expression.size() ? expression[index + 1] : '\0';
+
+                if (std::isspace(static_cast<unsigned char>(current))) {
+                    ++index;
+                } else if (current == '"') {
+                    // Only \" and \\ are escapes, everything else is part of the regular expression
+                    std::string text;
+                    for (++index; index < expression.size() && expression[index] != '"'; ++index) {
+                        if (expression[index] == '\\' && index + 1 < expression.size() &&
+                            (expression[index + 1] == '"' || expression[index + 1] == '\\')) {
+                            ++index;
+                        }
+                        text += expression[index];
+                    }
+
+                    if (index++ >= expression.size()) {
+                        return {};
+                    }
+                    tokens.push_back({Token::Kind::STRING, std::move(text)});
+                } else if (std::isdigit(static_cast<unsigned char>(current)) ||
+                           ((current == '-' || current == '+' || current == '.') &&
+                            std::isdigit(static_cast<unsigned char>(next)))) {
+                    size_t start = index++;
+                    while (index < expression.size() &&
+                           (std::isdigit(static_cast<unsigned char>(expression[index])) ||
+                            (expression[index] == '.' && index + 1 < expression.size() &&
+                             std::isdigit(static_cast<unsigned char>(expression[index + 1]))))) {
+                        ++index;
+                    }
+
+                    std::string text(expression.substr(start, index - start));
+                    tokens.push_back({Token::Kind::NUMBER, text, std::strtod(text.c_str(), nullptr)});
+                } else if (std::isalpha(static_cast<unsigned char>(current))) {
+                    size_t start = index;
+                    while (index < expression.size() && std::isalpha(static_cast<unsigned char>(expression[index]))) {
+                        ++index;
+                    }
+                    tokens.push_back({Token::Kind::WORD, std::string(expression.substr(start, index - start))});
+                } else if (current == '*') {
+                    ++index;
+                    tokens.push_back({Token::Kind::WILDCARD, "*"});
+                } else {
+                    static const char *const operators[] = {"==", "!=", "<=", ">=", "->", "..", "<", ">"};
+                    bool found = false;
+
+                    for (const char *current_operator : operators) {
+                        if (expression.substr(index).substr(0, std::char_traits<char>::length(current_operator)) ==
+                            current_operator) {
+                            tokens.push_back({Token::Kind::OPERATOR, current_operator});
+                            index += std::char_traits<char>::length(current_operator);
+                            found = true;
+                            break;
+                        }
+                    }
+
+                    if (!found) {
+                        return {};
+                    }
+                }
+            }
+
+            return tokens;
+        }
+
+        std::optional<double> numeric_value(const OptionValue &value) {
+            return std::visit(
+                [](const auto &current_value) -> std::optional<double> {
+                    using type = std::decay_t<decltype(current_value)>;
+
+                    if constexpr (std::is_same_v<type, int> || std::is_same_v<type, bool>) {
+                        return static_cast<double>(current_value);
+                    } else if constexpr (std::is_same_v<type, sanepp::Fixed>) {
+                        return current_value.value();
+                    } else {
+                        return {};
+                    }
+                },
+                value);
+        }
+    }  // namespace
+
+    TriggerCondition::TriggerCondition(Op op) : m_op(op) {}
+
+    TriggerCondition TriggerCondition::transition(double from, double to) {
+        TriggerCondition condition(Op::TRANSITION);
+        condition.m_first = from;
+        condition.m_second = to;
+        return condition;
+    }
+
+    // Throws std::regex_error, if one of the expressions is invalid
+    TriggerCondition TriggerCondition::string_transition(const std::string &from, const std::string &to) {
+        TriggerCondition condition(Op::STRING_TRANSITION);
+        condition.m_from.assign(from, std::regex_constants::extended);
+        condition.m_to.assign(to, std::regex_constants::extended);
+        return condition;
+    }
+
+    std::optional<TriggerCondition> TriggerCondition::parse(std::string_view expression) {
+        // [k] <condition> for element k of a word array
+        size_t start = expression.find_first_not_of(" \t");
+
+        if (start != std::string_view::npos && expression[start] == '[') {
+            size_t end = expression.find(']', start);
+            auto index = end != std::string_view::npos ? tokenize(expression.substr(start + 1, end - start - 1))
+                                                        : std::nullopt;
+
+            if (!index || index->size() != 1 || (*index)[0].kind != Token::Kind::NUMBER || (*index)[0].number < 0 ||
+                (*index)[0].number != static_cast<int32_t>((*index)[0].number)) {
+                return {};
+            }
+
+            auto condition = parse(expression.substr(end + 1));
+
+            if (!condition || condition->m_element >= 0) {
+                return {};
+            }
+
+            condition->m_element = static_cast<int32_t>((*index)[0].number);
+            return condition;
+        }
+
+        auto tokens = tokenize(expression);
+
+        if (!tokens || tokens->empty()) {
+            return {};
+        }
+
+        const auto &first = tokens->front();
+        auto is_operator = [&tokens](size_t index, std::string_view text) {
+            return index < tokens->size() && (*tokens)[index].kind == Token::Kind::OPERATOR &&
+                   (*tokens)[index].text == text;
+        };
+        auto is_number = [&tokens](size_t index) {
+            return index < tokens->size() && (*tokens)[index].kind == Token::Kind::NUMBER;
+        };
+
+        try {
+            if (first.kind == Token::Kind::WORD && tokens->size() == 1) {
+                if (first.text == "change") {
+                    return TriggerCondition(Op::CHANGE);
+                } else if (first.text == "rising") {
+                    return TriggerCondition(Op::RISING);
+                } else if (first.text == "falling") {
+                    return TriggerCondition(Op::FALLING);
+                }
+            } else if (first.kind == Token::Kind::WORD && first.text == "in" && tokens->size() == 4 &&
+                       is_number(1) && is_operator(2, "..") && is_number(3)) {
+                TriggerCondition condition(Op::RANGE);
+                condition.m_first = (*tokens)[1].number;
+                condition.m_second = (*tokens)[3].number;
+                return condition;
+            } else if (first.kind == Token::Kind::WORD && (first.text == "above" || first.text == "below") &&
+                       is_number(1)) {
+                TriggerCondition condition(first.text == "above" ? Op::ABOVE : Op::BELOW);
+                condition.m_first = (*tokens)[1].number;
+
+                if (tokens->size() == 2) {
+                    return condition;
+                } else if (tokens->size() == 4 && (*tokens)[2].kind == Token::Kind::WORD &&
+                           (*tokens)[2].text == "hysteresis" && is_number(3) && (*tokens)[3].number >= 0) {
+                    condition.m_second = (*tokens)[3].number;
+                    return condition;
+                }
+            } else if (first.kind == Token::Kind::OPERATOR && tokens->size() == 2) {
+                static const std::pair<const char *, Op> comparisons[] = {
+                    {"==", Op::EQUAL}, {"!=", Op::NOT_EQUAL},   {"<", Op::LESS},
+                    {"<=", Op::LESS_EQUAL}, {">", Op::GREATER}, {">=", Op::GREATER_EQUAL}};
+
+                if (first.text == "==" && (*tokens)[1].kind == Token::Kind::STRING) {
+                    TriggerCondition condition(Op::STRING_MATCH);
+                    condition.m_to.assign((*tokens)[1].text, std::regex_constants::extended);
+                    return condition;
+                }
+
+                for (const auto &[text, op] : comparisons) {
+                    if (first.text == text && is_number(1)) {
+                        TriggerCondition condition(op);
+                        condition.m_first = (*tokens)[1].number;
+                        return condition;
+                    }
+                }
+            } else if (tokens->size() == 3 && is_operator(1, "->")) {
+                const auto &from = (*tokens)[0];
+                const auto &to = (*tokens)[2];
+                auto is_numeric = [](const Token &token) {
+                    return token.kind == Token::Kind::NUMBER || token.kind == Token::Kind::WILDCARD;
+                };
+                auto is_textual = [](const Token &token) {
+                    return token.kind == Token::Kind::STRING || token.kind == Token::Kind::WILDCARD;
+                };
+
+                if (is_numeric(from) && is_numeric(to)) {
+                    TriggerCondition condition = transition(from.number, to.number);
+                    condition.m_wildcards = (from.kind == Token::Kind::WILDCARD ? 1 : 0) |
+                                            (to.kind == Token::Kind::WILDCARD ? 2 : 0);
+                    return condition;
+                } else if (is_textual(from) && is_textual(to)) {
+                    return string_transition(from.kind == Token::Kind::WILDCARD ? ".*" : from.text,
+                                             to.kind == Token::Kind::WILDCARD ? ".*" : to.text);
+                }
+            }
+        } catch (std::regex_error) {
+            return {};
+        }
+
+        return {};
+    }
+
+    bool TriggerCondition::changed(const OptionValue &previous, const OptionValue &current) {
+        if (previous.index() != current.index()) {
+            return true;
+        }
+
+        if (auto current_string = std::get_if<std::string>(&current); current_string) {
+            return std::get<std::string>(previous) != *current_string;
+        } else if (auto current_array = std::get_if<WordArray>(&current); current_array) {
+            return std::get<WordArray>(previous) != *current_array;
+        }
+
+        auto previous_number = numeric_value(previous);
+        auto current_number = numeric_value(current);
+
+        return previous_number && current_number && *previous_number != *current_number;
+    }
+
+    auto TriggerCondition::op() const -> Op { return m_op; }
+
+    // Only a numerical-trigger section with the same from-value and to-value fires for an unchanged value
+    bool TriggerCondition::fires_without_change() const {
+        return m_op == Op::TRANSITION && !m_wildcards && m_first == m_second;
+    }
+
+    bool TriggerCondition::accepts(const OptionValue &value) const {
+        if (auto array_value = std::get_if<WordArray>(&value); array_value) {
+            return m_op != Op::STRING_MATCH && m_op != Op::STRING_TRANSITION &&
+                   (m_element >= 0 ? static_cast<size_t>(m_element) < array_value->words.size()
+                                   : m_op != Op::ABOVE && m_op != Op::BELOW);
+        } else if (m_element >= 0) {
+            return false;
+        }
+
+        if (m_op == Op::CHANGE) {
+            return numeric_value(value) || std::holds_alternative<std::string>(value);
+        }
+
+        if (m_op == Op::STRING_MATCH || m_op == Op::STRING_TRANSITION) {
+            return std::holds_alternative<std::string>(value);
+        }
+
+        return numeric_value(value).has_value();
+    }
+
+    bool TriggerCondition::evaluate(const OptionValue &previous, const OptionValue &current) {
+        if (previous.index() != current.index()) {
+            return false;
+        }
+
+        if (auto current_string = std::get_if<std::string>(&current); current_string) {
+            return evaluate_string(std::get<std::string>(previous), *current_string);
+        } else if (auto current_array = std::get_if<WordArray>(&current); current_array) {
+            return evaluate_array(std::get<WordArray>(previous), *current_array);
+        }
+
+        auto previous_number = numeric_value(previous);
+        auto current_number = numeric_value(current);
+
+        return previous_number && current_number && evaluate_numeric(*previous_number, *current_number);
+    }
+
+    // Comparisons are edge triggered, they only fire when the condition wasn't true for the previous value
+    bool TriggerCondition::evaluate_numeric(double previous, double current) {
+        switch (m_op) {
+            case Op::CHANGE:
+                return previous != current;
+            case Op::RISING:
+                return current > previous;
+            case Op::FALLING:
+                return current < previous;
+            case Op::EQUAL:
+                return current == m_first && previous != m_first;
+            case Op::NOT_EQUAL:
+                return current != m_first && previous == m_first;
+            case Op::LESS:
+                return current < m_first && !(previous < m_first);
+            case Op::LESS_EQUAL:
+                return current <= m_first && !(previous <= m_first);
+            case Op::GREATER:
+                return current > m_first && !(previous > m_first);
+            case Op::GREATER_EQUAL:
+                return current >= m_first && !(previous >= m_first);
+            case Op::RANGE: {
+                bool inside = current >= m_first && current <= m_second;
+                bool was_inside = previous >= m_first && previous <= m_second;
+                return inside && !was_inside;
+            }
+            case Op::ABOVE:
+            case Op::BELOW: {
+                bool beyond = m_op == Op::ABOVE ? current > m_first : current < m_first;
+                bool rearm = m_op == Op::ABOVE ? current < m_first - m_second : current > m_first + m_second;
+
+                // A value, which is already beyond the threshold at the start doesn't fire
+                if (m_armed < 0) {
+                    m_armed = !(m_op == Op::ABOVE ? previous > m_first : previous < m_first);
+                }
+
+                if (m_armed && beyond) {
+                    m_armed = 0;
+                    return true;
+                } else if (!m_armed && rearm) {
+                    m_armed = 1;
+                }
+                return false;
+            }
+            case Op::TRANSITION:
+                // Without wildcards this is the numerical-trigger section, which doesn't require a change
+                return ((m_wildcards & 1) || previous == m_first) && ((m_wildcards & 2) || current == m_second) &&
+                       (!m_wildcards || previous != current);
+            case Op::STRING_MATCH:
+            case Op::STRING_TRANSITION:
+                return false;
+        }
+
+        return false;
+    }
+
+    bool TriggerCondition::evaluate_string(const std::string &previous, const std::string &current) const {
+        switch (m_op) {
+            case Op::CHANGE:
+                return previous != current;
+            case Op::STRING_MATCH:
+                return std::regex_match(current, m_to) && !std::regex_match(previous, m_to);
+            case Op::STRING_TRANSITION:
+                return std::regex_match(current, m_to) && std::regex_match(previous, m_from);
+            default:
+                return false;
+        }
+    }
+
+    // Without an element the condition is evaluated for every element, thresholds only with an element (see accepts)
+    bool TriggerCondition::evaluate_array(const WordArray &previous, const WordArray &current) {
+        if (previous.type != current.type || previous.words.size() != current.words.size()) {
+            return false;
+        }
+
+        if (m_element >= 0) {
+            size_t element = m_element;
+            return element < current.words.size() &&
+                   evaluate_numeric(previous.element(element), current.element(element));
+        }
+
+        if (m_op == Op::ABOVE || m_op == Op::BELOW || (previous == current && !fires_without_change())) {
+            return false;
+        }
+
+        bool fired = false;
+        for (size_t element = 0; element < current.words.size(); ++element) {
+            fired |= evaluate_numeric(previous.element(element), current.element(element));
+        }
+
+        return fired;
+    }
+
+    TriggerCondition read_trigger_condition(const confusepp::Section &section, const OptionValue &value) {
+        std::optional<TriggerCondition> condition;
+
+        if (auto trigger = section.get<confusepp::Option<std::string>>(Config::Constants::trigger);
+            trigger && !trigger->value().empty()) {
+            condition = TriggerCondition::parse(trigger->value());
+
+            if (!condition) {
+                logger.warn("Couldn't parse trigger {0} of action {1}", trigger->value(), section.title());
+            }
+        }
+
+        if (!condition && std::holds_alternative<std::string>(value)) {
+            std::string from_value = Config::Constants::from_value_def_str;
+            std::string to_value = Config::Constants::to_value_def_str;
+
+            if (auto trigger_section = section.get<confusepp::Section>(Config::Constants::string_trigger);
+                trigger_section) {
+                if (auto string_value =
+                        trigger_section->get<confusepp::Option<std::string>>(Config::Constants::from_value);
+                    string_value) {
+                    from_value = string_value->value();
+                }
+
+                if (auto string_value =
+                        trigger_section->get<confusepp::Option<std::string>>(Config::Constants::to_value);
+                    string_value) {
+                    to_value = string_value->value();
+                }
+            } else {
+                logger.warn("No trigger values were set for action {0}", section.title());
+            }
+
+            try {
+                condition = TriggerCondition::string_transition(from_value, to_value);
+            } catch (std::regex_error) {
+                logger.warn("Couldn't compile regular expressions for action {0}", section.title());
+                condition = TriggerCondition::string_transition(Config::Constants::from_value_def_str,
+                                                                Config::Constants::to_value_def_str);
+            }
+        } else if (!condition) {
+            int from_value = Config::Constants::from_value_def_int;
+            int to_value = Config::Constants::to_value_def_int;
+
+            if (auto trigger_section = section.get<confusepp::Section>(Config::Constants::numerical_trigger);
+                trigger_section) {
+                if (auto int_value = trigger_section->get<confusepp::Option<int>>(Config::Constants::from_value);
+                    int_value) {
+                    from_value = int_value->value();
+                }
+
+                if (auto int_value = trigger_section->get<confusepp::Option<int>>(Config::Constants::to_value);
+                    int_value) {
+                    to_value = int_value->value();
+                }
+            } else {
+                logger.warn("No trigger values were set for action {0}", section.title());
+            }
+
+            condition = TriggerCondition::transition(from_value, to_value);
+        }
+
+        if (!condition->accepts(value)) {
+            logger.warn("Trigger of action {0} doesn't match the type of its option", section.title());
+        }
+
+        return *condition;
+    }
+}  // namespace scanbdpp
@@ -4,12 +4,13 @@
 #include <chrono>
 #include <thread>
 
-#include "spdlog/spdlog.h"
 #include "udevpp.h"
 
 #include "device_events.h"
+#include "logging.h"
 #include "sane.h"
 #include "signal_handler.h"
+#include "trace.h"
 
 namespace scanbdpp {
     UDevHandler::UDevHandler() {
@@ -41,13 +42,15 @@ namespace scanbdpp {
                     auto device = device_monitor.receive_device();
 
                     if (device) {
+                        SCANBDPP_TRACE_SPAN("udev event");
+
                         if (device->get_device_type() == Constants::device_type) {
                             if (device->get_action() == Constants::add_action) {
-                                spdlog::get("logger")->info("Device added");
+                                logger.repeating_info("Device added");
                                 device_events.device_added();
                             } else if (device->get_action() == Constants::remove_action) {
                                 device_events.device_removed();
-                                spdlog::get("logger")->info("Device removed");
+                                logger.repeating_info("Device removed");
                             }
                         }
                     } else {
@@ -64,7 +67,7 @@ namespace scanbdpp {
         if (!_thread_started) {
             _thread_started = true;
             _thread_inst = std::thread(udev_thread);
-            spdlog::get("logger")->info("Started udev thread");
+            logger.info("Started udev thread");
         }
     }
 
@@ -76,9 +79,9 @@ namespace scanbdpp {
             if (_thread_inst.joinable()) {
                 _thread_inst.join();
                 _thread_started = false;
-                spdlog::get("logger")->info("Stopped udev thread");
+                logger.info("Stopped udev thread");
             } else {
-                spdlog::get("logger")->info("Couldn't join udev thread");
+                logger.info("Couldn't join udev thread");
             }
         }
     }
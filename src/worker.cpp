@@ -0,0 +1,199 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+// clang-format on
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include "logging.h"
+#include "output.h"
+#include "worker.h"
+
+namespace scanbdpp {
+
+    ScriptWorker::ScriptWorker(const std::string &name, std::shared_ptr<Script> script, Environment environment)
+        : m_name(name), m_script(std::move(script)), m_environment(std::move(environment)) {
+        m_environment.add("SCANBD_WORKER", "1");
+        m_pending.reserve(Constants::max_pending_size);
+        start();
+    }
+
+    ScriptWorker::~ScriptWorker() { stop(); }
+
+    const std::string &ScriptWorker::name() const { return m_name; }
+
+    unsigned long ScriptWorker::dropped() const { return m_dropped; }
+
+    int ScriptWorker::pid_fd() const { return m_pid_fd; }
+
+    bool ScriptWorker::start() {
+        m_last_start = std::chrono::steady_clock::now();
+
+        int fds[2];
+
+        if (pipe2(fds, O_CLOEXEC) < 0) {
+            logger.critical("Couldn't create pipe for worker {0} {1}", m_name, strerror(errno));
+            return false;
+        }
+
+        OutputCapture capture;
+        std::vector<Redirection> redirections{{fds[0], STDIN_FILENO}};
+        capture.add_redirections(redirections);
+
+        char *const argv[] = {const_cast<char *>(m_script->path().c_str()), nullptr};
+        char *const *envp = m_environment.envp();
+
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            logger.critical("Can't fork worker {0} {1}", m_name, strerror(errno));
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        } else if (pid == 0) {
+            detail::exec_script(m_script->fd(), argv, envp, redirections.data(), redirections.size());
+        }
+
+        capture.started(m_name, pid);
+        close(fds[0]);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+#ifdef SYS_pidfd_open
+        m_pid_fd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+
+        m_pid = pid;
+        m_stdin = fds[1];
+        m_pending.clear();
+
+        logger.info("Started worker {0} ({1})", m_name, m_pid);
+        return true;
+    }
+
+    void ScriptWorker::stop() {
+        if (m_pid < 0) {
+            return;
+        }
+
+        // A worker should exit, when its stdin is closed
+        close(m_stdin);
+        m_stdin = -1;
+
+        auto stop_time = std::chrono::steady_clock::now() + Constants::stop_grace;
+        while (waitpid(m_pid, nullptr, WNOHANG) == 0) {
+            if (std::chrono::steady_clock::now() > stop_time) {
+                kill(m_pid, SIGTERM);
+                waitpid(m_pid, nullptr, 0);
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        logger.info("Stopped worker {0} ({1})", m_name, m_pid);
+
+        if (m_pid_fd >= 0) {
+            close(m_pid_fd);
+            m_pid_fd = -1;
+        }
+        m_pid = -1;
+    }
+
+    // Doubles the backoff for every exit, unless the worker ran for stable_time
+    void ScriptWorker::reap() {
+        int status = 0;
+
+        if (m_pid < 0 || waitpid(m_pid, &status, WNOHANG) == 0) {
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (now - m_last_start >= Constants::stable_time || !m_backoff.count()) {
+            m_backoff = Constants::min_backoff;
+        } else {
+            m_backoff = std::min<std::chrono::milliseconds>(m_backoff * 2, Constants::max_backoff);
+        }
+        m_next_start = now + m_backoff;
+
+        logger.warn("Worker {0} ({1}) has exited with status {2}, restarting it in {3} ms", m_name, m_pid, status,
+                    m_backoff.count());
+        close(m_stdin);
+        m_stdin = -1;
+
+        if (m_pid_fd >= 0) {
+            close(m_pid_fd);
+            m_pid_fd = -1;
+        }
+        m_pid = -1;
+
+        if (!m_pending.empty()) {
+            ++m_dropped;
+            m_pending.clear();
+        }
+    }
+
+    // Restarts the worker, once its backoff has passed
+    bool ScriptWorker::alive() {
+        reap();
+
+        if (m_pid > 0) {
+            return true;
+        }
+
+        if (std::chrono::steady_clock::now() < m_next_start) {
+            return false;
+        }
+
+        return start();
+    }
+
+    // Called every poll cycle, even without pending events, so an exited worker doesn't stay a zombie
+    void ScriptWorker::flush() {
+        if (!alive() || m_pending.empty()) {
+            return;
+        }
+
+        ssize_t written = write(m_stdin, m_pending.data(), m_pending.size());
+
+        if (written > 0) {
+            m_pending.erase(m_pending.begin(), m_pending.begin() + written);
+        } else if (written < 0 && errno == EPIPE) {
+            // The worker can't get any events, it is restarted once it exited
+            logger.warn("Worker {0} ({1}) closed its stdin, stopping it", m_name, m_pid);
+            kill(m_pid, SIGTERM);
+            ++m_dropped;
+            m_pending.clear();
+            reap();
+        }
+    }
+
+    bool ScriptWorker::send(std::string_view entries) {
+        flush();
+
+        uint32_t length = entries.size();
+        unsigned char header[sizeof(length)];
+        for (size_t index = 0; index < sizeof(header); ++index) {
+            header[index] = (length >> (8 * index)) & 0xff;
+        }
+
+        if (m_pending.size() + sizeof(header) + entries.size() > Constants::max_pending_size) {
+            ++m_dropped;
+            logger.warn("Worker {0} can't keep up, dropped {1} events so far", m_name, m_dropped);
+            return false;
+        }
+
+        m_pending.insert(m_pending.end(), header, header + sizeof(header));
+        m_pending.insert(m_pending.end(), entries.begin(), entries.end());
+
+        flush();
+        return true;
+    }
+}  // namespace scanbdpp
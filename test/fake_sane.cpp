@@ -0,0 +1,286 @@
+#include <sane/sane.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "fake_sane.h"
+
+namespace scanbdpp::fake {
+    namespace {
+        struct FakeDevice {
+            std::string name;
+            SANE_Device info;
+            // Per button, it is pressed until this time (steady clock in ns)
+            std::unique_ptr<std::atomic<int64_t>[]> pressed_until;
+        };
+
+        struct FakeHandle {
+            FakeDevice *device;
+        };
+
+        enum struct OptionKind { BUTTON, SENSOR, STATUS };
+
+        // Longer than the small string buffer of std::string
+        constexpr const char status_text[] = "document feeder loaded, waiting for the scan button";
+        constexpr SANE_Int status_size = 64;
+
+        FakeSane::Settings settings;
+        std::vector<std::unique_ptr<FakeDevice>> devices;
+        std::vector<const SANE_Device *> device_list{nullptr};
+        std::vector<std::string> option_names;
+        std::vector<SANE_Option_Descriptor> descriptors;
+        // Kind and index within the kind per option (without option 0)
+        std::vector<std::pair<OptionKind, size_t>> option_kinds;
+        std::atomic<uint64_t> read_count = 0;
+        std::atomic<uint64_t> open_count = 0;
+        std::atomic<size_t> open_handles = 0;
+
+        int64_t now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        SANE_Option_Descriptor option(const char *name, const char *title, SANE_Value_Type type,
+                                      SANE_Int size = sizeof(SANE_Word)) {
+            SANE_Option_Descriptor descriptor{};
+            descriptor.name = name;
+            descriptor.title = title;
+            descriptor.desc = title;
+            descriptor.type = type;
+            descriptor.unit = SANE_UNIT_NONE;
+            descriptor.size = size;
+            descriptor.cap = SANE_CAP_SOFT_DETECT | SANE_CAP_HARD_SELECT;
+            descriptor.constraint_type = SANE_CONSTRAINT_NONE;
+            return descriptor;
+        }
+    }  // namespace
+
+    void FakeSane::configure(const Settings &new_settings) {
+        if (open_handles) {
+            throw std::logic_error("fake devices are still open");
+        }
+
+        settings = new_settings;
+        settings.devices_per_bus = std::max<size_t>(settings.devices_per_bus, 1);
+
+        devices.clear();
+        device_list.clear();
+
+        for (size_t index = 0; index < settings.devices; ++index) {
+            auto device = std::make_unique<FakeDevice>();
+            device->name = device_name(index);
+            device->info = SANE_Device{device->name.c_str(), "scanbdpp", "fake", "virtual device"};
+            device->pressed_until = std::make_unique<std::atomic<int64_t>[]>(settings.options);
+            device_list.push_back(&device->info);
+            devices.push_back(std::move(device));
+        }
+
+        device_list.push_back(nullptr);
+
+        option_names.clear();
+        option_kinds.clear();
+        for (size_t index = 0; index < settings.options; ++index) {
+            option_names.push_back("button-" + std::to_string(index));
+            option_kinds.emplace_back(OptionKind::BUTTON, index);
+        }
+        for (size_t index = 0; index < settings.fixed_options; ++index) {
+            option_names.push_back("sensor-" + std::to_string(index));
+            option_kinds.emplace_back(OptionKind::SENSOR, index);
+        }
+        for (size_t index = 0; index < settings.string_options; ++index) {
+            option_names.push_back("status-" + std::to_string(index));
+            option_kinds.emplace_back(OptionKind::STATUS, index);
+        }
+
+        // Option 0 is the number of options (SANE_NAME_NUM_OPTIONS is ""), the names don't move anymore
+        descriptors.clear();
+        descriptors.push_back(option("", "Number of options", SANE_TYPE_INT));
+        for (size_t index = 0; index < option_names.size(); ++index) {
+            switch (option_kinds[index].first) {
+                case OptionKind::BUTTON:
+                    descriptors.push_back(option(option_names[index].c_str(), "Button", SANE_TYPE_INT));
+                    break;
+                case OptionKind::SENSOR:
+                    descriptors.push_back(option(option_names[index].c_str(), "Temperature", SANE_TYPE_FIXED));
+                    break;
+                case OptionKind::STATUS:
+                    descriptors.push_back(
+                        option(option_names[index].c_str(), "Status", SANE_TYPE_STRING, status_size));
+                    break;
+            }
+        }
+    }
+
+    std::chrono::steady_clock::time_point FakeSane::press(size_t device, size_t option,
+                                                          std::chrono::milliseconds hold) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (device < devices.size() && option < settings.options) {
+            devices[device]->pressed_until[option].store(
+                std::chrono::duration_cast<std::chrono::nanoseconds>((now + hold).time_since_epoch()).count(),
+                std::memory_order_relaxed);
+        }
+
+        return now;
+    }
+
+    std::string FakeSane::device_name(size_t device) {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "fake:libusb:%03zu:%03zu", device / settings.devices_per_bus + 1,
+                      device % settings.devices_per_bus + 2);
+        return buf;
+    }
+
+    uint64_t FakeSane::reads() { return read_count.load(std::memory_order_relaxed); }
+
+    uint64_t FakeSane::opens() { return open_count.load(std::memory_order_relaxed); }
+}  // namespace scanbdpp::fake
+
+using namespace scanbdpp::fake;
+
+extern "C" {
+SANE_Status sane_init(SANE_Int *version_code, SANE_Auth_Callback) {
+    if (version_code) {
+        *version_code = SANE_VERSION_CODE(SANE_CURRENT_MAJOR, 0, 0);
+    }
+
+    return SANE_STATUS_GOOD;
+}
+
+void sane_exit(void) {}
+
+SANE_Status sane_get_devices(const SANE_Device ***device_list_out, SANE_Bool) {
+    *device_list_out = device_list.data();
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status sane_open(SANE_String_Const name, SANE_Handle *handle) {
+    for (const auto &current_device : devices) {
+        if (current_device->name != name) {
+            continue;
+        }
+
+        std::this_thread::sleep_for(settings.open_latency);
+        *handle = new FakeHandle{current_device.get()};
+        ++open_handles;
+        open_count.fetch_add(1, std::memory_order_relaxed);
+        return SANE_STATUS_GOOD;
+    }
+
+    return SANE_STATUS_INVAL;
+}
+
+void sane_close(SANE_Handle handle) {
+    delete static_cast<FakeHandle *>(handle);
+    --open_handles;
+}
+
+const SANE_Option_Descriptor *sane_get_option_descriptor(SANE_Handle, SANE_Int option) {
+    if (option < 0 || static_cast<size_t>(option) >= descriptors.size()) {
+        return nullptr;
+    }
+
+    return &descriptors[option];
+}
+
+// All options are read only sensors
+SANE_Status sane_control_option(SANE_Handle handle, SANE_Int option, SANE_Action action, void *value,
+                                SANE_Int *info) {
+    if (option < 0 || static_cast<size_t>(option) >= descriptors.size()) {
+        return SANE_STATUS_INVAL;
+    }
+
+    if (action != SANE_ACTION_GET_VALUE) {
+        return SANE_STATUS_INVAL;
+    }
+
+    if (info) {
+        *info = 0;
+    }
+
+    if (option == 0) {
+        *static_cast<SANE_Word *>(value) = static_cast<SANE_Word>(descriptors.size());
+        return SANE_STATUS_GOOD;
+    }
+
+    if (settings.read_latency.count()) {
+        std::this_thread::sleep_for(settings.read_latency);
+    }
+
+    auto device = static_cast<FakeHandle *>(handle)->device;
+    auto reads = read_count.fetch_add(1, std::memory_order_relaxed);
+    auto [kind, index] = option_kinds[option - 1];
+
+    switch (kind) {
+        case OptionKind::BUTTON:
+            *static_cast<SANE_Word *>(value) =
+                now_ns() < device->pressed_until[index].load(std::memory_order_relaxed) ? 1 : 0;
+            break;
+        case OptionKind::SENSOR:
+            *static_cast<SANE_Word *>(value) = SANE_FIX(20.0 + static_cast<double>(reads % 100) / 10);
+            break;
+        case OptionKind::STATUS:
+            std::strncpy(static_cast<char *>(value), status_text, status_size - 1);
+            static_cast<char *>(value)[status_size - 1] = '\0';
+            break;
+    }
+
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status sane_get_parameters(SANE_Handle, SANE_Parameters *) { return SANE_STATUS_INVAL; }
+
+// The fake devices have an empty document feeder
+SANE_Status sane_start(SANE_Handle) { return SANE_STATUS_NO_DOCS; }
+
+SANE_Status sane_read(SANE_Handle, SANE_Byte *, SANE_Int, SANE_Int *length) {
+    *length = 0;
+    return SANE_STATUS_EOF;
+}
+
+void sane_cancel(SANE_Handle) {}
+
+SANE_Status sane_set_io_mode(SANE_Handle, SANE_Bool non_blocking) {
+    return non_blocking ? SANE_STATUS_UNSUPPORTED : SANE_STATUS_GOOD;
+}
+
+SANE_Status sane_get_select_fd(SANE_Handle, SANE_Int *) { return SANE_STATUS_UNSUPPORTED; }
+
+SANE_String_Const sane_strstatus(SANE_Status status) {
+    switch (status) {
+        case SANE_STATUS_GOOD:
+            return "Success";
+        case SANE_STATUS_UNSUPPORTED:
+            return "Operation not supported";
+        case SANE_STATUS_CANCELLED:
+            return "Operation was cancelled";
+        case SANE_STATUS_DEVICE_BUSY:
+            return "Device busy";
+        case SANE_STATUS_INVAL:
+            return "Invalid argument";
+        case SANE_STATUS_EOF:
+            return "End of file reached";
+        case SANE_STATUS_JAMMED:
+            return "Document feeder jammed";
+        case SANE_STATUS_NO_DOCS:
+            return "Document feeder out of documents";
+        case SANE_STATUS_COVER_OPEN:
+            return "Scanner cover is open";
+        case SANE_STATUS_IO_ERROR:
+            return "Error during device I/O";
+        case SANE_STATUS_NO_MEM:
+            return "Out of memory";
+        case SANE_STATUS_ACCESS_DENIED:
+            return "Access to resource has been denied";
+        default:
+            return "Unknown SANE status code";
+    }
+}
+}
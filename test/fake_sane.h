@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace scanbdpp::fake {
+    // A SANE backend without hardware, which is linked instead of libsane into the tests and scanbdpp_bench (the
+    // static library scanbdpp_fake_sane), so sanepp and the polling engine run unchanged. Every device has the options
+    // - "button-0" .. "button-<options - 1>" (int, 0 while released)
+    // - "sensor-0" .. "sensor-<fixed_options - 1>" (fixed, a temperature, which changes with every read)
+    // - "status-0" .. "status-<string_options - 1>" (string, longer than the small string buffer)
+    // Each read takes read_latency. Devices are spread over USB buses (fake:libusb:<bus>:<device>), so the bus
+    // scheduling of scanbd is measured as well.
+    class FakeSane {
+       public:
+        struct Settings {
+            size_t devices = 1;
+            size_t options = 1;
+            size_t fixed_options = 0;
+            size_t string_options = 0;
+            size_t devices_per_bus = 4;
+            std::chrono::microseconds read_latency = std::chrono::microseconds(200);
+            std::chrono::microseconds open_latency = std::chrono::milliseconds(5);
+        };
+
+        // Only allowed while no device is open
+        static void configure(const Settings &settings);
+
+        // The button reads 1 from now on for hold, returns the time of the press
+        static std::chrono::steady_clock::time_point press(size_t device, size_t option,
+                                                           std::chrono::milliseconds hold);
+
+        static std::string device_name(size_t device);
+        static uint64_t reads();
+        static uint64_t opens();
+    };
+}  // namespace scanbdpp::fake
@@ -0,0 +1,152 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <stdlib.h>
+// clang-format on
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+#include <new>
+#include <thread>
+
+#include "config.h"
+#include "fake_sane.h"
+#include "run_configuration.h"
+#include "sane.h"
+
+// Polls fake devices (see fake_sane.h) with int, fixed and string options and fails, if the poll threads allocate
+// once the device is opened and the config is matched. Every operator new of the process is counted, so the main
+// thread only sleeps while measuring.
+using namespace scanbdpp;
+using namespace scanbdpp::fake;
+namespace fs = std::experimental::filesystem;
+
+namespace {
+    std::atomic<uint64_t> allocations = 0;
+
+    constexpr size_t devices = 4;
+    constexpr size_t options = 4;
+    constexpr size_t fixed_options = 2;
+    constexpr size_t string_options = 2;
+    constexpr size_t polled_options = options + fixed_options + string_options;
+    constexpr uint64_t cycles = 200;
+    constexpr std::chrono::milliseconds timeout{5};
+    constexpr std::chrono::seconds max_duration{30};
+
+    void write_config(const fs::path &path) {
+        std::ofstream config_file(path);
+        config_file << "global {\n"
+                    << "    timeout = " << timeout.count() << "\n"
+                    << "    multiple_actions = true\n"
+                    << "    action press {\n"
+                    << "        filter = \"^button-.*\"\n"
+                    << "        numerical-trigger {\n"
+                    << "            from-value = 0\n"
+                    << "            to-value = 1\n"
+                    << "        }\n"
+                    << "        script = \"/bin/true\"\n"
+                    << "    }\n"
+                    << "    action overheat {\n"
+                    << "        filter = \"^sensor-.*\"\n"
+                    << "        trigger = \"above 1000\"\n"
+                    << "        script = \"/bin/true\"\n"
+                    << "    }\n"
+                    << "    action jam {\n"
+                    << "        filter = \"^status-.*\"\n"
+                    << "        string-trigger {\n"
+                    << "            from-value = \".*\"\n"
+                    << "            to-value = \"^jammed$\"\n"
+                    << "        }\n"
+                    << "        script = \"/bin/true\"\n"
+                    << "    }\n"
+                    << "}\n";
+    }
+
+    // Waits until the options of all devices were read reads times more
+    bool wait_reads(uint64_t reads) {
+        auto end = std::chrono::steady_clock::now() + max_duration;
+
+        for (auto start = FakeSane::reads(); FakeSane::reads() - start < reads;) {
+            if (std::chrono::steady_clock::now() > end) {
+                return false;
+            }
+
+            std::this_thread::sleep_for(timeout);
+        }
+
+        return true;
+    }
+}  // namespace
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *memory = std::malloc(size ? size : 1); memory) {
+        return memory;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+
+int main() {
+    char directory_template[] = "/tmp/scanbdpp_test.XXXXXX";
+    if (!mkdtemp(directory_template)) {
+        std::fprintf(stderr, "Couldn't create a temporary directory %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    fs::path directory = directory_template;
+    write_config(directory / "scanbd.conf");
+
+    RunConfiguration run_config;
+    run_config.foreground(true);
+    run_config.config_path(directory / "scanbd.conf");
+
+    if (Config config; !config) {
+        std::fprintf(stderr, "Couldn't load the generated config\n");
+        fs::remove_all(directory);
+        return EXIT_FAILURE;
+    }
+
+    FakeSane::Settings settings;
+    settings.devices = devices;
+    settings.options = options;
+    settings.fixed_options = fixed_options;
+    settings.string_options = string_options;
+    settings.read_latency = std::chrono::microseconds(0);
+    settings.open_latency = std::chrono::microseconds(0);
+    FakeSane::configure(settings);
+
+    SaneHandler sane;
+    sane.start();
+
+    // The first cycles fill the buffers of the polled options
+    bool polled = wait_reads(10 * devices * polled_options);
+
+    uint64_t allocations_before = allocations.load(std::memory_order_relaxed);
+    polled = polled && wait_reads(cycles * devices * polled_options);
+    uint64_t allocated = allocations.load(std::memory_order_relaxed) - allocations_before;
+
+    sane.stop();
+    fs::remove_all(directory);
+
+    if (!polled) {
+        std::fprintf(stderr, "The fake devices weren't polled %llu times within %lld s\n",
+                     static_cast<unsigned long long>(cycles), static_cast<long long>(max_duration.count()));
+        return EXIT_FAILURE;
+    }
+
+    std::printf("%llu allocations in %llu poll cycles of %zu devices with %zu options\n",
+                static_cast<unsigned long long>(allocated), static_cast<unsigned long long>(cycles), devices,
+                polled_options);
+    return allocated == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
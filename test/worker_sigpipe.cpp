@@ -0,0 +1,134 @@
+// clang-format off
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+// clang-format on
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "config.h"
+#include "environment.h"
+#include "run_configuration.h"
+#include "script.h"
+#include "signal_handler.h"
+#include "worker.h"
+
+// Sends events to a worker, which closed its stdin, and to a worker, which was killed. Both writes hit a pipe
+// without reader, the daemon has to survive them and restart the worker.
+using namespace scanbdpp;
+namespace fs = std::experimental::filesystem;
+
+namespace {
+    constexpr std::chrono::seconds max_duration{10};
+
+    // The first worker closes its stdin right away, every worker records its pid, so the test can kill it
+    void write_script(const fs::path &path, const fs::path &pid_path) {
+        {
+            std::ofstream script_file(path);
+            script_file << "#!/bin/sh\n"
+                        << "if [ ! -e " << pid_path.native() << ".closed ]; then\n"
+                        << "    touch " << pid_path.native() << ".closed\n"
+                        << "    exec 0<&-\n"
+                        << "fi\n"
+                        << "echo $$ > " << pid_path.native() << ".tmp\n"
+                        << "mv " << pid_path.native() << ".tmp " << pid_path.native() << "\n"
+                        << "exec sleep 60\n";
+        }
+
+        chmod(path.c_str(), S_IRWXU);
+    }
+
+    pid_t read_pid(const fs::path &pid_path) {
+        std::ifstream pid_file(pid_path);
+        pid_t pid = -1;
+        pid_file >> pid;
+        return pid_file ? pid : -1;
+    }
+
+    // Keeps sending events, until a worker other than previous has written its pid
+    pid_t wait_restart(ScriptWorker &worker, const fs::path &pid_path, pid_t previous) {
+        auto end = std::chrono::steady_clock::now() + max_duration;
+
+        while (std::chrono::steady_clock::now() < end) {
+            worker.send(std::string("SCANBD_ACTION=press") + '\0');
+
+            if (pid_t pid = read_pid(pid_path); pid > 0 && pid != previous) {
+                return pid;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        return -1;
+    }
+}  // namespace
+
+int main() {
+    char directory_template[] = "/tmp/scanbdpp_test.XXXXXX";
+    if (!mkdtemp(directory_template)) {
+        std::fprintf(stderr, "Couldn't create a temporary directory %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    fs::path directory = directory_template;
+    fs::path pid_path = directory / "worker.pid";
+
+    std::ofstream(directory / "scanbd.conf") << "global {\n}\n";
+    write_script(directory / "worker.script", pid_path);
+
+    RunConfiguration run_config;
+    run_config.foreground(true);
+    run_config.config_path(directory / "scanbd.conf");
+
+    // Same signal dispositions as the daemon
+    SignalHandler signal_handler;
+    signal_handler.install();
+
+    int fd = open((directory / "worker.script").c_str(), O_PATH | O_CLOEXEC);
+    if (fd < 0) {
+        std::fprintf(stderr, "Couldn't open the worker script %s\n", strerror(errno));
+        fs::remove_all(directory);
+        return EXIT_FAILURE;
+    }
+
+    bool restarted = false;
+
+    {
+        ScriptWorker worker("sigpipe", std::make_shared<Script>(directory / "worker.script", fd), Environment());
+
+        // The first worker closed its stdin and is restarted, the second one is killed
+        pid_t first = wait_restart(worker, pid_path, -1);
+        pid_t second = first > 0 ? wait_restart(worker, pid_path, first) : -1;
+
+        if (second > 0) {
+            kill(second, SIGKILL);
+            restarted = wait_restart(worker, pid_path, second) > 0;
+        }
+
+        if (pid_t pid = read_pid(pid_path); pid > 0) {
+            kill(pid, SIGKILL);
+        }
+    }
+
+    fs::remove_all(directory);
+
+    if (!restarted) {
+        std::fprintf(stderr, "The worker wasn't restarted within %lld s\n",
+                     static_cast<long long>(max_duration.count()));
+        return EXIT_FAILURE;
+    }
+
+    std::printf("Survived writes to a closed and to a killed worker\n");
+    return EXIT_SUCCESS;
+}